@@ -22,6 +22,11 @@
 #include <functiondiscoverykeys_devpkey.h>
 #include <sstream>  
 #include <windows.h>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <atomic>
+#include "KbStore.h"
 
 #pragma comment(lib, "Ole32.lib")
 #ifdef _DEBUG
@@ -32,7 +37,8 @@
 // returning it as UTF-8/ANSI (CStringA).
 // Commonly used to call Python/toolchains
 // (such as RAG query, pandoc, pdftotext, etc.) and get their output.
-CStringA RunCmdCaptureStdout(const CString& cmd)
+// `env` is an optional environment block (see PythonUtf8Environment).
+CStringA RunCmdCaptureStdout(const CString& cmd, const wchar_t* env)
 {
 	SECURITY_ATTRIBUTES sa{ sizeof(sa), nullptr, TRUE };
 	HANDLE hRead{}, hWrite{};
@@ -47,8 +53,9 @@ CStringA RunCmdCaptureStdout(const CString& cmd)
 	si.wShowWindow = SW_HIDE;
 
 	wchar_t bufCmd[1024];  wcsncpy_s(bufCmd, cmd, _TRUNCATE);
+	DWORD flags = CREATE_NO_WINDOW | (env ? CREATE_UNICODE_ENVIRONMENT : 0);
 	if (!CreateProcessW(nullptr, bufCmd, nullptr, nullptr, TRUE,
-		CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi))
+		flags, (LPVOID)env, nullptr, &si, &pi))
 	{
 		CloseHandle(hRead); CloseHandle(hWrite);
 		return "cmd fail";
@@ -65,10 +72,42 @@ CStringA RunCmdCaptureStdout(const CString& cmd)
 	return CStringA(out.c_str(), (int)out.size());
 }
 
+// [Function] Environment block for the Python tools: the current environment plus
+// PYTHONUTF8=1 / PYTHONIOENCODING=utf-8. Passing it to CreateProcess instead of
+// toggling our own environment keeps concurrent tool runs (UI + note sync) independent.
+const wchar_t* PythonUtf8Environment()
+{
+	static const std::wstring block = [] {
+		std::wstring out;
+		LPWCH env = GetEnvironmentStringsW();
+		for (LPCWSTR p = env; p && *p; p += wcslen(p) + 1)
+		{
+			if (_wcsnicmp(p, L"PYTHONUTF8=", 11) == 0 || _wcsnicmp(p, L"PYTHONIOENCODING=", 17) == 0)
+				continue;
+			out.append(p);
+			out.push_back(L'\0');
+		}
+		if (env) FreeEnvironmentStringsW(env);
+		out.append(L"PYTHONUTF8=1");
+		out.push_back(L'\0');
+		out.append(L"PYTHONIOENCODING=utf-8");
+		out.push_back(L'\0');
+		out.push_back(L'\0');
+		return out;
+	}();
+	return block.c_str();
+}
+
+std::mutex& KbWriteMutex()
+{
+	static std::mutex m;
+	return m;
+}
+
 // === Get Program Directory ===
 //[Function]Get the directory where the current executable file is located,
 // which is convenient for locating relative path resources (models, tools, kb, etc.)
-static CString GetExeDir()
+CString GetExeDir()
 {
 	wchar_t buf[MAX_PATH]{};
 	GetModuleFileNameW(nullptr, buf, MAX_PATH);
@@ -77,7 +116,7 @@ static CString GetExeDir()
 }
 
 // === If the directory does not exist, create it ===
-static void EnsureDir(const CString& path)
+void EnsureDir(const CString& path)
 {
 	if (!PathFileExistsW(path))
 		CreateDirectoryW(path, nullptr);
@@ -304,6 +343,9 @@ BEGIN_MESSAGE_MAP(CAIassistantDlg, CDialogEx)
 	ON_WM_DROPFILES()        
 	ON_BN_CLICKED(IDC_BUTTON_RECORD, &CAIassistantDlg::OnBnClickedButtonRecord)
 	ON_BN_CLICKED(IDC_BUTTON_RAG, &CAIassistantDlg::OnBnClickedButtonRag)
+	ON_WM_DESTROY()
+	ON_MESSAGE(WM_NOTESYNC_STATUS, &CAIassistantDlg::OnNoteSyncStatus)
+	ON_MESSAGE(WM_RAG_FINISHED, &CAIassistantDlg::OnRagFinished)
 END_MESSAGE_MAP()
 
 
@@ -332,6 +374,23 @@ BOOL CAIassistantDlg::OnInitDialog()
 		SWP_NOMOVE | SWP_NOSIZE);
 	// Make the dialog accept drag and drop files
 	DragAcceptFiles(TRUE);
+
+	// QOwnNotes passes its note folder: keep the kb in sync with it in the background
+	GetWindowTextW(m_baseTitle);
+	int argc = 0;
+	LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+	for (int i = 1; argv && i + 1 < argc; ++i)
+	{
+		if (wcscmp(argv[i], L"--note-folder") == 0)
+		{
+			CString kbDir = GetExeDir() + L"\\kb";
+			EnsureDir(kbDir);
+			if (m_noteSync.Start(argv[i + 1], kbDir, m_hWnd))
+				SetWindowTextW(m_baseTitle + L" - syncing notes…");
+			break;
+		}
+	}
+	if (argv) LocalFree(argv);
 	
 	return TRUE;
 	SetIcon(m_hIcon, TRUE);		
@@ -432,17 +491,17 @@ void CAIassistantDlg::OnBnClickedButton1()
 		CString kbDir = exeDir + L"\\kb";
 		EnsureDir(kbDir);
 
-		// 2 Assemble command line (UTF-8 output)
-		CString cmdLine;
-		cmdLine.Format(L"\"%s\" \"%s\" --kb \"%s\"",
-			(LPCTSTR)ragExe, (LPCTSTR)prompt, (LPCTSTR)kbDir);
-		SetEnvironmentVariableW(L"PYTHONUTF8", L"1");
-		SetEnvironmentVariableW(L"PYTHONIOENCODING", L"utf-8");
-		// 3 Run and capture stdout
-		CStringA outA = RunCmdCaptureStdout(cmdLine);     
-		SetEnvironmentVariableW(L"PYTHONUTF8", nullptr);
-		SetEnvironmentVariableW(L"PYTHONIOENCODING", nullptr);
-		CString  ragPrompt = CA2W(outA, CP_UTF8);       
+		// 2 Native kb (mapped segments) first; fall back to the Python retriever
+		CString ragPrompt = BuildNativeRagPrompt(prompt);
+		if (ragPrompt.IsEmpty())
+		{
+			// 3 Assemble command line (UTF-8 output), run and capture stdout
+			CString cmdLine;
+			cmdLine.Format(L"\"%s\" \"%s\" --kb \"%s\"",
+				(LPCTSTR)ragExe, (LPCTSTR)prompt, (LPCTSTR)kbDir);
+			CStringA outA = RunCmdCaptureStdout(cmdLine, PythonUtf8Environment());
+			ragPrompt = CA2W(outA, CP_UTF8);
+		}
 
 		// 4 As the final prompt to the model
 		userPrompt = ragPrompt;
@@ -587,11 +646,7 @@ void CAIassistantDlg::OnDropFiles(HDROP hDrop)
 	DragFinish(hDrop);
 
 	if (m_ragMode) {                      //  Special branches when RAG is enabled
-		ImportFileToKb(path);
-		CString note;
-		note.Format(L"《%s》 has been added to the knowledge library\r\n", (LPCTSTR)path);
-		m_editInput.ReplaceSel(note);     // Only give prompts, no plain text
-		m_editInput.SetSel(-1, -1);
+		StartRagImport(path);             // Prompt line is written when the import finishes
 		m_lastRagFile = path;             
 		return;
 	}
@@ -926,34 +981,75 @@ void CAIassistantDlg::OnBnClickedButtonRag()
 
 	m_lastRagFile = dlg.GetPathName();
 	m_ragMode = true;                 
-	m_btnRag.EnableWindow(FALSE);        
 
-	// 2 remind user
+	// 2 Import in the background; questions can be asked right away and are
+	// answered from the kb as it was before this file (see StartRagImport)
+	StartRagImport(m_lastRagFile);
+
+	// ---  Keep m_ragMode = true and wait for the next Send event
+	m_btnRag.SetWindowTextW(L"RAG:Input Your Files");
+}
+
+struct RagImportJob {
+	HWND    hWnd;
+	CString path;
+	CString log;
+	bool    ok = false;
+};
+
+static UINT RagImportThread(LPVOID pParam)
+{
+	RagImportJob* job = reinterpret_cast<RagImportJob*>(pParam);
+	job->ok = ImportFileToKb(job->path, &job->log);
+	if (!::PostMessageW(job->hWnd, WM_RAG_FINISHED, 0, (LPARAM)job))
+		delete job;   // Dialog already gone
+	return 0;
+}
+
+// [Function] Convert + embed + publish a file on a worker thread. Retrieval keeps
+// reading the last published kb snapshot meanwhile; the new segment becomes
+// visible to the next question after the manifest is swapped.
+void CAIassistantDlg::StartRagImport(const CString& path)
+{
 	CString note;
-	note.Format(L"[Loading «%s» To The Local Retrieval Library…]\r\n", (LPCTSTR)m_lastRagFile);
+	note.Format(L"[Loading «%s» To The Local Retrieval Library In The Background…]\r\n", (LPCTSTR)path);
 	m_editInput.ReplaceSel(note);
 	m_editInput.SetSel(-1, -1);
 
-	// 3 Synchronously call Python's index_docs.py
-	bool ok = ImportFileToKb(m_lastRagFile);
+	RagImportJob* job = new RagImportJob;
+	job->hWnd = GetSafeHwnd();
+	job->path = path;
+	if (!AfxBeginThread(RagImportThread, job, THREAD_PRIORITY_BELOW_NORMAL)) {
+		delete job;
+		return;
+	}
+	++m_importsRunning;
+}
+
+// [Function] A background import finished: report it and compact the kb.
+LRESULT CAIassistantDlg::OnRagFinished(WPARAM, LPARAM lParam)
+{
+	std::unique_ptr<RagImportJob> job(reinterpret_cast<RagImportJob*>(lParam));
+	--m_importsRunning;
 
-	// 4) Change the prompt line: success or failure
 	CString done;
-	done.Format(ok ? L"[Successfully Load «%s» The Local Retrieval Library]\r\n"
+	done.Format(job->ok ? L"[Successfully Load «%s» The Local Retrieval Library]\r\n"
 		: L"[❌ Fail To Import «%s» ，Please Check]\r\n",
-		(LPCTSTR)m_lastRagFile);
-	m_editInput.ReplaceSel(done);
-	m_editInput.SetSel(-1, -1);
-	// ……The user can then type in the question in the input box.
-	// ---  Restore the button immediately, but keep m_ragMode = true and wait for the next Send event
-	m_btnRag.EnableWindow(TRUE);
-	m_btnRag.SetWindowTextW(L"RAG:Input Your Files");
+		(LPCTSTR)job->path);
+	m_editOutput.SetSel(-1, -1);
+	m_editOutput.ReplaceSel(done);
+	if (!job->ok && !job->log.IsEmpty())
+		AfxMessageBox(job->log);
+	if (job->ok && m_importsRunning == 0)
+		CompactKbInBackground();
+	return 0;
 }
 // [Function] Import files into the knowledge base (KB):
 // - If PDF/DOCX, convert to a temporary UTF-8 .txt file first;
 // - Run index_docs.exe to write/update the KB (if there is no faiss.index for the first time, add --fresh);
-// - Display the build log in a pop-up window; clean up temporary files.
-bool ImportFileToKb(const CString& path)
+// - Return the build log in `log`; clean up temporary files.
+// Blocking: called from RagImportThread, never on the UI thread.
+bool ImportFileToKb(const CString& path, CString* log)
 {
 	// 1 If it is PDF/DOCX → convert to plain text first
 	CString ext = PathFindExtensionW(path);
@@ -977,19 +1073,37 @@ bool ImportFileToKb(const CString& path)
 		CFile file;
 		if (!file.Open(txtPath, CFile::modeCreate | CFile::modeWrite | CFile::typeBinary))
 		{
-			AfxMessageBox(L"can not build txt file");
+			if (log) *log = L"can not build txt file";
 			return false;
 		}
 		file.Write(utf8.GetString(), utf8.GetLength());
 		file.Close();
 	}
-	// b) Call index_docs.exe to write into kb
-	static CString exeDir;
-	if (exeDir.IsEmpty()) {
-		exeDir = GetExeDir();
-	}
+	// b) Write into kb (native segment or index_docs.exe)
+	KbIngestItem item;
+	item.textPath = txtPath;
+	item.sourcePath = path;
+	CString outW;
+	bool ok = IngestFilesToKb({ item }, &outW);
+	if (log) *log = outW;
+
+	// Cleaning up temporary files
+	if (ext == L".pdf" || ext == L".docx")
+		DeleteFileW(txtPath);
+
+	return ok;
+}
+
+// [Function] Run index_docs.exe for one UTF-8 text file against the local kb.
+// Serialised through KbWriteMutex so the RAG button and the note sync thread
+// never write the index at the same time; `log` receives the tool output.
+bool RunIndexDocs(const CString& txtPath, CString* log)
+{
+	static const CString exeDir = GetExeDir();
 	CString kbDir = exeDir + L"\\kb";
 	EnsureDir(kbDir);
+
+	std::lock_guard<std::mutex> lock(KbWriteMutex());
 	// First determine whether it is the first time to build the database; 
 	// if faiss.index is not there, add --fresh
 	CString extra = PathFileExistsW(kbDir + L"\\faiss.index") ? L"" : L" --fresh";
@@ -998,19 +1112,298 @@ bool ImportFileToKb(const CString& path)
 	cmdLine.Format(L"\"%s\" \"%s\" --kb \"%s\"%s",
 		(LPCTSTR)idxExe, (LPCTSTR)txtPath,
 		(LPCTSTR)kbDir, (LPCTSTR)extra);
-	SetEnvironmentVariableW(L"PYTHONUTF8", L"1");
-	SetEnvironmentVariableW(L"PYTHONIOENCODING", L"utf-8");
 	// Direct capture output
-	CStringA outA = RunCmdCaptureStdout(cmdLine);
-	SetEnvironmentVariableW(L"PYTHONUTF8", nullptr);
-	SetEnvironmentVariableW(L"PYTHONIOENCODING", nullptr);
-	CString  outW = CA2W(outA, CP_UTF8);
+	CStringA outA = RunCmdCaptureStdout(cmdLine, PythonUtf8Environment());
+	if (log) *log = CA2W(outA, CP_UTF8);
+	return outA != "cmd fail";
+}
 
-	AfxMessageBox(outW);   
+// ===== Native knowledge base (KbStore.h): chunk → embed → mapped segment =====
+// Used when llama-embedding.exe and its model ship next to the program;
+// otherwise the Python tools (index_docs.exe / rag_query.exe) are used.
+static const wchar_t* kEmbedExe = L"llama-embedding.exe";
+static const wchar_t* kEmbedModel = L"bge-small-en-v1.5-q8_0.gguf";
+static const size_t kChunkBytes = 800;      // Target chunk size (UTF-8 bytes)
+static const size_t kChunkOverlap = 100;    // Bytes shared with the previous chunk
+static const size_t kRagTopK = 4;
 
-	// Cleaning up temporary files
-	if (ext == L".pdf" || ext == L".docx")
-		DeleteFileW(txtPath);
+bool NativeKbAvailable()
+{
+	CString exeDir = GetExeDir();
+	return PathFileExistsW(exeDir + L"\\" + kEmbedExe) && PathFileExistsW(exeDir + L"\\" + kEmbedModel);
+}
+
+static std::string ToUtf8(const CString& s)
+{
+	return std::string(CW2A(s, CP_UTF8));
+}
 
+// [Function] Read a UTF-8 text file (BOM stripped).
+static bool ReadUtf8File(const CString& path, std::string& out)
+{
+	CFile file;
+	if (!file.Open(path, CFile::modeRead | CFile::shareDenyNone | CFile::typeBinary))
+		return false;
+	out.assign((size_t)file.GetLength(), '\0');
+	if (!out.empty())
+		out.resize(file.Read(&out[0], (UINT)out.size()));
+	file.Close();
+	if (out.compare(0, 3, "\xEF\xBB\xBF") == 0) out.erase(0, 3);
 	return true;
 }
+
+// [Function] Split text into ~kChunkBytes pieces, preferring paragraph, line and
+// sentence ends; breaks only at ASCII characters so UTF-8 sequences stay intact.
+static std::vector<std::string> ChunkText(const std::string& text)
+{
+	std::vector<std::string> chunks;
+	size_t pos = 0;
+	while (pos < text.size())
+	{
+		size_t end = (std::min)(text.size(), pos + kChunkBytes);
+		if (end < text.size())
+		{
+			size_t cut = std::string::npos;
+			for (const char* sep : { "\n\n", "\n", ". ", " " }) {
+				size_t at = text.rfind(sep, end);
+				if (at != std::string::npos && at > pos + kChunkBytes / 2) {
+					cut = at + strlen(sep);
+					break;
+				}
+			}
+			if (cut == std::string::npos)
+				while (end > pos + 1 && ((unsigned char)text[end] & 0xC0) == 0x80) --end;   // Hard cut on a code point boundary
+			else
+				end = cut;
+		}
+		std::string chunk = text.substr(pos, end - pos);
+		if (chunk.find_first_not_of(" \t\r\n") != std::string::npos)
+			chunks.push_back(chunk);
+		if (end >= text.size()) break;
+
+		size_t next = end > kChunkOverlap ? end - kChunkOverlap : end;
+		while (next < end && ((unsigned char)text[next] & 0xC0) == 0x80) ++next;
+		pos = next > pos ? next : end;
+	}
+	return chunks;
+}
+
+// [Function] Embed texts with llama-embedding.exe: one prompt per line of a temp file,
+// output "[[...],[...]]" (L2-normalised). Returns false on any tool/parse failure.
+static bool EmbedTexts(const std::vector<std::string>& texts, std::vector<float>& vectors, uint32_t& dim)
+{
+	vectors.clear();
+	dim = 0;
+	if (texts.empty()) return true;
+
+	wchar_t tmpDir[MAX_PATH], tmpName[MAX_PATH];
+	GetTempPathW(MAX_PATH, tmpDir);
+	GetTempFileNameW(tmpDir, L"emb", 0, tmpName);
+	{
+		std::string lines;
+		for (std::string t : texts) {
+			for (char& c : t)
+				if (c == '\r' || c == '\n') c = ' ';
+			lines += t;
+			lines += '\n';
+		}
+		CFile file;
+		if (!file.Open(tmpName, CFile::modeCreate | CFile::modeWrite | CFile::typeBinary))
+			return false;
+		file.Write(lines.data(), (UINT)lines.size());
+		file.Close();
+	}
+
+	CString exeDir = GetExeDir();
+	CString cmd;
+	cmd.Format(L"\"%s\\%s\" -m \"%s\\%s\" -f \"%s\" --embd-normalize 2 --embd-output-format array --log-disable",
+		(LPCTSTR)exeDir, kEmbedExe, (LPCTSTR)exeDir, kEmbedModel, tmpName);
+	CStringA out = RunCmdCaptureStdout(cmd);
+	DeleteFileW(tmpName);
+
+	int start = out.Find("[[");
+	if (start < 0) return false;
+	const char* p = out.GetString() + start + 1;
+	size_t rows = 0;
+	while (*p == '[')
+	{
+		++p;
+		size_t before = vectors.size();
+		char* end = nullptr;
+		for (;;) {
+			float v = strtof(p, &end);
+			if (end == p) break;
+			vectors.push_back(v);
+			p = end;
+			while (*p == ',' || *p == ' ') ++p;
+		}
+		if (*p != ']') return false;
+		++p;
+		uint32_t rowDim = (uint32_t)(vectors.size() - before);
+		if (dim == 0) dim = rowDim;
+		if (rowDim != dim || dim == 0) return false;
+		++rows;
+		while (*p == ',' || *p == ' ' || *p == '\r' || *p == '\n') ++p;
+	}
+	return rows == texts.size();
+}
+
+// [Function] Chunk and embed a set of text files, then publish them as one new segment.
+static bool IngestFilesToNativeKb(const std::vector<KbIngestItem>& items, CString* log)
+{
+	std::string kbDir = ToUtf8(GetExeDir() + L"\\kb");
+	std::unique_ptr<CKbSegmentWriter> writer;
+	uint32_t dim = 0;
+	int docs = 0;
+
+	for (const KbIngestItem& item : items)
+	{
+		std::string text;
+		if (!ReadUtf8File(item.textPath, text)) continue;
+		std::vector<std::string> chunks = ChunkText(text);
+		std::vector<float> vectors;
+		uint32_t d = 0;
+		if (!EmbedTexts(chunks, vectors, d)) {
+			if (log) log->AppendFormat(L"[embedding failed: %s]\r\n", (LPCTSTR)item.sourcePath);
+			return false;
+		}
+		if (chunks.empty()) continue;
+		if (!writer) {
+			dim = d;
+			writer.reset(new CKbSegmentWriter(dim));
+		}
+		if (d != dim) return false;
+		uint64_t hash = item.contentHash ? item.contentHash : KbFnv1a(text.data(), text.size());
+		writer->AddDocument(ToUtf8(item.sourcePath), hash, chunks, vectors.data());
+		++docs;
+	}
+	if (!writer || writer->Empty()) return true;
+
+	// Re-ingesting a document replaces it: KbPublishSegment tombstones the older versions
+	std::lock_guard<std::mutex> lock(KbWriteMutex());
+	std::string segment;
+	if (!KbPublishSegment(kbDir, *writer, {}, &segment)) {
+		if (log) *log = L"[Could not publish the kb segment (embedding dimension changed or disk error)]\r\n";
+		return false;
+	}
+
+	if (log) log->AppendFormat(L"Indexed %d document(s), %I64u chunk(s) into %S\r\n",
+		docs, writer->ChunkCount(), segment.c_str());
+	return true;
+}
+
+// [Function] Ingest a batch of UTF-8 text files: native kb when available, otherwise
+// one index_docs.exe run per file.
+bool IngestFilesToKb(const std::vector<KbIngestItem>& items, CString* log)
+{
+	if (NativeKbAvailable())
+		return IngestFilesToNativeKb(items, log);
+
+	bool ok = true;
+	for (const KbIngestItem& item : items)
+	{
+		CString one;
+		ok = RunIndexDocs(item.textPath, &one) && ok;
+		if (log) *log += one;
+	}
+	return ok;
+}
+
+// [Function] Remove documents (by original path) from the native kb. The chunks stay
+// in their segments until compaction rewrites them; retrieval skips them right away.
+bool RemoveFilesFromKb(const std::vector<CString>& sourcePaths)
+{
+	std::vector<uint64_t> ids;
+	for (const CString& path : sourcePaths)
+		ids.push_back(KbDocId(ToUtf8(path)));
+	std::lock_guard<std::mutex> lock(KbWriteMutex());
+	return KbRemoveDocuments(ToUtf8(GetExeDir() + L"\\kb"), ids);
+}
+
+// [Function] One compaction round over the native kb. Thresholds can be tuned in the
+// registry: Kb\CompactGarbagePercent (default 30) and Kb\CompactMaxSegments (16).
+bool CompactKb(CString* log)
+{
+	if (!NativeKbAvailable()) return false;
+	KbCompactionPolicy policy;
+	policy.garbageRatio = AfxGetApp()->GetProfileInt(L"Kb", L"CompactGarbagePercent", 30) / 100.0;
+	policy.maxSegments = (size_t)(std::max)(1, (int)AfxGetApp()->GetProfileInt(L"Kb", L"CompactMaxSegments", 16));
+
+	KbCompactionStats stats;
+	if (!KbCompact(ToUtf8(GetExeDir() + L"\\kb"), policy, KbWriteMutex(), &stats))
+		return false;
+	if (log) log->Format(L"Compacted %Iu segment(s): %I64u -> %I64u chunk(s), %Iu tombstone(s) dropped",
+		stats.segmentsIn, stats.chunksIn, stats.chunksOut, stats.tombstonesDropped);
+	return true;
+}
+
+static UINT CompactKbThread(LPVOID pParam)
+{
+	std::atomic<bool>* running = reinterpret_cast<std::atomic<bool>*>(pParam);
+	while (CompactKb(nullptr)) {}   // Until the policy is satisfied
+	*running = false;
+	return 0;
+}
+
+// [Function] Compact in the background at idle priority; queries keep using the old
+// segments until the new manifest is published. At most one such thread runs.
+void CompactKbInBackground()
+{
+	static std::atomic<bool> running(false);
+	if (!NativeKbAvailable() || running.exchange(true)) return;
+	if (!AfxBeginThread(CompactKbThread, &running, THREAD_PRIORITY_LOWEST))
+		running = false;
+}
+
+// [Function] The process-wide snapshot of the native kb (see CKbSnapshotCache).
+static CKbSnapshotCache& KbSnapshots()
+{
+	static CKbSnapshotCache cache(ToUtf8(GetExeDir() + L"\\kb"));
+	return cache;
+}
+
+// [Function] Native RAG: embed the question, search the mapped kb and assemble the
+// prompt with the top chunks. Returns an empty string if there is no native kb.
+// Runs on the current snapshot, so an import in progress never delays it.
+CString BuildNativeRagPrompt(const CString& question)
+{
+	if (!NativeKbAvailable()) return CString();
+	std::shared_ptr<const CKbReader> snapshot = KbSnapshots().Acquire();
+	if (!snapshot) return CString();
+	const CKbReader& reader = *snapshot;
+
+	std::vector<float> q;
+	uint32_t dim = 0;
+	if (!EmbedTexts({ ToUtf8(question) }, q, dim) || dim != reader.Dim())
+		return CString();
+
+	std::string prompt = "Answer the question using the context below. "
+		"If the context does not contain the answer, say so.\n\nContext:\n";
+	int n = 0;
+	for (const KbHit& hit : reader.Search(q.data(), kRagTopK))
+	{
+		const CKbSegment& seg = reader.Segment(hit.segment);
+		std::string path = seg.DocPath(seg.Chunk(hit.chunk).doc);
+		size_t slash = path.find_last_of("/\\");
+		prompt += "[" + std::to_string(++n) + "] (" + path.substr(slash == std::string::npos ? 0 : slash + 1) + ")\n";
+		prompt += seg.ChunkText(hit.chunk);
+		prompt += "\n\n";
+	}
+	prompt += "Question: " + ToUtf8(question);
+	return CString(CA2W(prompt.c_str(), CP_UTF8));
+}
+
+// [Function] Stop the note sync thread before the window goes away.
+void CAIassistantDlg::OnDestroy()
+{
+	m_noteSync.Stop();
+	CDialogEx::OnDestroy();
+}
+
+// [Function] Note sync progress from the background thread, shown in the caption.
+LRESULT CAIassistantDlg::OnNoteSyncStatus(WPARAM, LPARAM lParam)
+{
+	std::unique_ptr<CString> p(reinterpret_cast<CString*>(lParam));
+	SetWindowTextW(m_baseTitle + L" - " + *p);
+	return 0;
+}
@@ -2,11 +2,32 @@
 #include <Shlwapi.h>                 
 #include <Shellapi.h>                
 #pragma comment(lib, "Shlwapi.lib") 
+#include <mutex>
+#include <vector>
+#include "NoteSyncIndexer.h"
 
 CString ConvertFileToText(const CString& path);   
 
 CString ConvertImageToText(const CString& imagePath);
-bool    ImportFileToKb(const CString& path);
+bool    ImportFileToKb(const CString& path, CString* log = nullptr);   // Blocking, any thread
+bool    RunIndexDocs(const CString& txtPath, CString* log);   // Shared by the RAG button and the note sync thread
+CStringA RunCmdCaptureStdout(const CString& cmd, const wchar_t* env = nullptr);
+const wchar_t* PythonUtf8Environment();
+CString GetExeDir();
+void    EnsureDir(const CString& path);
+std::mutex& KbWriteMutex();   // index_docs.exe must never run twice against the same kb
+
+struct KbIngestItem {
+	CString  textPath;          // UTF-8 text that gets chunked and embedded
+	CString  sourcePath;        // Original document, identifies it in the kb
+	uint64_t contentHash = 0;   // 0 = hash the text
+};
+bool    IngestFilesToKb(const std::vector<KbIngestItem>& items, CString* log);
+bool    NativeKbAvailable();
+bool    RemoveFilesFromKb(const std::vector<CString>& sourcePaths);   // Native kb only
+bool    CompactKb(CString* log);                                      // One round, caller's thread
+void    CompactKbInBackground();
+CString BuildNativeRagPrompt(const CString& question);
 
 #pragma once
 #define WM_IMPORT_TEXT  (WM_APP + 3)
@@ -34,6 +55,9 @@ public:
 	CButton m_btnRag;          // “RAG” button
 	bool    m_ragMode = false; // Whether to enable RAG in this round (will automatically return to false after Send)
 	CString m_lastRagFile;      // Record the document path for this import
+	CNoteSyncIndexer m_noteSync;  // Keeps kb in sync with the QOwnNotes note folder (--note-folder)
+	CString m_baseTitle;          // Dialog caption without the note sync status
+	int     m_importsRunning = 0; // Background RAG imports still embedding
 
 	CAIassistantDlg(CWnd* pParent = nullptr);	
 
@@ -70,6 +94,10 @@ public:
 	afx_msg void OnDropFiles(HDROP hDrop);    
 	afx_msg void OnBnClickedButtonRecord();
 	afx_msg void OnBnClickedButtonRag();
+	afx_msg void OnDestroy();
+	afx_msg LRESULT OnNoteSyncStatus(WPARAM, LPARAM);
+	afx_msg LRESULT OnRagFinished(WPARAM, LPARAM);
+	void StartRagImport(const CString& path);
 	
 };
 
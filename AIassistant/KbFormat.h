@@ -0,0 +1,100 @@
+﻿// [Function] On-disk format of the local knowledge base (kb), version 1.
+//
+// The kb directory holds immutable segment files plus one manifest that lists
+// the live segments:
+//
+//   kb\kb.manifest              text, replaced atomically (temp file + rename)
+//       QNKB 1
+//       dim <embedding dimension>
+//       next <generation>        number for the next segment file
+//       segment <file name>      one line per live segment
+//       tomb <docId hex> <gen>   every version of docId in a segment whose
+//                                generation is <= gen is deleted
+//   kb\seg_<number>.kbs         binary segment, never modified after it is written
+//
+// Deleting or replacing a document never touches a segment: the writer adds a
+// tombstone at the current generation (replacement = tombstone + the new version
+// in a newer segment). Compaction rewrites segments whose dead-chunk ratio is
+// too high, or merges small segments, into one new segment that keeps the
+// highest input generation, and drops tombstones that no longer match anything.
+//
+// Segment layout (little-endian, every section 64-byte aligned):
+//
+//   KbSegmentHeader     256 bytes, see below
+//   vectors             chunkCount * dim float32, L2-normalised, row-major
+//   chunks              chunkCount * KbChunkRecord
+//   text                UTF-8 chunk text, referenced by KbChunkRecord
+//   docs                docCount * KbDocRecord, sorted by docId
+//   strings             UTF-8 document paths, referenced by KbDocRecord
+//
+// A reader maps the file and uses the sections in place: opening a segment only
+// validates the header (magic, version, header checksum, section bounds), so
+// startup cost does not depend on kb size and every process that maps the same
+// segment shares the same page cache. Section checksums (FNV-1a 64) are checked
+// on demand by CKbSegment::Verify().
+#pragma once
+
+#include <cstdint>
+
+#define KB_SEGMENT_MAGIC    "QNKBSEG1"
+#define KB_FORMAT_VERSION   1u
+#define KB_SECTION_ALIGN    64u
+#define KB_MANIFEST_NAME    "kb.manifest"
+
+// Header flags
+#define KB_FLAG_NORMALIZED  0x1u   // vectors are unit length, score = dot product
+
+struct KbSection {
+	uint64_t offset;     // From the start of the file
+	uint64_t size;       // In bytes
+	uint64_t checksum;   // FNV-1a 64 of the section bytes
+};
+
+struct KbSegmentHeader {
+	char      magic[8];        // KB_SEGMENT_MAGIC
+	uint32_t  version;         // KB_FORMAT_VERSION
+	uint32_t  headerSize;      // sizeof(KbSegmentHeader)
+	uint32_t  dim;             // Embedding dimension
+	uint32_t  flags;           // KB_FLAG_*
+	uint64_t  generation;      // Data generation compared against tombstones
+	uint64_t  chunkCount;
+	uint64_t  docCount;
+	KbSection vectors;
+	KbSection chunks;
+	KbSection text;
+	KbSection docs;
+	KbSection strings;
+	uint8_t   reserved[80];
+	uint64_t  headerChecksum;  // FNV-1a 64 of all preceding header bytes
+};
+
+struct KbChunkRecord {
+	uint32_t doc;          // Index into the docs section
+	uint32_t textLength;   // Bytes
+	uint64_t textOffset;   // Relative to the text section
+};
+
+struct KbDocRecord {
+	uint64_t docId;        // FNV-1a 64 of the lower-cased document path
+	uint64_t contentHash;  // FNV-1a 64 of the document bytes that were indexed
+	uint64_t pathOffset;   // Relative to the strings section
+	uint32_t pathLength;   // Bytes
+	uint32_t firstChunk;   // Chunks of a document are contiguous
+	uint32_t chunkCount;
+	uint32_t flags;        // Reserved, 0
+};
+
+static_assert(sizeof(KbSection) == 24, "KbSection layout");
+static_assert(sizeof(KbSegmentHeader) == 256, "KbSegmentHeader layout");
+static_assert(sizeof(KbChunkRecord) == 16, "KbChunkRecord layout");
+static_assert(sizeof(KbDocRecord) == 40, "KbDocRecord layout");
+
+inline uint64_t KbFnv1a(const void* data, uint64_t size, uint64_t hash = 1469598103934665603ull)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	for (uint64_t i = 0; i < size; ++i) {
+		hash ^= p[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
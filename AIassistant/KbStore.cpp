@@ -0,0 +1,797 @@
+﻿// [Function] Knowledge-base segment writer, memory-mapped reader and exact search.
+// Built without the precompiled header (no MFC here), see KbStore.h.
+#include "KbStore.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <queue>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+static std::wstring Widen(const std::string& s)
+{
+	if (s.empty()) return std::wstring();
+	int n = MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), nullptr, 0);
+	std::wstring w(n, L'\0');
+	MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), &w[0], n);
+	return w;
+}
+#endif
+
+static uint64_t AlignUp(uint64_t v)
+{
+	return (v + KB_SECTION_ALIGN - 1) & ~(uint64_t)(KB_SECTION_ALIGN - 1);
+}
+
+// ---------------- Helpers ----------------
+
+#ifdef _WIN32
+void KbFoldPathCase(std::wstring& path)
+{
+	if (!path.empty())
+		CharLowerBuffW(&path[0], (DWORD)path.size());
+}
+#endif
+
+uint64_t KbDocId(const std::string& utf8Path)
+{
+#ifdef _WIN32
+	std::wstring wide = Widen(utf8Path);
+	for (wchar_t& c : wide)
+		if (c == L'\\') c = L'/';
+	KbFoldPathCase(wide);
+	std::string key;
+	if (!wide.empty()) {
+		int n = WideCharToMultiByte(CP_UTF8, 0, wide.data(), (int)wide.size(), nullptr, 0,
+			nullptr, nullptr);
+		key.resize(n);
+		WideCharToMultiByte(CP_UTF8, 0, wide.data(), (int)wide.size(), &key[0], n,
+			nullptr, nullptr);
+	}
+#else
+	// Only the bench runs here; its paths come from one directory listing
+	std::string key = utf8Path;
+	for (char& c : key) {
+		if (c == '\\') c = '/';
+		else if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+	}
+#endif
+	return KbFnv1a(key.data(), key.size());
+}
+
+std::string KbJoinPath(const std::string& dir, const std::string& name)
+{
+	if (dir.empty()) return name;
+	char last = dir.back();
+	if (last == '/' || last == '\\') return dir + name;
+#ifdef _WIN32
+	return dir + "\\" + name;
+#else
+	return dir + "/" + name;
+#endif
+}
+
+bool KbDeleteFile(const std::string& path)
+{
+#ifdef _WIN32
+	// Segments are opened with FILE_SHARE_DELETE, so mapped readers don't block this
+	return DeleteFileW(Widen(path).c_str()) != 0;
+#else
+	return ::unlink(path.c_str()) == 0;
+#endif
+}
+
+bool KbReplaceFile(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+	return MoveFileExW(Widen(from).c_str(), Widen(to).c_str(),
+		MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+void KbNormalize(float* v, uint32_t dim)
+{
+	double sum = 0;
+	for (uint32_t i = 0; i < dim; ++i) sum += (double)v[i] * v[i];
+	if (sum <= 0) return;
+	float inv = (float)(1.0 / std::sqrt(sum));
+	for (uint32_t i = 0; i < dim; ++i) v[i] *= inv;
+}
+
+// Opened with FILE_SHARE_DELETE like the mapped segments: query threads may read the
+// manifest while a writer renames the new one over it. Only "rb" and "wb" are used.
+static FILE* OpenFile(const std::string& path, const char* mode)
+{
+#ifdef _WIN32
+	bool write = mode[0] == 'w';
+	HANDLE h = CreateFileW(Widen(path).c_str(), write ? GENERIC_WRITE : GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+		write ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (h == INVALID_HANDLE_VALUE) {
+		DWORD error = GetLastError();
+		errno = (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND) ? ENOENT : EACCES;
+		return nullptr;
+	}
+	int fd = _open_osfhandle((intptr_t)h, (write ? _O_WRONLY : _O_RDONLY) | _O_BINARY);
+	if (fd == -1) {
+		CloseHandle(h);
+		return nullptr;
+	}
+	FILE* f = _fdopen(fd, mode);
+	if (!f) _close(fd);   // Closes the handle too
+	return f;
+#else
+	return std::fopen(path.c_str(), mode);
+#endif
+}
+
+// ---------------- CKbMappedFile ----------------
+
+CKbMappedFile::~CKbMappedFile()
+{
+	Close();
+}
+
+bool CKbMappedFile::Open(const std::string& path)
+{
+	Close();
+#ifdef _WIN32
+	HANDLE hFile = CreateFileW(Widen(path).c_str(), GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size{};
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0) {
+		CloseHandle(hFile);
+		return false;
+	}
+	HANDLE hMap = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!hMap) {
+		CloseHandle(hFile);
+		return false;
+	}
+	void* view = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		CloseHandle(hMap);
+		CloseHandle(hFile);
+		return false;
+	}
+	m_hFile = hFile;
+	m_hMapping = hMap;
+	m_data = static_cast<const unsigned char*>(view);
+	m_size = (uint64_t)size.QuadPart;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+	struct stat st {};
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (view == MAP_FAILED) {
+		::close(fd);
+		return false;
+	}
+	m_fd = fd;
+	m_data = static_cast<const unsigned char*>(view);
+	m_size = (uint64_t)st.st_size;
+#endif
+	return true;
+}
+
+void CKbMappedFile::Close()
+{
+	if (!m_data) return;
+#ifdef _WIN32
+	UnmapViewOfFile(m_data);
+	CloseHandle(m_hMapping);
+	CloseHandle(m_hFile);
+	m_hMapping = m_hFile = nullptr;
+#else
+	munmap(const_cast<unsigned char*>(m_data), (size_t)m_size);
+	::close(m_fd);
+	m_fd = -1;
+#endif
+	m_data = nullptr;
+	m_size = 0;
+}
+
+// ---------------- CKbSegment ----------------
+
+// [Function] Map the file and validate the header only; O(1) in segment size.
+bool CKbSegment::Open(const std::string& path, std::string* error)
+{
+	auto fail = [&](const char* why) {
+		if (error) *error = path + ": " + why;
+		m_file.Close();
+		m_header = nullptr;
+		return false;
+	};
+
+	if (!m_file.Open(path)) return fail("cannot map file");
+	if (m_file.Size() < sizeof(KbSegmentHeader)) return fail("file too small");
+
+	const unsigned char* base = m_file.Data();
+	const KbSegmentHeader* h = reinterpret_cast<const KbSegmentHeader*>(base);
+	if (memcmp(h->magic, KB_SEGMENT_MAGIC, sizeof(h->magic)) != 0) return fail("bad magic");
+	if (h->version != KB_FORMAT_VERSION) return fail("unsupported version");
+	if (h->headerSize != sizeof(KbSegmentHeader)) return fail("bad header size");
+	if (KbFnv1a(h, offsetof(KbSegmentHeader, headerChecksum)) != h->headerChecksum)
+		return fail("header checksum mismatch");
+
+	const KbSection* sections[] = { &h->vectors, &h->chunks, &h->text, &h->docs, &h->strings };
+	for (const KbSection* s : sections)
+		if (s->offset % KB_SECTION_ALIGN || s->offset > m_file.Size() || s->size > m_file.Size() - s->offset)
+			return fail("section out of bounds");
+	if (h->vectors.size != h->chunkCount * h->dim * sizeof(float) ||
+		h->chunks.size != h->chunkCount * sizeof(KbChunkRecord) ||
+		h->docs.size != h->docCount * sizeof(KbDocRecord))
+		return fail("section size mismatch");
+
+	m_header = h;
+	m_vectors = reinterpret_cast<const float*>(base + h->vectors.offset);
+	m_chunks = reinterpret_cast<const KbChunkRecord*>(base + h->chunks.offset);
+	m_text = reinterpret_cast<const char*>(base + h->text.offset);
+	m_docs = reinterpret_cast<const KbDocRecord*>(base + h->docs.offset);
+	m_strings = reinterpret_cast<const char*>(base + h->strings.offset);
+
+	size_t slash = path.find_last_of("/\\");
+	m_fileName = slash == std::string::npos ? path : path.substr(slash + 1);
+	return true;
+}
+
+bool CKbSegment::Verify() const
+{
+	if (!m_header) return false;
+	const unsigned char* base = m_file.Data();
+	const KbSection* sections[] = { &m_header->vectors, &m_header->chunks, &m_header->text,
+		&m_header->docs, &m_header->strings };
+	for (const KbSection* s : sections)
+		if (KbFnv1a(base + s->offset, s->size) != s->checksum)
+			return false;
+	// Record references must stay inside their sections
+	for (uint64_t i = 0; i < m_header->chunkCount; ++i)
+		if (m_chunks[i].doc >= m_header->docCount ||
+			m_chunks[i].textOffset + m_chunks[i].textLength > m_header->text.size)
+			return false;
+	for (uint64_t i = 0; i < m_header->docCount; ++i)
+		if (m_docs[i].pathOffset + m_docs[i].pathLength > m_header->strings.size ||
+			(uint64_t)m_docs[i].firstChunk + m_docs[i].chunkCount > m_header->chunkCount)
+			return false;
+	return true;
+}
+
+std::string CKbSegment::ChunkText(uint64_t chunk) const
+{
+	const KbChunkRecord& c = m_chunks[chunk];
+	return std::string(m_text + c.textOffset, c.textLength);
+}
+
+std::string CKbSegment::DocPath(uint64_t doc) const
+{
+	const KbDocRecord& d = m_docs[doc];
+	return std::string(m_strings + d.pathOffset, d.pathLength);
+}
+
+const KbDocRecord* CKbSegment::FindDoc(uint64_t docId) const
+{
+	const KbDocRecord* end = m_docs + m_header->docCount;
+	const KbDocRecord* it = std::lower_bound(m_docs, end, docId,
+		[](const KbDocRecord& d, uint64_t id) { return d.docId < id; });
+	return (it != end && it->docId == docId) ? it : nullptr;
+}
+
+// ---------------- CKbSegmentWriter ----------------
+
+void CKbSegmentWriter::AddDocument(const std::string& path, uint64_t contentHash,
+	const std::vector<std::string>& chunks, const float* vectors)
+{
+	PendingDoc doc{};
+	doc.path = path;
+	doc.record.docId = KbDocId(path);
+	doc.record.contentHash = contentHash;
+	doc.record.pathLength = (uint32_t)path.size();
+	doc.record.firstChunk = (uint32_t)m_chunkRecords.size();
+	doc.record.chunkCount = (uint32_t)chunks.size();
+
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		KbChunkRecord rec{};
+		rec.doc = (uint32_t)m_docs.size();   // Remapped after sorting in Write()
+		rec.textOffset = m_text.size();
+		rec.textLength = (uint32_t)chunks[i].size();
+		m_text += chunks[i];
+		m_chunkRecords.push_back(rec);
+
+		size_t at = m_vectors.size();
+		m_vectors.insert(m_vectors.end(), vectors + i * m_dim, vectors + (i + 1) * m_dim);
+		KbNormalize(&m_vectors[at], m_dim);
+	}
+	m_docs.push_back(doc);
+}
+
+std::vector<uint64_t> CKbSegmentWriter::DocIds() const
+{
+	std::vector<uint64_t> ids;
+	ids.reserve(m_docs.size());
+	for (const PendingDoc& d : m_docs) ids.push_back(d.record.docId);
+	return ids;
+}
+
+bool CKbSegmentWriter::Write(const std::string& kbDir, uint64_t fileNumber, uint64_t generation,
+	std::string* fileName)
+{
+	// Docs are sorted by id for FindDoc(); chunks keep their order and point at the new index
+	std::vector<uint32_t> order(m_docs.size());
+	for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return m_docs[a].record.docId < m_docs[b].record.docId;
+	});
+	std::vector<uint32_t> remap(m_docs.size());
+	std::vector<KbDocRecord> docs(m_docs.size());
+	std::string strings;
+	for (uint32_t i = 0; i < order.size(); ++i)
+	{
+		remap[order[i]] = i;
+		docs[i] = m_docs[order[i]].record;
+		docs[i].pathOffset = strings.size();
+		strings += m_docs[order[i]].path;
+	}
+	for (KbChunkRecord& c : m_chunkRecords)
+		c.doc = remap[c.doc];
+
+	KbSegmentHeader h{};
+	memcpy(h.magic, KB_SEGMENT_MAGIC, sizeof(h.magic));
+	h.version = KB_FORMAT_VERSION;
+	h.headerSize = sizeof(KbSegmentHeader);
+	h.dim = m_dim;
+	h.flags = KB_FLAG_NORMALIZED;
+	h.generation = generation;
+	h.chunkCount = m_chunkRecords.size();
+	h.docCount = docs.size();
+
+	struct Part { KbSection* section; const void* data; uint64_t size; };
+	Part parts[] = {
+		{ &h.vectors, m_vectors.data(), m_vectors.size() * sizeof(float) },
+		{ &h.chunks, m_chunkRecords.data(), m_chunkRecords.size() * sizeof(KbChunkRecord) },
+		{ &h.text, m_text.data(), m_text.size() },
+		{ &h.docs, docs.data(), docs.size() * sizeof(KbDocRecord) },
+		{ &h.strings, strings.data(), strings.size() },
+	};
+	uint64_t offset = AlignUp(sizeof(KbSegmentHeader));
+	for (Part& p : parts)
+	{
+		p.section->offset = offset;
+		p.section->size = p.size;
+		p.section->checksum = KbFnv1a(p.data, p.size);
+		offset = AlignUp(offset + p.size);
+	}
+	h.headerChecksum = KbFnv1a(&h, offsetof(KbSegmentHeader, headerChecksum));
+
+	char name[64];
+	snprintf(name, sizeof(name), "seg_%016llx.kbs", (unsigned long long)fileNumber);
+	std::string path = KbJoinPath(kbDir, name);
+	std::string tmp = path + ".tmp";
+
+	FILE* f = OpenFile(tmp, "wb");
+	if (!f) return false;
+	static const char zeros[KB_SECTION_ALIGN] = {};
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+	uint64_t pos = sizeof(h);
+	for (const Part& p : parts)
+	{
+		ok = ok && fwrite(zeros, 1, (size_t)(p.section->offset - pos), f) == p.section->offset - pos;
+		ok = ok && (p.size == 0 || fwrite(p.data, 1, (size_t)p.size, f) == p.size);
+		pos = p.section->offset + p.size;
+	}
+	ok = fflush(f) == 0 && ok;
+	ok = fclose(f) == 0 && ok;
+	if (!ok || !KbReplaceFile(tmp, path)) {
+		std::remove(tmp.c_str());
+		return false;
+	}
+	if (fileName) *fileName = name;
+	return true;
+}
+
+// ---------------- KbManifest ----------------
+
+void KbManifest::AddTombstone(uint64_t docId)
+{
+	uint64_t& gen = tombstones[docId];
+	gen = (std::max)(gen, nextGeneration - 1);
+}
+
+bool KbManifest::IsDeleted(uint64_t docId, uint64_t generation) const
+{
+	auto it = tombstones.find(docId);
+	return it != tombstones.end() && generation <= it->second;
+}
+
+bool KbManifest::Load(const std::string& kbDir, bool* missing)
+{
+	dim = 0;
+	nextGeneration = 1;
+	segments.clear();
+	tombstones.clear();
+	fingerprint = 0;
+	if (missing) *missing = false;
+
+	FILE* f = OpenFile(KbJoinPath(kbDir, KB_MANIFEST_NAME), "rb");
+	if (!f) {
+		if (missing) *missing = errno == ENOENT;
+		return false;
+	}
+	char line[512];
+	bool ok = fgets(line, sizeof(line), f) && strncmp(line, "QNKB 1", 6) == 0;
+	uint64_t hash = KbFnv1a(line, ok ? strlen(line) : 0);
+	while (ok && fgets(line, sizeof(line), f))
+	{
+		hash = KbFnv1a(line, strlen(line), hash);
+		line[strcspn(line, "\r\n")] = '\0';
+		unsigned long long v = 0, g = 0;
+		if (sscanf(line, "tomb %llx %llu", &v, &g) == 2) tombstones[v] = g;
+		else if (sscanf(line, "dim %llu", &v) == 1) dim = (uint32_t)v;
+		else if (sscanf(line, "next %llu", &v) == 1) nextGeneration = v;
+		else if (strncmp(line, "segment ", 8) == 0) segments.push_back(line + 8);
+	}
+	fclose(f);
+	fingerprint = hash;
+	return ok && dim != 0;
+}
+
+bool KbManifest::Save(const std::string& kbDir) const
+{
+	std::string path = KbJoinPath(kbDir, KB_MANIFEST_NAME);
+	std::string tmp = path + ".tmp";
+	FILE* f = OpenFile(tmp, "wb");
+	if (!f) return false;
+	fprintf(f, "QNKB 1\ndim %u\nnext %llu\n", dim, (unsigned long long)nextGeneration);
+	for (const std::string& s : segments)
+		fprintf(f, "segment %s\n", s.c_str());
+	std::vector<std::pair<uint64_t, uint64_t>> tombs(tombstones.begin(), tombstones.end());
+	std::sort(tombs.begin(), tombs.end());
+	for (const auto& t : tombs)
+		fprintf(f, "tomb %016llx %llu\n", (unsigned long long)t.first, (unsigned long long)t.second);
+	bool ok = fflush(f) == 0;
+	ok = fclose(f) == 0 && ok;
+	return ok && KbReplaceFile(tmp, path);
+}
+
+// ---------------- CKbReader ----------------
+
+// [Function] A compaction may delete a segment between reading the manifest and
+// mapping it; the manifest has already moved on then, so simply read it again.
+bool CKbReader::Open(const std::string& kbDir, std::string* error, const CKbReader* reuse)
+{
+	for (int attempt = 0; attempt < 3; ++attempt)
+		if (OpenOnce(kbDir, error, reuse))
+			return true;
+	return false;
+}
+
+bool CKbReader::OpenOnce(const std::string& kbDir, std::string* error, const CKbReader* reuse)
+{
+	m_segments.clear();
+	m_dead.clear();
+	m_deadCount.clear();
+	if (!m_manifest.Load(kbDir)) {
+		if (error) *error = "no kb manifest";
+		return false;
+	}
+	for (const std::string& name : m_manifest.segments)
+	{
+		// A segment file never changes once written: share the mapping with `reuse`
+		std::shared_ptr<const CKbSegment> shared;
+		if (reuse) {
+			for (const auto& old : reuse->m_segments)
+				if (old->FileName() == name && old->Dim() == m_manifest.dim) {
+					shared = old;
+					break;
+				}
+		}
+		if (!shared) {
+			std::shared_ptr<CKbSegment> seg = std::make_shared<CKbSegment>();
+			if (!seg->Open(KbJoinPath(kbDir, name), error) || seg->Dim() != m_manifest.dim) {
+				m_segments.clear();
+				m_manifest.dim = 0;
+				return false;
+			}
+			shared = seg;
+		}
+		m_segments.push_back(shared);
+	}
+
+	// Dead masks: one binary search per tombstone and segment
+	m_dead.resize(m_segments.size());
+	m_deadCount.assign(m_segments.size(), 0);
+	for (const auto& t : m_manifest.tombstones)
+	{
+		for (size_t s = 0; s < m_segments.size(); ++s)
+		{
+			const CKbSegment& seg = *m_segments[s];
+			if (seg.Header().generation > t.second) continue;
+			const KbDocRecord* doc = seg.FindDoc(t.first);
+			if (!doc) continue;
+			if (m_dead[s].empty()) m_dead[s].assign((size_t)seg.ChunkCount(), false);
+			for (uint32_t c = 0; c < doc->chunkCount; ++c)
+				m_dead[s][doc->firstChunk + c] = true;
+			m_deadCount[s] += doc->chunkCount;
+		}
+	}
+	return true;
+}
+
+bool CKbReader::IsDead(uint32_t segment, uint64_t chunk) const
+{
+	return !m_dead[segment].empty() && m_dead[segment][(size_t)chunk];
+}
+
+uint64_t CKbReader::ChunkCount() const
+{
+	uint64_t n = 0;
+	for (const auto& s : m_segments) n += s->ChunkCount();
+	return n;
+}
+
+uint64_t CKbReader::LiveChunkCount() const
+{
+	uint64_t n = ChunkCount();
+	for (uint64_t d : m_deadCount) n -= d;
+	return n;
+}
+
+// [Function] Exact top-k by inner product (vectors are normalised, so this is cosine).
+std::vector<KbHit> CKbReader::Search(const float* query, size_t k) const
+{
+	auto worse = [](const KbHit& a, const KbHit& b) { return a.score > b.score; };
+	std::priority_queue<KbHit, std::vector<KbHit>, decltype(worse)> top(worse);
+	const uint32_t dim = m_manifest.dim;
+
+	for (uint32_t s = 0; s < m_segments.size() && k; ++s)
+	{
+		const CKbSegment& seg = *m_segments[s];
+		const std::vector<bool>& dead = m_dead[s];
+		for (uint64_t c = 0; c < seg.ChunkCount(); ++c)
+		{
+			if (!dead.empty() && dead[(size_t)c]) continue;
+			const float* v = seg.Vector(c);
+			float score = 0;
+			for (uint32_t i = 0; i < dim; ++i) score += v[i] * query[i];
+			if (top.size() < k) top.push(KbHit{ score, s, c });
+			else if (score > top.top().score) {
+				top.pop();
+				top.push(KbHit{ score, s, c });
+			}
+		}
+	}
+
+	std::vector<KbHit> hits;
+	hits.reserve(top.size());
+	while (!top.empty()) {
+		hits.push_back(top.top());
+		top.pop();
+	}
+	std::reverse(hits.begin(), hits.end());
+	return hits;
+}
+
+// ---------------- CKbSnapshotCache ----------------
+
+// [Function] Costs one manifest read when nothing changed. A new snapshot is built
+// outside the lock (only new segments get mapped) and then swapped in; queries that
+// still hold the previous one finish on it undisturbed.
+std::shared_ptr<const CKbReader> CKbSnapshotCache::Acquire()
+{
+	KbManifest manifest;
+	bool exists = manifest.Load(m_kbDir);
+
+	std::shared_ptr<const CKbReader> current;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		current = m_current;
+	}
+	if (!exists) return current;
+	if (current && current->Manifest().fingerprint == manifest.fingerprint)
+		return current;
+
+	std::shared_ptr<CKbReader> next = std::make_shared<CKbReader>();
+	if (!next->Open(m_kbDir, nullptr, current.get()))
+		return current;   // Keep serving the last good snapshot
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_current = next;
+	return next;
+}
+
+// ---------------- Write side ----------------
+
+bool KbPublishSegment(const std::string& kbDir, CKbSegmentWriter& writer,
+	const std::vector<uint64_t>& removedDocIds, std::string* fileName)
+{
+	// An unreadable manifest must not be replaced by one that only knows the new segment
+	KbManifest manifest;
+	bool missing = false;
+	if (manifest.Load(kbDir, &missing) ? manifest.dim != writer.Dim() : !missing)
+		return false;
+	manifest.dim = writer.Dim();
+
+	// Replacement: every older version of the incoming documents dies with this publish
+	for (uint64_t id : writer.DocIds()) manifest.AddTombstone(id);
+	for (uint64_t id : removedDocIds) manifest.AddTombstone(id);
+
+	std::string name;
+	uint64_t generation = manifest.nextGeneration;
+	if (!writer.Write(kbDir, generation, generation, &name))
+		return false;
+	manifest.nextGeneration++;
+	manifest.segments.push_back(name);
+	if (!manifest.Save(kbDir)) {
+		KbDeleteFile(KbJoinPath(kbDir, name));
+		return false;
+	}
+	if (fileName) *fileName = name;
+	return true;
+}
+
+bool KbRemoveDocuments(const std::string& kbDir, const std::vector<uint64_t>& docIds)
+{
+	KbManifest manifest;
+	bool missing = false;
+	if (!manifest.Load(kbDir, &missing)) return missing;   // Missing: nothing indexed yet
+	for (uint64_t id : docIds) manifest.AddTombstone(id);
+	return manifest.Save(kbDir);
+}
+
+// [Function] One compaction round:
+// 1 pick segments whose dead ratio >= policy.garbageRatio, plus the smallest
+//   segments while there are more than policy.maxSegments;
+// 2 copy their live documents (text and vectors straight from the mapping, no
+//   re-embedding) into one new segment that keeps the highest input generation,
+//   so tombstones written meanwhile still apply to the copies;
+// 3 under the lock: re-read the manifest, swap the inputs for the new segment,
+//   drop tombstones nothing refers to any more, publish, delete the input files.
+bool KbCompact(const std::string& kbDir, const KbCompactionPolicy& policy,
+	std::mutex& publishLock, KbCompactionStats* stats)
+{
+	CKbReader reader;
+	if (!reader.Open(kbDir)) return false;
+
+	const size_t count = reader.SegmentCount();
+	std::vector<bool> selected(count, false);
+	size_t selectedCount = 0;
+	uint32_t lastSelected = 0;
+	for (uint32_t s = 0; s < count; ++s)
+	{
+		uint64_t chunks = reader.Segment(s).ChunkCount();
+		if (chunks == 0 || (double)reader.DeadChunkCount(s) / (double)chunks >= policy.garbageRatio) {
+			selected[s] = true;
+			lastSelected = s;
+			++selectedCount;
+		}
+	}
+	if (count - selectedCount > policy.maxSegments)
+	{
+		std::vector<uint32_t> bySize;
+		for (uint32_t s = 0; s < count; ++s)
+			if (!selected[s]) bySize.push_back(s);
+		std::sort(bySize.begin(), bySize.end(), [&](uint32_t a, uint32_t b) {
+			return reader.Segment(a).ChunkCount() < reader.Segment(b).ChunkCount();
+		});
+		// Merging n segments into one leaves count - n + 1 of them
+		size_t need = count - selectedCount - policy.maxSegments + 1;
+		for (size_t i = 0; i < need && i < bySize.size(); ++i) {
+			selected[bySize[i]] = true;
+			lastSelected = bySize[i];
+			++selectedCount;
+		}
+	}
+	// Rewriting a single segment without dead chunks would only copy it
+	if (selectedCount == 0 || (selectedCount == 1 && count <= policy.maxSegments &&
+		reader.DeadChunkCount(lastSelected) == 0 && reader.Segment(lastSelected).ChunkCount() != 0))
+		return false;
+
+	CKbSegmentWriter writer(reader.Dim());
+	uint64_t generation = 0, chunksIn = 0;
+	std::vector<std::string> inputs;
+	for (uint32_t s = 0; s < count; ++s)
+	{
+		if (!selected[s]) continue;
+		const CKbSegment& seg = reader.Segment(s);
+		inputs.push_back(seg.FileName());
+		generation = (std::max)(generation, seg.Header().generation);
+		chunksIn += seg.ChunkCount();
+		for (uint64_t d = 0; d < seg.DocCount(); ++d)
+		{
+			const KbDocRecord& doc = seg.Doc(d);
+			if (doc.chunkCount == 0 || reader.IsDead(s, doc.firstChunk)) continue;
+			std::vector<std::string> texts;
+			for (uint32_t c = 0; c < doc.chunkCount; ++c)
+				texts.push_back(seg.ChunkText(doc.firstChunk + c));
+			writer.AddDocument(seg.DocPath(d), doc.contentHash, texts, seg.Vector(doc.firstChunk));
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(publishLock);
+	KbManifest manifest;
+	if (!manifest.Load(kbDir)) return false;
+	for (const std::string& in : inputs)
+		if (std::find(manifest.segments.begin(), manifest.segments.end(), in) == manifest.segments.end())
+			return false;   // Someone else compacted these already
+
+	std::string merged;
+	if (!writer.Empty()) {
+		if (!writer.Write(kbDir, manifest.nextGeneration, generation, &merged))
+			return false;
+		manifest.nextGeneration++;
+	}
+
+	std::vector<std::string> segments;
+	for (const std::string& name : manifest.segments)
+		if (std::find(inputs.begin(), inputs.end(), name) == inputs.end())
+			segments.push_back(name);
+	if (!merged.empty())
+		segments.push_back(merged);
+	manifest.segments = segments;
+
+	// Keep only tombstones that still hit a document in a remaining segment
+	std::vector<std::unique_ptr<CKbSegment>> remaining;
+	for (const std::string& name : manifest.segments)
+	{
+		std::unique_ptr<CKbSegment> seg(new CKbSegment());
+		if (!seg->Open(KbJoinPath(kbDir, name))) {
+			if (!merged.empty()) KbDeleteFile(KbJoinPath(kbDir, merged));
+			return false;
+		}
+		remaining.push_back(std::move(seg));
+	}
+	size_t dropped = 0;
+	for (auto it = manifest.tombstones.begin(); it != manifest.tombstones.end();)
+	{
+		bool used = false;
+		for (const auto& seg : remaining)
+			if (seg->Header().generation <= it->second && seg->FindDoc(it->first)) {
+				used = true;
+				break;
+			}
+		if (used) ++it;
+		else {
+			it = manifest.tombstones.erase(it);
+			++dropped;
+		}
+	}
+
+	if (!manifest.Save(kbDir)) {
+		if (!merged.empty()) KbDeleteFile(KbJoinPath(kbDir, merged));
+		return false;
+	}
+	for (const std::string& in : inputs)
+		KbDeleteFile(KbJoinPath(kbDir, in));
+
+	if (stats) {
+		stats->segmentsIn = inputs.size();
+		stats->chunksIn = chunksIn;
+		stats->chunksOut = writer.ChunkCount();
+		stats->tombstonesDropped = dropped;
+	}
+	return true;
+}
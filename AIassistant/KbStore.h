@@ -0,0 +1,214 @@
+﻿// [Function] Knowledge-base storage and retrieval engine (format: see KbFormat.h).
+// Portable C++14 without MFC, so the same code backs the assistant and the
+// command-line tools; file paths are UTF-8.
+#pragma once
+
+#include "KbFormat.h"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// [Function] Read-only memory mapping of a whole file (MapViewOfFile / mmap).
+class CKbMappedFile
+{
+public:
+	CKbMappedFile() = default;
+	~CKbMappedFile();
+	CKbMappedFile(const CKbMappedFile&) = delete;
+	CKbMappedFile& operator=(const CKbMappedFile&) = delete;
+
+	bool Open(const std::string& path);
+	void Close();
+	const unsigned char* Data() const { return m_data; }
+	uint64_t Size() const { return m_size; }
+
+private:
+	const unsigned char* m_data = nullptr;
+	uint64_t m_size = 0;
+#ifdef _WIN32
+	void* m_hFile = nullptr;
+	void* m_hMapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+};
+
+// [Function] One immutable, mapped segment. All accessors point into the mapping.
+class CKbSegment
+{
+public:
+	bool Open(const std::string& path, std::string* error = nullptr);
+	bool Verify() const;   // O(size): recompute the section checksums
+
+	const std::string& FileName() const { return m_fileName; }
+	const KbSegmentHeader& Header() const { return *m_header; }
+	uint32_t Dim() const { return m_header->dim; }
+	uint64_t ChunkCount() const { return m_header->chunkCount; }
+	uint64_t DocCount() const { return m_header->docCount; }
+
+	const float* Vector(uint64_t chunk) const { return m_vectors + chunk * m_header->dim; }
+	const KbChunkRecord& Chunk(uint64_t chunk) const { return m_chunks[chunk]; }
+	const KbDocRecord& Doc(uint64_t doc) const { return m_docs[doc]; }
+	std::string ChunkText(uint64_t chunk) const;
+	std::string DocPath(uint64_t doc) const;
+	const KbDocRecord* FindDoc(uint64_t docId) const;   // Binary search, docs are sorted
+
+private:
+	CKbMappedFile m_file;
+	std::string m_fileName;
+	const KbSegmentHeader* m_header = nullptr;
+	const float* m_vectors = nullptr;
+	const KbChunkRecord* m_chunks = nullptr;
+	const char* m_text = nullptr;
+	const KbDocRecord* m_docs = nullptr;
+	const char* m_strings = nullptr;
+};
+
+// [Function] Builds one segment in memory and writes it to disk atomically.
+class CKbSegmentWriter
+{
+public:
+	explicit CKbSegmentWriter(uint32_t dim) : m_dim(dim) {}
+
+	// `vectors` holds chunks.size() * dim floats; they are normalised on the way in.
+	void AddDocument(const std::string& path, uint64_t contentHash,
+		const std::vector<std::string>& chunks, const float* vectors);
+	bool Empty() const { return m_docs.empty(); }
+	uint32_t Dim() const { return m_dim; }
+	uint64_t ChunkCount() const { return m_chunkRecords.size(); }
+
+	// Writes kbDir/seg_<fileNumber>.kbs (via a temp file) and returns its file name.
+	bool Write(const std::string& kbDir, uint64_t fileNumber, uint64_t generation,
+		std::string* fileName);
+	std::vector<uint64_t> DocIds() const;
+
+private:
+	struct PendingDoc {
+		KbDocRecord record;
+		std::string path;
+	};
+
+	uint32_t m_dim;
+	std::vector<float> m_vectors;
+	std::vector<KbChunkRecord> m_chunkRecords;
+	std::string m_text;
+	std::vector<PendingDoc> m_docs;
+};
+
+// [Function] The kb.manifest file: embedding dimension, live segments and tombstones.
+struct KbManifest
+{
+	uint32_t dim = 0;
+	uint64_t nextGeneration = 1;
+	std::vector<std::string> segments;
+	std::unordered_map<uint64_t, uint64_t> tombstones;   // docId -> generation
+	uint64_t fingerprint = 0;                           // FNV-1a of the file, set by Load
+
+	// Deletes every version of docId that exists at the current generation
+	void AddTombstone(uint64_t docId);
+	bool IsDeleted(uint64_t docId, uint64_t generation) const;
+
+	// false if the manifest can't be read; `missing` tells whether it doesn't exist at all
+	bool Load(const std::string& kbDir, bool* missing = nullptr);
+	bool Save(const std::string& kbDir) const;   // temp file + atomic rename
+};
+
+struct KbHit
+{
+	float    score;
+	uint32_t segment;
+	uint64_t chunk;
+};
+
+// [Function] Retrieval engine: opens the manifest and maps every live segment.
+// Tombstoned chunks are turned into a per-segment dead mask once at open;
+// Search is an exact inner-product scan over the live mapped vectors.
+// An open reader is an immutable snapshot: later publishes and compactions
+// never change what it sees, so any number of threads may search it.
+class CKbReader
+{
+public:
+	// `reuse`: an older snapshot whose mappings are shared instead of mapped again
+	bool Open(const std::string& kbDir, std::string* error = nullptr, const CKbReader* reuse = nullptr);
+	bool IsOpen() const { return m_manifest.dim != 0; }
+	uint32_t Dim() const { return m_manifest.dim; }
+	uint64_t ChunkCount() const;       // Including dead chunks
+	uint64_t LiveChunkCount() const;
+
+	std::vector<KbHit> Search(const float* query, size_t k) const;
+	const CKbSegment& Segment(uint32_t i) const { return *m_segments[i]; }
+	size_t SegmentCount() const { return m_segments.size(); }
+	const KbManifest& Manifest() const { return m_manifest; }
+	bool IsDead(uint32_t segment, uint64_t chunk) const;
+	uint64_t DeadChunkCount(uint32_t segment) const { return m_deadCount[segment]; }
+
+private:
+	bool OpenOnce(const std::string& kbDir, std::string* error, const CKbReader* reuse);
+
+	KbManifest m_manifest;
+	std::vector<std::shared_ptr<const CKbSegment>> m_segments;
+	std::vector<std::vector<bool>> m_dead;   // Empty for segments without deletions
+	std::vector<uint64_t> m_deadCount;
+};
+
+// [Function] The current snapshot of one kb, shared by all query threads.
+// Acquire() never waits on a writer: it compares the manifest fingerprint and
+// only reopens (and swaps in) a new reader after a publish.
+class CKbSnapshotCache
+{
+public:
+	explicit CKbSnapshotCache(const std::string& kbDir) : m_kbDir(kbDir) {}
+	std::shared_ptr<const CKbReader> Acquire();   // nullptr until the kb exists
+
+private:
+	std::string m_kbDir;
+	std::mutex m_lock;   // Guards m_current only, never held while mapping
+	std::shared_ptr<const CKbReader> m_current;
+};
+
+// [Function] Write side. Callers serialise writers (one process, one lock);
+// readers never need the lock because segments are immutable and the manifest
+// is replaced atomically.
+
+// Publish a new segment. Older versions of every document in it are tombstoned,
+// as are `removedDocIds`.
+bool KbPublishSegment(const std::string& kbDir, CKbSegmentWriter& writer,
+	const std::vector<uint64_t>& removedDocIds, std::string* fileName = nullptr);
+
+// Tombstone documents without adding anything.
+bool KbRemoveDocuments(const std::string& kbDir, const std::vector<uint64_t>& docIds);
+
+struct KbCompactionPolicy
+{
+	double garbageRatio = 0.3;   // Rewrite a segment once this share of its chunks is dead
+	size_t maxSegments = 16;     // Merge the smallest segments beyond this count
+};
+
+struct KbCompactionStats
+{
+	size_t   segmentsIn = 0;
+	uint64_t chunksIn = 0;
+	uint64_t chunksOut = 0;
+	size_t   tombstonesDropped = 0;
+};
+
+// Decide and run one compaction round. The expensive rewrite happens without
+// `publishLock` held; it is only taken to swap the manifest. Returns false if
+// there was nothing to do or the kb changed underneath.
+bool KbCompact(const std::string& kbDir, const KbCompactionPolicy& policy,
+	std::mutex& publishLock, KbCompactionStats* stats = nullptr);
+
+// [Function] Helpers shared by writers and readers.
+// Document ids fold the case of the path like NTFS does (KbFoldPathCase on Windows).
+uint64_t KbDocId(const std::string& utf8Path);
+#ifdef _WIN32
+// The one case folding for note paths, also used for the sync indexer's manifest keys.
+void KbFoldPathCase(std::wstring& path);
+#endif
+std::string KbJoinPath(const std::string& dir, const std::string& name);
+bool KbReplaceFile(const std::string& from, const std::string& to);
+bool KbDeleteFile(const std::string& path);
+void KbNormalize(float* v, uint32_t dim);
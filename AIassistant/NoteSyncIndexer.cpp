@@ -0,0 +1,503 @@
+﻿// [Function] Incremental sync of the QOwnNotes note folder into the knowledge base.
+// See NoteSyncIndexer.h for the journal protocol.
+#include "pch.h"
+#include <atlconv.h>
+#include "framework.h"
+#include "AIassistantDlg.h"
+#include "NoteSyncIndexer.h"
+#include "KbStore.h"
+#include <vector>
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+static const wchar_t* kJournalName = L"\\note_events.journal";
+static const wchar_t* kManifestName = L"\\note_manifest.tsv";
+static const uint64_t kJournalRotateSize = 1024 * 1024;   // Rotate the journal once 1 MB has been consumed
+static const size_t kIngestBatchSize = 64;                 // Notes per embedding run / kb segment
+
+CNoteSyncIndexer::CNoteSyncIndexer()
+{
+}
+
+CNoteSyncIndexer::~CNoteSyncIndexer()
+{
+	Stop();
+}
+
+// [Function] Only Markdown/plain-text notes are indexed (QOwnNotes default note extensions).
+bool CNoteSyncIndexer::IsNotePath(const std::wstring& path)
+{
+	CString ext = PathFindExtensionW(path.c_str());
+	ext.MakeLower();
+	return ext == L".md" || ext == L".txt";
+}
+
+// [Function] Manifest key: Windows separators, case folded like KbDocId (NTFS is
+// case-insensitive), so a note is one document to both.
+std::wstring CNoteSyncIndexer::Key(const std::wstring& path)
+{
+	std::wstring key = path;
+	for (wchar_t& c : key)
+		if (c == L'/') c = L'\\';
+	KbFoldPathCase(key);
+	return key;
+}
+
+// [Function] FNV-1a 64 over the raw file bytes; cheap enough to run on every changed note.
+uint64_t CNoteSyncIndexer::HashFile(const std::wstring& path, uint64_t* size)
+{
+	HANDLE h = CreateFileW(path.c_str(), GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (h == INVALID_HANDLE_VALUE) return 0;
+
+	uint64_t hash = 1469598103934665603ull;
+	uint64_t total = 0;
+	std::vector<unsigned char> buf(64 * 1024);
+	DWORD n = 0;
+	while (ReadFile(h, buf.data(), (DWORD)buf.size(), &n, nullptr) && n)
+	{
+		for (DWORD i = 0; i < n; ++i) {
+			hash ^= buf[i];
+			hash *= 1099511628211ull;
+		}
+		total += n;
+	}
+	CloseHandle(h);
+	if (size) *size = total;
+	return hash;
+}
+
+bool CNoteSyncIndexer::Start(const CString& noteFolder, const CString& kbDir, HWND hNotify)
+{
+	if (m_thread) return true;
+	// rag_query.exe can neither replace nor forget documents: without the native kb every
+	// edit would leave the old chunks behind, so the Python kb is only rebuilt by hand
+	if (!NativeKbAvailable() || !PathIsDirectoryW(noteFolder)) return false;
+
+	m_noteFolder = (LPCWSTR)noteFolder;
+	for (wchar_t& c : m_noteFolder)
+		if (c == L'/') c = L'\\';
+	while (!m_noteFolder.empty() && m_noteFolder.back() == L'\\')
+		m_noteFolder.pop_back();
+	m_kbDir = kbDir;
+	m_hNotify = hNotify;
+
+	m_hStopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+	m_thread = AfxBeginThread(ThreadProc, this, THREAD_PRIORITY_BELOW_NORMAL,
+		0, CREATE_SUSPENDED);
+	if (!m_thread) {
+		CloseHandle(m_hStopEvent);
+		m_hStopEvent = nullptr;
+		return false;
+	}
+	// Keep the CWinThread alive after the thread exits so Stop() can wait on it
+	m_thread->m_bAutoDelete = FALSE;
+	m_thread->ResumeThread();
+	return true;
+}
+
+void CNoteSyncIndexer::Stop()
+{
+	if (!m_thread) return;
+	SetEvent(m_hStopEvent);
+	WaitForSingleObject(m_thread->m_hThread, INFINITE);
+	delete m_thread;
+	CloseHandle(m_hStopEvent);
+	m_thread = nullptr;
+	m_hStopEvent = nullptr;
+}
+
+UINT CNoteSyncIndexer::ThreadProc(LPVOID pParam)
+{
+	reinterpret_cast<CNoteSyncIndexer*>(pParam)->Run();
+	return 0;
+}
+
+// [Function] Worker loop: reconcile once against the folder (stat only, no re-embedding of
+// unchanged notes), then wake on every write to the kb directory and drain the journal.
+void CNoteSyncIndexer::Run()
+{
+	LoadManifest();
+	FullReconcile();
+
+	HANDLE hChange = FindFirstChangeNotificationW(m_kbDir.c_str(), FALSE,
+		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+
+	for (;;)
+	{
+		std::unordered_set<std::wstring> files, dirs;
+		DrainJournal(files, dirs);
+
+		// Only the directory itself; subdirectories that appeared (created, renamed or
+		// moved in) are walked by ScanDirectory
+		std::unordered_set<std::wstring> seen;
+		for (const std::wstring& dir : dirs)
+			ScanDirectory(dir, false, seen, files);
+
+		int reindexed = ProcessFiles(files);
+		if (m_manifestDirty) SaveManifest();
+		if (!files.empty() || !dirs.empty()) {
+			CString status;
+			status.Format(L"Notes: %d re-indexed, %Iu tracked", reindexed, m_manifest.size());
+			PostStatus(status);
+		}
+		// Edits leave dead chunks behind; reclaim them here, off the UI thread
+		if (reindexed > 0) {
+			CString log;
+			while (WaitForSingleObject(m_hStopEvent, 0) != WAIT_OBJECT_0 && CompactKb(&log))
+				PostStatus(L"Notes: " + log);
+		}
+
+		// Sub-second staleness: wake on any kb write, poll at least every 500 ms
+		HANDLE waits[2] = { m_hStopEvent, hChange };
+		DWORD count = (hChange != INVALID_HANDLE_VALUE) ? 2 : 1;
+		DWORD r = WaitForMultipleObjects(count, waits, FALSE, 500);
+		if (r == WAIT_OBJECT_0) break;
+		if (r == WAIT_OBJECT_0 + 1)
+			FindNextChangeNotification(hChange);
+	}
+
+	if (hChange != INVALID_HANDLE_VALUE)
+		FindCloseChangeNotification(hChange);
+	if (m_manifestDirty) SaveManifest();
+}
+
+// [Function] Walk the whole note folder once (directory enumeration only) and
+// queue every note whose size/mtime differs from the manifest.
+void CNoteSyncIndexer::FullReconcile()
+{
+	std::unordered_set<std::wstring> seen, files;
+	ScanDirectory(m_noteFolder, true, seen, files);
+
+	int reindexed = ProcessFiles(files);
+	if (m_manifestDirty) SaveManifest();
+
+	CString status;
+	status.Format(L"Notes: %d re-indexed, %Iu tracked", reindexed, m_manifest.size());
+	PostStatus(status);
+}
+
+// [Function] Enumerate a directory (optionally recursively). Notes whose size/mtime
+// differ from the manifest go into `files`; manifest entries below `dir` that were
+// not seen are queued as well so that ProcessFile turns them into tombstones.
+// Without `recursive` only subdirectories without tracked notes are walked: those are
+// new or were renamed, the others report their own changes.
+void CNoteSyncIndexer::ScanDirectory(const std::wstring& dir, bool recursive,
+	std::unordered_set<std::wstring>& seen, std::unordered_set<std::wstring>& files)
+{
+	std::wstring prefix = Key(dir) + L"\\";
+
+	// Direct subdirectories of `dir` with tracked notes (keys), and the ones on disk
+	std::unordered_set<std::wstring> trackedDirs, presentDirs;
+	if (!recursive)
+	{
+		for (const auto& kv : m_manifest)
+		{
+			if (kv.second.deleted || kv.first.compare(0, prefix.size(), prefix) != 0) continue;
+			size_t slash = kv.first.find(L'\\', prefix.size());
+			if (slash != std::wstring::npos)
+				trackedDirs.insert(kv.first.substr(0, slash));
+		}
+	}
+
+	std::vector<std::pair<std::wstring, bool>> stack{ { dir, recursive } };
+	while (!stack.empty())
+	{
+		std::wstring cur = stack.back().first;
+		bool walk = stack.back().second;
+		stack.pop_back();
+
+		WIN32_FIND_DATAW fd{};
+		HANDLE hFind = FindFirstFileExW((cur + L"\\*").c_str(), FindExInfoBasic, &fd,
+			FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+		if (hFind == INVALID_HANDLE_VALUE) continue;
+		do
+		{
+			// Skip ".", ".." and hidden folders such as ".git" or ".trash"
+			if (fd.cFileName[0] == L'.') continue;
+			std::wstring full = cur + L"\\" + fd.cFileName;
+
+			if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+				if (walk) {
+					stack.push_back({ full, true });
+					continue;
+				}
+				std::wstring key = Key(full);
+				presentDirs.insert(key);
+				if (!trackedDirs.count(key)) stack.push_back({ full, true });
+				continue;
+			}
+			if (!IsNotePath(full)) continue;
+
+			std::wstring key = Key(full);
+			seen.insert(key);
+			uint64_t size = ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+			uint64_t mtime = ((uint64_t)fd.ftLastWriteTime.dwHighDateTime << 32) |
+				fd.ftLastWriteTime.dwLowDateTime;
+
+			auto it = m_manifest.find(key);
+			if (it == m_manifest.end() || it->second.deleted ||
+				it->second.size != size || it->second.mtime != mtime)
+				files.insert(full);
+		} while (FindNextFileW(hFind, &fd));
+		FindClose(hFind);
+	}
+
+	// Anything tracked below `dir` that no longer exists becomes a tombstone; without
+	// `recursive`, notes in subdirectories that are still there were not looked at
+	for (const auto& kv : m_manifest)
+	{
+		if (kv.second.deleted || seen.count(kv.first)) continue;
+		if (kv.first.compare(0, prefix.size(), prefix) != 0) continue;
+		size_t slash = kv.first.find(L'\\', prefix.size());
+		if (!recursive && slash != std::wstring::npos) {
+			std::wstring subDir = kv.first.substr(0, slash);
+			if (presentDirs.count(subDir) && trackedDirs.count(subDir)) continue;
+		}
+		files.insert(kv.second.path);
+	}
+}
+
+// [Function] Run ProcessFile over a change set; changed notes are embedded in batches
+// so one kb segment covers many notes. Returns the number of notes re-indexed or removed.
+int CNoteSyncIndexer::ProcessFiles(const std::unordered_set<std::wstring>& files)
+{
+	int changed = 0;
+	for (const std::wstring& file : files)
+	{
+		if (WaitForSingleObject(m_hStopEvent, 0) == WAIT_OBJECT_0) break;
+		if (ProcessFile(file)) ++changed;
+		if (m_batch.size() >= kIngestBatchSize) {
+			changed += FlushBatch();
+			SaveManifest();
+		}
+	}
+	changed += FlushBatch();
+	return changed;
+}
+
+// [Function] Embed the queued notes in one go, then retire their previous versions.
+int CNoteSyncIndexer::FlushBatch()
+{
+	if (m_batch.empty()) return 0;
+
+	std::vector<KbIngestItem> items;
+	for (const NoteEntry& e : m_batch)
+	{
+		KbIngestItem item;
+		item.textPath = e.path.c_str();
+		item.sourcePath = e.path.c_str();
+		item.contentHash = e.hash;
+		items.push_back(item);
+	}
+
+	CString log;
+	bool ok = IngestFilesToKb(items, &log);
+	int count = 0;
+	if (ok)   // Otherwise leave the manifest alone so the notes are retried on the next event
+	{
+		for (const NoteEntry& e : m_batch)
+		{
+			// Start() only runs with the native kb, which tombstones the previous
+			// version by itself when the new segment is published
+			m_manifest[Key(e.path)] = e;
+			++count;
+		}
+		m_manifestDirty = true;
+	}
+	m_batch.clear();
+	return count;
+}
+
+// [Function] Bring one note up to date. Returns true if it was tombstoned; notes that
+// need (re-)indexing are queued for FlushBatch().
+// Cost for an unchanged note is a single attribute query; content is hashed only when
+// size/mtime moved, and the embedder only runs when the hash moved.
+bool CNoteSyncIndexer::ProcessFile(const std::wstring& path)
+{
+	std::wstring key = Key(path);
+	auto it = m_manifest.find(key);
+	bool tracked = it != m_manifest.end() && !it->second.deleted;
+
+	WIN32_FILE_ATTRIBUTE_DATA fad{};
+	if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &fad) ||
+		(fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+	{
+		if (!tracked || !AddTombstone(it->second)) return false;   // Retried on the next event
+		it->second.deleted = true;
+		m_manifestDirty = true;
+		return true;
+	}
+
+	uint64_t size = ((uint64_t)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+	uint64_t mtime = ((uint64_t)fad.ftLastWriteTime.dwHighDateTime << 32) |
+		fad.ftLastWriteTime.dwLowDateTime;
+	if (tracked && it->second.size == size && it->second.mtime == mtime)
+		return false;
+
+	uint64_t hash = HashFile(path, &size);
+	if (tracked && it->second.hash == hash) {
+		// Touched but not changed (e.g. sync client rewrote the same bytes)
+		it->second.size = size;
+		it->second.mtime = mtime;
+		m_manifestDirty = true;
+		return false;
+	}
+
+	NoteEntry entry;
+	entry.path = path;
+	entry.size = size;
+	entry.mtime = mtime;
+	entry.hash = hash;
+	m_batch.push_back(entry);
+	return false;
+}
+
+// [Function] Retire a removed note: tombstone in kb.manifest. Only the native kb can
+// forget documents; without it the note is not recorded as deleted and stays queued.
+bool CNoteSyncIndexer::AddTombstone(const NoteEntry& entry)
+{
+	if (!NativeKbAvailable()) return false;
+	return RemoveFilesFromKb({ CString(entry.path.c_str()) });
+}
+
+// [Function] Read new journal lines since the last offset. Only complete lines are consumed;
+// once the journal is large and fully drained it is renamed away and a fresh one is started.
+bool CNoteSyncIndexer::DrainJournal(std::unordered_set<std::wstring>& files,
+	std::unordered_set<std::wstring>& dirs)
+{
+	std::wstring journal = m_kbDir + kJournalName;
+	std::wstring rotated = journal + L".old";
+
+	WIN32_FILE_ATTRIBUTE_DATA fad{};
+	if (!GetFileAttributesExW(journal.c_str(), GetFileExInfoStandard, &fad))
+		return false;
+	uint64_t size = ((uint64_t)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+	if (size < m_journalOffset)
+		m_journalOffset = 0;   // Truncated externally, start over
+	if (size == m_journalOffset)
+		return false;
+
+	// Rotate before reading so that later appends land in a new file
+	bool rotate = size >= kJournalRotateSize;
+	std::wstring source = journal;
+	if (rotate && MoveFileExW(journal.c_str(), rotated.c_str(), MOVEFILE_REPLACE_EXISTING))
+		source = rotated;
+	else
+		rotate = false;
+
+	HANDLE h = CreateFileW(source.c_str(), GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (h == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER off; off.QuadPart = (LONGLONG)m_journalOffset;
+	SetFilePointerEx(h, off, nullptr, FILE_BEGIN);
+	std::string data; char tmp[4096]; DWORD n = 0;
+	while (ReadFile(h, tmp, sizeof(tmp), &n, nullptr) && n)
+		data.append(tmp, n);
+	CloseHandle(h);
+
+	size_t consumed = 0, pos;
+	while ((pos = data.find('\n', consumed)) != std::string::npos)
+	{
+		std::string line = data.substr(consumed, pos - consumed);
+		consumed = pos + 1;
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.size() < 3 || line[1] != '\t') continue;
+
+		std::wstring path = CA2W(line.c_str() + 2, CP_UTF8);
+		for (wchar_t& c : path)
+			if (c == L'/') c = L'\\';
+		if (line[0] == 'D')
+			dirs.insert(path);
+		else if (IsNotePath(path))
+			files.insert(path);
+	}
+
+	if (rotate) {
+		DeleteFileW(rotated.c_str());
+		m_journalOffset = 0;
+	}
+	else {
+		m_journalOffset += consumed;
+	}
+	m_manifestDirty = true;
+	return true;
+}
+
+// [Function] Manifest: header "#v1<TAB>journalOffset", then one line per note:
+// hash<TAB>size<TAB>mtime<TAB>deleted<TAB>path (UTF-8).
+void CNoteSyncIndexer::LoadManifest()
+{
+	m_manifest.clear();
+	m_journalOffset = 0;
+
+	CFile file;
+	if (!file.Open((m_kbDir + kManifestName).c_str(), CFile::modeRead | CFile::shareDenyWrite | CFile::typeBinary))
+		return;
+	std::string data((size_t)file.GetLength(), '\0');
+	if (!data.empty())
+		file.Read(&data[0], (UINT)data.size());
+	file.Close();
+
+	size_t cur = 0, pos;
+	while ((pos = data.find('\n', cur)) != std::string::npos)
+	{
+		std::string line = data.substr(cur, pos - cur);
+		cur = pos + 1;
+		if (line.rfind("#v1\t", 0) == 0) {
+			m_journalOffset = _strtoui64(line.c_str() + 4, nullptr, 10);
+			continue;
+		}
+
+		NoteEntry e;
+		char* p = &line[0];
+		char* end = nullptr;
+		e.hash = _strtoui64(p, &end, 16);   if (*end != '\t') continue; p = end + 1;
+		e.size = _strtoui64(p, &end, 10);   if (*end != '\t') continue; p = end + 1;
+		e.mtime = _strtoui64(p, &end, 10);  if (*end != '\t') continue; p = end + 1;
+		e.deleted = *p == '1';              if (p[1] != '\t') continue; p += 2;
+		e.path = CA2W(p, CP_UTF8);
+		m_manifest[Key(e.path)] = e;
+	}
+}
+
+// [Function] Write to a temp file and rename over the old manifest so a crash never leaves
+// a half-written manifest behind.
+void CNoteSyncIndexer::SaveManifest()
+{
+	std::string out;
+	out.reserve(m_manifest.size() * 96);
+	char head[64];
+	sprintf_s(head, "#v1\t%I64u\n", m_journalOffset);
+	out += head;
+	for (const auto& kv : m_manifest)
+	{
+		const NoteEntry& e = kv.second;
+		char buf[96];
+		sprintf_s(buf, "%016I64x\t%I64u\t%I64u\t%c\t", e.hash, e.size, e.mtime, e.deleted ? '1' : '0');
+		out += buf;
+		out += CW2A(e.path.c_str(), CP_UTF8);
+		out += '\n';
+	}
+
+	std::wstring path = m_kbDir + kManifestName;
+	std::wstring tmp = path + L".tmp";
+	CFile file;
+	if (!file.Open(tmp.c_str(), CFile::modeCreate | CFile::modeWrite | CFile::typeBinary))
+		return;
+	file.Write(out.data(), (UINT)out.size());
+	file.Close();
+	if (MoveFileExW(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		m_manifestDirty = false;
+}
+
+void CNoteSyncIndexer::PostStatus(const CString& text)
+{
+	if (m_hNotify && IsWindow(m_hNotify))
+		PostMessage(m_hNotify, WM_NOTESYNC_STATUS, 0, (LPARAM)new CString(text));
+}
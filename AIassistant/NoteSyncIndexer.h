@@ -0,0 +1,69 @@
+﻿// [Function] Background indexer that keeps the local knowledge base (kb)
+// in sync with the QOwnNotes note folder.
+// QOwnNotes appends one line per watcher event to kb\note_events.journal
+// ("F<TAB>path" for a changed note file, "D<TAB>path" for a changed directory);
+// this thread drains the journal, re-indexes only notes whose size/mtime and
+// content hash changed, and records removed or superseded notes as tombstones.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define WM_NOTESYNC_STATUS (WM_APP + 6)   // lParam = new CString, status text for the title bar
+
+class CNoteSyncIndexer
+{
+public:
+	// One manifest row per note file (key = full path, lower-cased)
+	struct NoteEntry {
+		std::wstring path;          // Original spelling of the path
+		uint64_t     size = 0;
+		uint64_t     mtime = 0;     // FILETIME as 100 ns ticks
+		uint64_t     hash = 0;      // FNV-1a 64 of the file bytes
+		bool         deleted = false;
+	};
+
+	CNoteSyncIndexer();
+	~CNoteSyncIndexer();
+
+	// Starts the worker thread; status messages are posted to hNotify.
+	bool Start(const CString& noteFolder, const CString& kbDir, HWND hNotify);
+	void Stop();
+	bool IsRunning() const { return m_thread != nullptr; }
+
+	static uint64_t HashFile(const std::wstring& path, uint64_t* size = nullptr);
+
+private:
+	static UINT ThreadProc(LPVOID pParam);
+	void Run();
+
+	void LoadManifest();
+	void SaveManifest();
+	void FullReconcile();
+	bool DrainJournal(std::unordered_set<std::wstring>& files,
+		std::unordered_set<std::wstring>& dirs);
+	void ScanDirectory(const std::wstring& dir, bool recursive,
+		std::unordered_set<std::wstring>& seen, std::unordered_set<std::wstring>& files);
+	int  ProcessFiles(const std::unordered_set<std::wstring>& files);
+	bool ProcessFile(const std::wstring& path);
+	int  FlushBatch();
+	bool AddTombstone(const NoteEntry& entry);
+	void PostStatus(const CString& text);
+
+	static bool IsNotePath(const std::wstring& path);
+	static std::wstring Key(const std::wstring& path);
+
+	std::unordered_map<std::wstring, NoteEntry> m_manifest;
+	std::vector<NoteEntry> m_batch;   // Changed notes waiting to be embedded
+	std::wstring m_noteFolder;
+	std::wstring m_kbDir;
+	uint64_t     m_journalOffset = 0;
+	bool         m_manifestDirty = false;
+
+	HWND   m_hNotify = nullptr;
+	CWinThread* m_thread = nullptr;
+	HANDLE m_hStopEvent = nullptr;
+};
@@ -0,0 +1,765 @@
+// [Function] Retrieval benchmark for the native knowledge base (KbStore.h).
+// For every corpus scale it builds a synthetic kb on disk exactly the way the
+// assistant does (documents -> segments -> KbPublishSegment), then measures
+//   build time, size on disk and peak memory of the build, and for each index
+//   type in kIndexTypes: open and index build time, index memory, query latency
+//   (p50/p99), recall@k against an exact scan that does not go through KbStore,
+//   and peak resident memory.
+// Results are written as one JSON document.
+//
+// The build and every index type run in a forked child of their own, so each
+// peak memory figure is that child's alone (RUSAGE_SELF), never cumulative.
+// Vectors are regenerated from (seed, chunk number) instead of being kept in
+// memory, so the ground truth does not distort the memory figures.
+#include "KbStore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct BenchOptions
+{
+	std::vector<uint64_t> scales{ 10000, 100000, 1000000 };   // Chunks per corpus
+	uint32_t dim = 384;               // bge-small-en-v1.5, the model the assistant ships with
+	uint32_t k = 10;
+	uint32_t queries = 200;           // Timed queries per scale
+	uint32_t recallQueries = 50;      // Of those, checked against the exact scan
+	uint32_t chunksPerDoc = 8;
+	uint32_t docsPerSegment = 1024;   // One segment per ingestion batch
+	uint32_t textBytes = 256;
+	uint32_t clusters = 256;          // Topic centroids the chunk vectors scatter around
+	uint64_t seed = 42;
+	std::vector<std::string> indexes{ "flat", "ivf", "sq8" };
+	uint32_t ivfLists = 0;            // 0: sqrt(live chunks)
+	uint32_t nprobe = 8;              // IVF lists scanned per query
+	uint32_t rerank = 4;              // SQ8 candidates rescored exactly, times k
+	bool     compact = false;         // Run KbCompact with the default policy before querying
+	bool     keep = false;
+	std::string dir = "/tmp/kb_bench";
+	std::string out;
+};
+
+// ---------------- Deterministic synthetic data ----------------
+
+static uint64_t SplitMix64(uint64_t& state)
+{
+	uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+static float Uniform(uint64_t& state)   // [-1, 1)
+{
+	return (float)((SplitMix64(state) >> 40) * (2.0 / 16777216.0) - 1.0);
+}
+
+class CSyntheticCorpus
+{
+public:
+	explicit CSyntheticCorpus(const BenchOptions& o) : m_opt(o), m_centroids((size_t)o.clusters * o.dim)
+	{
+		uint64_t state = o.seed;
+		for (float& v : m_centroids) v = Uniform(state);
+	}
+
+	// Chunk vector: its topic centroid plus noise, L2-normalised
+	void Vector(uint64_t chunk, float* out) const
+	{
+		uint64_t state = m_opt.seed ^ (chunk * 0xD1B54A32D192ED03ull);
+		const float* c = &m_centroids[(size_t)(SplitMix64(state) % m_opt.clusters) * m_opt.dim];
+		for (uint32_t i = 0; i < m_opt.dim; ++i)
+			out[i] = c[i] + 0.6f * Uniform(state);
+		KbNormalize(out, m_opt.dim);
+	}
+
+	// Query: a perturbed corpus chunk, so every query has real neighbours
+	void Query(uint32_t q, uint64_t chunks, float* out) const
+	{
+		uint64_t state = ~m_opt.seed ^ (q * 0xA0761D6478BD642Full);
+		Vector(SplitMix64(state) % chunks, out);
+		for (uint32_t i = 0; i < m_opt.dim; ++i)
+			out[i] += 0.05f * Uniform(state);
+		KbNormalize(out, m_opt.dim);
+	}
+
+	std::string Text(uint64_t chunk) const
+	{
+		char head[64];
+		snprintf(head, sizeof(head), "synthetic chunk %llu ", (unsigned long long)chunk);
+		std::string t = head;
+		while (t.size() < m_opt.textBytes) t += "lorem ipsum dolor sit amet ";
+		t.resize(m_opt.textBytes);
+		return t;
+	}
+
+	static std::string DocPath(uint64_t doc)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "bench/doc%08llu.md", (unsigned long long)doc);
+		return path;
+	}
+
+private:
+	const BenchOptions& m_opt;
+	std::vector<float> m_centroids;
+};
+
+// ---------------- Index types ----------------
+// CKbReader::Search (exact scan over the mapped segments) is what the assistant
+// ships. The approximate indexes are built in memory from an open reader so the
+// candidates can be compared on the same kb before one goes into KbStore.
+
+struct ChunkRef { uint32_t segment; uint64_t chunk; };
+
+// [Function] One index type under test. Build is timed, Bytes is the memory it
+// needs on top of the mapped segments.
+class CBenchIndex
+{
+public:
+	virtual ~CBenchIndex() {}
+	virtual const char* Name() const = 0;
+	virtual void Build(const CKbReader& reader) = 0;
+	virtual std::vector<KbHit> Search(const float* query, uint32_t k) const = 0;
+	virtual uint64_t Bytes() const = 0;
+};
+
+// [Function] Bounded min-heap that keeps the k best scores.
+class CTopK
+{
+public:
+	explicit CTopK(size_t k) : m_k(k) {}
+
+	void Push(float score, uint32_t segment, uint64_t chunk)
+	{
+		if (m_heap.size() < m_k) m_heap.push(KbHit{ score, segment, chunk });
+		else if (m_k && score > m_heap.top().score) {
+			m_heap.pop();
+			m_heap.push(KbHit{ score, segment, chunk });
+		}
+	}
+
+	std::vector<KbHit> Take()   // Best first
+	{
+		std::vector<KbHit> hits;
+		for (; !m_heap.empty(); m_heap.pop()) hits.push_back(m_heap.top());
+		std::reverse(hits.begin(), hits.end());
+		return hits;
+	}
+
+private:
+	struct Worse { bool operator()(const KbHit& a, const KbHit& b) const { return a.score > b.score; } };
+	size_t m_k;
+	std::priority_queue<KbHit, std::vector<KbHit>, Worse> m_heap;
+};
+
+static float Dot(const float* a, const float* b, uint32_t dim)
+{
+	float s = 0;
+	for (uint32_t i = 0; i < dim; ++i) s += a[i] * b[i];
+	return s;
+}
+
+static std::vector<ChunkRef> LiveChunks(const CKbReader& reader)
+{
+	std::vector<ChunkRef> refs;
+	refs.reserve((size_t)reader.LiveChunkCount());
+	for (uint32_t s = 0; s < reader.SegmentCount(); ++s)
+		for (uint64_t c = 0; c < reader.Segment(s).ChunkCount(); ++c)
+			if (!reader.IsDead(s, c)) refs.push_back({ s, c });
+	return refs;
+}
+
+// Runs f(begin, end) over [0, n) on every core
+template <class F>
+static void ParallelFor(uint64_t n, F f)
+{
+	unsigned threads = (std::max)(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> pool;
+	for (unsigned t = 0; t < threads; ++t)
+		pool.emplace_back(f, n * t / threads, n * (t + 1) / threads);
+	for (std::thread& t : pool) t.join();
+}
+
+// [Function] Exact inner-product scan, i.e. CKbReader::Search itself.
+class CFlatIndex : public CBenchIndex
+{
+public:
+	const char* Name() const override { return "flat"; }
+	void Build(const CKbReader& reader) override { m_reader = &reader; }
+	std::vector<KbHit> Search(const float* query, uint32_t k) const override { return m_reader->Search(query, k); }
+	uint64_t Bytes() const override { return 0; }
+
+private:
+	const CKbReader* m_reader = nullptr;
+};
+
+// [Function] Inverted file: spherical k-means over the live vectors, a query scans
+// the lists of its nprobe closest centroids with the exact mapped vectors.
+class CIvfIndex : public CBenchIndex
+{
+public:
+	CIvfIndex(uint32_t lists, uint32_t nprobe) : m_lists(lists), m_nprobe(nprobe) {}
+
+	const char* Name() const override { return "ivf"; }
+
+	void Build(const CKbReader& reader) override
+	{
+		m_reader = &reader;
+		m_dim = reader.Dim();
+		std::vector<ChunkRef> refs = LiveChunks(reader);
+		const uint64_t n = refs.size();
+		uint64_t lists = m_lists ? m_lists : (uint64_t)std::sqrt((double)n);
+		lists = (std::max)((uint64_t)1, (std::min)(lists, n));
+
+		// Train on an evenly spaced sample, seeded with every other sample vector
+		const uint64_t sampleSize = (std::min)(n, lists * 32);
+		std::vector<uint64_t> sample(sampleSize);
+		for (uint64_t i = 0; i < sampleSize; ++i) sample[i] = i * n / sampleSize;
+		m_centroids.assign((size_t)(lists * m_dim), 0.0f);
+		for (uint64_t l = 0; l < lists; ++l)
+			memcpy(&m_centroids[(size_t)(l * m_dim)], VectorOf(refs[sample[l * sampleSize / lists]]),
+				m_dim * sizeof(float));
+
+		std::vector<uint32_t> assignment(sampleSize);
+		for (int iteration = 0; iteration < 8; ++iteration)
+		{
+			ParallelFor(sampleSize, [&](uint64_t begin, uint64_t end) {
+				for (uint64_t i = begin; i < end; ++i)
+					assignment[i] = Nearest(VectorOf(refs[sample[i]]));
+			});
+			std::vector<float> sums(m_centroids.size(), 0.0f);
+			std::vector<uint64_t> counts(lists, 0);
+			for (uint64_t i = 0; i < sampleSize; ++i) {
+				const float* v = VectorOf(refs[sample[i]]);
+				float* sum = &sums[(size_t)assignment[i] * m_dim];
+				for (uint32_t d = 0; d < m_dim; ++d) sum[d] += v[d];
+				++counts[assignment[i]];
+			}
+			for (uint64_t l = 0; l < lists; ++l)
+				if (counts[l]) {   // An empty list keeps its centroid
+					KbNormalize(&sums[(size_t)(l * m_dim)], m_dim);
+					memcpy(&m_centroids[(size_t)(l * m_dim)], &sums[(size_t)(l * m_dim)],
+						m_dim * sizeof(float));
+				}
+		}
+
+		// Assign every live chunk and lay the lists out contiguously
+		assignment.assign((size_t)n, 0);
+		ParallelFor(n, [&](uint64_t begin, uint64_t end) {
+			for (uint64_t i = begin; i < end; ++i) assignment[i] = Nearest(VectorOf(refs[i]));
+		});
+		m_offsets.assign((size_t)(lists + 1), 0);
+		for (uint32_t l : assignment) ++m_offsets[l + 1];
+		for (uint64_t l = 0; l < lists; ++l) m_offsets[l + 1] += m_offsets[l];
+		m_entries.resize((size_t)n);
+		std::vector<uint64_t> next(m_offsets.begin(), m_offsets.end() - 1);
+		for (uint64_t i = 0; i < n; ++i) m_entries[(size_t)next[assignment[i]]++] = refs[i];
+	}
+
+	std::vector<KbHit> Search(const float* query, uint32_t k) const override
+	{
+		const uint64_t lists = m_offsets.size() - 1;
+		CTopK probes((std::min)((uint64_t)m_nprobe, lists));
+		for (uint64_t l = 0; l < lists; ++l)
+			probes.Push(Dot(query, &m_centroids[(size_t)(l * m_dim)], m_dim), 0, l);
+
+		CTopK top(k);
+		for (const KbHit& probe : probes.Take())
+			for (uint64_t e = m_offsets[probe.chunk]; e < m_offsets[probe.chunk + 1]; ++e) {
+				const ChunkRef& r = m_entries[(size_t)e];
+				top.Push(Dot(query, VectorOf(r), m_dim), r.segment, r.chunk);
+			}
+		return top.Take();
+	}
+
+	uint64_t Bytes() const override
+	{
+		return m_centroids.size() * sizeof(float) + m_offsets.size() * sizeof(uint64_t) +
+			m_entries.size() * sizeof(ChunkRef);
+	}
+
+private:
+	const float* VectorOf(const ChunkRef& r) const { return m_reader->Segment(r.segment).Vector(r.chunk); }
+
+	uint32_t Nearest(const float* v) const
+	{
+		uint32_t best = 0;
+		float bestScore = -1e30f;
+		for (uint32_t l = 0; l * m_dim < m_centroids.size(); ++l) {
+			float s = Dot(v, &m_centroids[(size_t)l * m_dim], m_dim);
+			if (s > bestScore) { bestScore = s; best = l; }
+		}
+		return best;
+	}
+
+	uint32_t m_lists, m_nprobe, m_dim = 0;
+	const CKbReader* m_reader = nullptr;
+	std::vector<float> m_centroids;
+	std::vector<uint64_t> m_offsets;   // List l is m_entries[m_offsets[l], m_offsets[l + 1])
+	std::vector<ChunkRef> m_entries;
+};
+
+// [Function] 8-bit scalar quantisation: every dimension is mapped linearly onto
+// 0..255 between its min and max; the rerank * k best codes are rescored exactly.
+class CSq8Index : public CBenchIndex
+{
+public:
+	explicit CSq8Index(uint32_t rerank) : m_rerank((std::max)(1u, rerank)) {}
+
+	const char* Name() const override { return "sq8"; }
+
+	void Build(const CKbReader& reader) override
+	{
+		m_reader = &reader;
+		m_dim = reader.Dim();
+		m_refs = LiveChunks(reader);
+		m_min.assign(m_dim, 1e30f);
+		m_scale.assign(m_dim, -1e30f);   // Holds the max until the scale is known
+		for (const ChunkRef& r : m_refs) {
+			const float* v = VectorOf(r);
+			for (uint32_t d = 0; d < m_dim; ++d) {
+				m_min[d] = (std::min)(m_min[d], v[d]);
+				m_scale[d] = (std::max)(m_scale[d], v[d]);
+			}
+		}
+		for (uint32_t d = 0; d < m_dim; ++d)
+			m_scale[d] = m_scale[d] > m_min[d] ? (m_scale[d] - m_min[d]) / 255.0f : 1.0f;
+
+		m_codes.resize(m_refs.size() * m_dim);
+		ParallelFor(m_refs.size(), [&](uint64_t begin, uint64_t end) {
+			for (uint64_t i = begin; i < end; ++i) {
+				const float* v = VectorOf(m_refs[(size_t)i]);
+				uint8_t* code = &m_codes[(size_t)(i * m_dim)];
+				for (uint32_t d = 0; d < m_dim; ++d)
+					code[d] = (uint8_t)std::lround((v[d] - m_min[d]) / m_scale[d]);
+			}
+		});
+	}
+
+	std::vector<KbHit> Search(const float* query, uint32_t k) const override
+	{
+		// q.v ~= q.min + sum(q[d] * scale[d] * code[d])
+		std::vector<float> scaled(m_dim);
+		for (uint32_t d = 0; d < m_dim; ++d) scaled[d] = query[d] * m_scale[d];
+		const float offset = Dot(query, m_min.data(), m_dim);
+
+		CTopK candidates((size_t)k * m_rerank);
+		for (size_t i = 0; i < m_refs.size(); ++i) {
+			const uint8_t* code = &m_codes[i * m_dim];
+			float s = offset;
+			for (uint32_t d = 0; d < m_dim; ++d) s += scaled[d] * code[d];
+			candidates.Push(s, 0, i);
+		}
+
+		CTopK top(k);
+		for (const KbHit& c : candidates.Take()) {
+			const ChunkRef& r = m_refs[(size_t)c.chunk];
+			top.Push(Dot(query, VectorOf(r), m_dim), r.segment, r.chunk);
+		}
+		return top.Take();
+	}
+
+	uint64_t Bytes() const override
+	{
+		return m_codes.size() + m_refs.size() * sizeof(ChunkRef) + 2 * m_dim * sizeof(float);
+	}
+
+private:
+	const float* VectorOf(const ChunkRef& r) const { return m_reader->Segment(r.segment).Vector(r.chunk); }
+
+	uint32_t m_rerank, m_dim = 0;
+	const CKbReader* m_reader = nullptr;
+	std::vector<ChunkRef> m_refs;
+	std::vector<float> m_min, m_scale;
+	std::vector<uint8_t> m_codes;
+};
+
+static const char* const kIndexTypes[] = { "flat", "ivf", "sq8" };
+
+static std::unique_ptr<CBenchIndex> CreateIndex(const std::string& type, const BenchOptions& o)
+{
+	if (type == "flat") return std::unique_ptr<CBenchIndex>(new CFlatIndex());
+	if (type == "ivf") return std::unique_ptr<CBenchIndex>(new CIvfIndex(o.ivfLists, o.nprobe));
+	if (type == "sq8") return std::unique_ptr<CBenchIndex>(new CSq8Index(o.rerank));
+	return nullptr;
+}
+
+// Map a (segment, chunk) hit back to the synthetic chunk number through the document path
+static uint64_t GlobalChunk(const CKbReader& reader, const KbHit& hit, uint32_t chunksPerDoc)
+{
+	const CKbSegment& seg = reader.Segment(hit.segment);
+	const KbChunkRecord& c = seg.Chunk(hit.chunk);
+	unsigned long long doc = 0;
+	sscanf(seg.DocPath(c.doc).c_str(), "bench/doc%llu", &doc);
+	return doc * chunksPerDoc + (hit.chunk - seg.Doc(c.doc).firstChunk);
+}
+
+// ---------------- Measurement ----------------
+
+static double Seconds(std::chrono::steady_clock::time_point since)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+static double Percentile(std::vector<double> v, double p)
+{
+	if (v.empty()) return 0;
+	std::sort(v.begin(), v.end());
+	size_t i = (size_t)std::ceil(p * v.size()) - 1;
+	return v[(std::min)(i, v.size() - 1)];
+}
+
+static uint64_t DirectoryBytes(const std::string& dir)
+{
+	uint64_t total = 0;
+	DIR* d = opendir(dir.c_str());
+	if (!d) return 0;
+	while (dirent* e = readdir(d)) {
+		struct stat st {};
+		if (e->d_name[0] != '.' && stat(KbJoinPath(dir, e->d_name).c_str(), &st) == 0)
+			total += (uint64_t)st.st_size;
+	}
+	closedir(d);
+	return total;
+}
+
+static void RemoveDirectory(const std::string& dir)
+{
+	DIR* d = opendir(dir.c_str());
+	if (!d) return;
+	while (dirent* e = readdir(d))
+		if (e->d_name[0] != '.') KbDeleteFile(KbJoinPath(dir, e->d_name));
+	closedir(d);
+	rmdir(dir.c_str());
+}
+
+// [Function] Exact top-k for a set of queries in one pass over the regenerated corpus.
+static std::vector<std::vector<uint64_t>> ExactTopK(const CSyntheticCorpus& corpus,
+	const std::vector<std::vector<float>>& queries, uint64_t chunks, uint32_t dim, uint32_t k)
+{
+	typedef std::pair<float, uint64_t> Entry;
+	std::vector<std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>>> heaps(queries.size());
+	std::vector<float> v(dim);
+	for (uint64_t c = 0; c < chunks; ++c)
+	{
+		corpus.Vector(c, v.data());
+		for (size_t q = 0; q < queries.size(); ++q)
+		{
+			float s = 0;
+			for (uint32_t i = 0; i < dim; ++i) s += queries[q][i] * v[i];
+			if (heaps[q].size() < k) heaps[q].push(Entry(s, c));
+			else if (s > heaps[q].top().first) {
+				heaps[q].pop();
+				heaps[q].push(Entry(s, c));
+			}
+		}
+	}
+	std::vector<std::vector<uint64_t>> truth(queries.size());
+	for (size_t q = 0; q < queries.size(); ++q)
+		for (; !heaps[q].empty(); heaps[q].pop())
+			truth[q].push_back(heaps[q].top().second);
+	return truth;
+}
+
+// [Function] Build one scale on disk the way the assistant does; returns the JSON
+// fields of the build.
+static std::string BuildScale(const BenchOptions& o, const std::string& dir, uint64_t chunks)
+{
+	RemoveDirectory(dir);
+	mkdir(o.dir.c_str(), 0755);
+	if (mkdir(dir.c_str(), 0755) != 0) return std::string();
+
+	CSyntheticCorpus corpus(o);
+	const uint64_t docs = (chunks + o.chunksPerDoc - 1) / o.chunksPerDoc;
+
+	// Same path as IngestFilesToNativeKb, one segment per batch of documents
+	double buildSeconds = 0;
+	std::vector<float> vectors;
+	std::vector<std::string> texts;
+	for (uint64_t first = 0; first < docs; first += o.docsPerSegment)
+	{
+		CKbSegmentWriter writer(o.dim);
+		uint64_t last = (std::min)(docs, first + o.docsPerSegment);
+		for (uint64_t d = first; d < last; ++d)
+		{
+			uint64_t c0 = d * o.chunksPerDoc;
+			uint64_t n = (std::min)((uint64_t)o.chunksPerDoc, chunks - c0);
+			vectors.resize((size_t)(n * o.dim));
+			texts.clear();
+			for (uint64_t c = 0; c < n; ++c) {
+				corpus.Vector(c0 + c, &vectors[(size_t)(c * o.dim)]);
+				texts.push_back(corpus.Text(c0 + c));
+			}
+			auto t = std::chrono::steady_clock::now();
+			writer.AddDocument(CSyntheticCorpus::DocPath(d), d, texts, vectors.data());
+			buildSeconds += Seconds(t);
+		}
+		auto t = std::chrono::steady_clock::now();
+		if (!KbPublishSegment(dir, writer, {})) return std::string();
+		buildSeconds += Seconds(t);
+	}
+
+	double compactSeconds = 0;
+	if (o.compact) {
+		std::mutex lock;
+		auto t = std::chrono::steady_clock::now();
+		while (KbCompact(dir, KbCompactionPolicy(), lock)) {}
+		compactSeconds = Seconds(t);
+	}
+
+	KbManifest manifest;
+	if (!manifest.Load(dir)) return std::string();
+
+	char buf[256];
+	snprintf(buf, sizeof(buf),
+		"{\"documents\": %llu, \"segments\": %zu, \"seconds\": %.3f, \"compact_seconds\": %.3f, "
+		"\"disk_bytes\": %llu",
+		(unsigned long long)docs, manifest.segments.size(), buildSeconds, compactSeconds,
+		(unsigned long long)DirectoryBytes(dir));
+	return buf;
+}
+
+// [Function] Open the kb, build one index type over it and time the queries;
+// returns the JSON fields of the index.
+static std::string MeasureIndex(const BenchOptions& o, const std::string& dir, const std::string& type,
+	const std::vector<std::vector<float>>& queries, const std::vector<std::vector<uint64_t>>& truth)
+{
+	auto t = std::chrono::steady_clock::now();
+	CKbReader reader;
+	if (!reader.Open(dir)) return std::string();
+	double openMs = Seconds(t) * 1000;
+
+	std::unique_ptr<CBenchIndex> index = CreateIndex(type, o);
+	t = std::chrono::steady_clock::now();
+	index->Build(reader);
+	double buildSeconds = Seconds(t);
+	index->Search(queries[0].data(), o.k);   // Fault the mapping in once
+
+	std::vector<double> latencies;
+	double recall = 0;
+	for (uint32_t q = 0; q < o.queries; ++q)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::vector<KbHit> hits = index->Search(queries[q].data(), o.k);
+		latencies.push_back(Seconds(start) * 1000);
+		if (q < truth.size()) {
+			size_t found = 0;
+			for (const KbHit& h : hits)
+				found += std::count(truth[q].begin(), truth[q].end(), GlobalChunk(reader, h, o.chunksPerDoc));
+			recall += truth[q].empty() ? 1.0 : (double)found / truth[q].size();
+		}
+	}
+	double mean = 0;
+	for (double l : latencies) mean += l;
+	mean /= latencies.empty() ? 1 : latencies.size();
+
+	char buf[512];
+	snprintf(buf, sizeof(buf),
+		"{\"type\": \"%s\", \"open_ms\": %.3f, \"build_seconds\": %.3f, \"memory_bytes\": %llu, "
+		"\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"mean_ms\": %.3f, \"qps\": %.1f, \"recall_at_k\": %.4f",
+		index->Name(), openMs, buildSeconds, (unsigned long long)index->Bytes(),
+		Percentile(latencies, 0.50), Percentile(latencies, 0.99), mean, mean > 0 ? 1000.0 / mean : 0.0,
+		truth.empty() ? 0.0 : recall / truth.size());
+	return buf;
+}
+
+// [Function] Fork, run `run` in the child and return the JSON object it produced,
+// closed with the child's own peak RSS. Descendants are not counted (RUSAGE_SELF),
+// so the build and every index type get a figure of their own.
+template <class F>
+static std::string RunIsolated(F run)
+{
+	int fds[2];
+	if (pipe(fds) != 0) return std::string();
+	fflush(nullptr);
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		std::string json = run();
+		if (!json.empty()) {
+			struct rusage usage {};
+			getrusage(RUSAGE_SELF, &usage);
+			json += ", \"peak_rss_kb\": " + std::to_string(usage.ru_maxrss) + "}";   // KiB on Linux
+		}
+		size_t done = 0;
+		while (done < json.size()) {
+			ssize_t n = write(fds[1], json.data() + done, json.size() - done);
+			if (n <= 0) break;
+			done += (size_t)n;
+		}
+		_exit(json.empty() ? 1 : 0);
+	}
+	close(fds[1]);
+	if (pid < 0) {
+		close(fds[0]);
+		return std::string();
+	}
+
+	std::string json;
+	char buf[4096];
+	ssize_t n;
+	while ((n = read(fds[0], buf, sizeof(buf))) > 0) json.append(buf, (size_t)n);
+	close(fds[0]);
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return std::string();
+	return json;
+}
+
+// [Function] Build one scale and measure every index type on it. The ground truth
+// is computed here from regenerated vectors, it never touches the kb.
+static std::string RunScale(const BenchOptions& o, uint64_t chunks)
+{
+	const std::string dir = o.dir + "/" + std::to_string(chunks);
+	std::string build = RunIsolated([&] { return BuildScale(o, dir, chunks); });
+	if (build.empty()) return std::string();
+
+	CSyntheticCorpus corpus(o);
+	std::vector<std::vector<float>> queries(o.queries, std::vector<float>(o.dim));
+	for (uint32_t q = 0; q < o.queries; ++q)
+		corpus.Query(q, chunks, queries[q].data());
+	std::vector<std::vector<float>> recallSet(queries.begin(),
+		queries.begin() + (std::min)(o.recallQueries, o.queries));
+	std::vector<std::vector<uint64_t>> truth = ExactTopK(corpus, recallSet, chunks, o.dim, o.k);
+
+	std::string json = "{\"chunks\": " + std::to_string(chunks) + ", \"build\": " + build + ", \"indexes\": [";
+	bool first = true;
+	for (const std::string& type : o.indexes)
+	{
+		fprintf(stderr, "kb_bench: %llu chunks, %s...\n", (unsigned long long)chunks, type.c_str());
+		std::string index = RunIsolated([&] { return MeasureIndex(o, dir, type, queries, truth); });
+		if (index.empty()) {
+			fprintf(stderr, "kb_bench: %s failed\n", type.c_str());
+			continue;
+		}
+		json += (first ? "" : ", ") + index;
+		first = false;
+	}
+	json += "]}";
+
+	if (!o.keep) RemoveDirectory(dir);
+	return first ? std::string() : json;
+}
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: kb_bench [--scales 10000,100000,1000000] [--dim 384] [--k 10]\n"
+		"                [--queries 200] [--recall-queries 50] [--chunks-per-doc 8]\n"
+		"                [--docs-per-segment 1024] [--text-bytes 256] [--clusters 256]\n"
+		"                [--seed 42] [--indexes flat,ivf,sq8] [--ivf-lists 0] [--nprobe 8]\n"
+		"                [--rerank 4] [--dir /tmp/kb_bench] [--compact] [--keep] [--out file.json]\n");
+}
+
+static bool ParseArgs(int argc, char** argv, BenchOptions& o)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string a = argv[i];
+		if (a == "--compact") { o.compact = true; continue; }
+		if (a == "--keep") { o.keep = true; continue; }
+		if (i + 1 >= argc) return false;
+		const char* v = argv[++i];
+		if (a == "--scales") {
+			o.scales.clear();
+			for (const char* p = v; *p;) {
+				char* end = nullptr;
+				unsigned long long s = strtoull(p, &end, 10);
+				if (end == p || s == 0) return false;
+				o.scales.push_back(s);
+				p = *end == ',' ? end + 1 : end;
+			}
+		}
+		else if (a == "--indexes") {
+			o.indexes.clear();
+			for (const char* p = v; *p;) {
+				const char* end = strchr(p, ',');
+				std::string type(p, end ? end : p + strlen(p));
+				if (std::find(std::begin(kIndexTypes), std::end(kIndexTypes), type) == std::end(kIndexTypes))
+					return false;
+				o.indexes.push_back(type);
+				p = end ? end + 1 : p + strlen(p);
+			}
+		}
+		else if (a == "--dim") o.dim = (uint32_t)atoi(v);
+		else if (a == "--k") o.k = (uint32_t)atoi(v);
+		else if (a == "--queries") o.queries = (uint32_t)atoi(v);
+		else if (a == "--recall-queries") o.recallQueries = (uint32_t)atoi(v);
+		else if (a == "--chunks-per-doc") o.chunksPerDoc = (uint32_t)atoi(v);
+		else if (a == "--docs-per-segment") o.docsPerSegment = (uint32_t)atoi(v);
+		else if (a == "--text-bytes") o.textBytes = (uint32_t)atoi(v);
+		else if (a == "--clusters") o.clusters = (uint32_t)atoi(v);
+		else if (a == "--ivf-lists") o.ivfLists = (uint32_t)atoi(v);
+		else if (a == "--nprobe") o.nprobe = (uint32_t)atoi(v);
+		else if (a == "--rerank") o.rerank = (uint32_t)atoi(v);
+		else if (a == "--seed") o.seed = strtoull(v, nullptr, 10);
+		else if (a == "--dir") o.dir = v;
+		else if (a == "--out") o.out = v;
+		else return false;
+	}
+	return o.dim && o.k && o.queries && o.chunksPerDoc && o.docsPerSegment && o.clusters && o.nprobe &&
+		!o.scales.empty() && !o.indexes.empty();
+}
+
+int main(int argc, char** argv)
+{
+	BenchOptions o;
+	if (!ParseArgs(argc, argv, o)) {
+		Usage();
+		return 2;
+	}
+	char buf[512];
+	snprintf(buf, sizeof(buf),
+		"{\n  \"benchmark\": \"kb_retrieval\",\n  \"format_version\": %u,\n  \"dim\": %u,\n  \"k\": %u,\n"
+		"  \"queries\": %u,\n  \"recall_queries\": %u,\n  \"chunks_per_doc\": %u,\n"
+		"  \"docs_per_segment\": %u,\n  \"text_bytes\": %u,\n  \"seed\": %llu,\n  \"compact\": %s,\n"
+		"  \"ivf_lists\": %u,\n  \"nprobe\": %u,\n  \"rerank\": %u,\n  \"results\": [",
+		KB_FORMAT_VERSION, o.dim, o.k, o.queries, o.recallQueries, o.chunksPerDoc,
+		o.docsPerSegment, o.textBytes, (unsigned long long)o.seed, o.compact ? "true" : "false",
+		o.ivfLists, o.nprobe, o.rerank);
+	std::string json = buf;
+
+	int failed = 0;
+	for (size_t i = 0; i < o.scales.size(); ++i)
+	{
+		std::string r = RunScale(o, o.scales[i]);
+		if (r.empty()) {
+			fprintf(stderr, "kb_bench: scale %llu failed\n", (unsigned long long)o.scales[i]);
+			++failed;
+			continue;
+		}
+		json += (json.back() == '[' ? "\n    " : ",\n    ") + r;
+	}
+	json += "\n  ]\n}\n";
+
+	if (o.out.empty()) {
+		fputs(json.c_str(), stdout);
+	}
+	else {
+		FILE* f = fopen(o.out.c_str(), "wb");
+		if (!f || fputs(json.c_str(), f) < 0) {
+			fprintf(stderr, "kb_bench: cannot write %s\n", o.out.c_str());
+			if (f) fclose(f);
+			return 1;
+		}
+		fclose(f);
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "imagedownloadpool.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QRegularExpression>
+#include <QTimer>
+
+ImageDownloadPool::ImageDownloadPool(QObject *parent)
+    : QObject(parent), _networkManager(new QNetworkAccessManager(this)) {
+    connect(_networkManager, &QNetworkAccessManager::finished, this,
+            &ImageDownloadPool::replyFinished);
+}
+
+void ImageDownloadPool::download(const QUrl &url) {
+    if (_pending.contains(url)) {
+        return;
+    }
+
+    for (const QUrl &runningUrl : _running) {
+        if (runningUrl == url) {
+            return;
+        }
+    }
+
+    _pending << url;
+    startNext();
+}
+
+/**
+ * Starts the queued downloads in their order as far as the limits allow
+ */
+void ImageDownloadPool::startNext() {
+    for (int i = 0; i < _pending.size() && _running.size() < maxDownloads;) {
+        const QUrl url = _pending.at(i);
+        const QString host = url.host();
+
+        if (_runningPerHost.value(host) >= maxDownloadsPerHost) {
+            i++;
+            continue;
+        }
+
+        _pending.removeAt(i);
+        _runningPerHost[host]++;
+
+        QNetworkRequest request(url);
+        request.setAttribute(QNetworkRequest::RedirectPolicyAttribute,
+                             QNetworkRequest::NoLessSafeRedirectPolicy);
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
+        request.setTransferTimeout(transferTimeout);
+#endif
+
+        QNetworkReply *reply = _networkManager->get(request);
+#if (QT_VERSION < QT_VERSION_CHECK(5, 15, 0))
+        // abort a download without progress ourselves
+        auto *timer = new QTimer(reply);
+        timer->setSingleShot(true);
+        connect(timer, &QTimer::timeout, reply, &QNetworkReply::abort);
+        connect(reply, &QNetworkReply::downloadProgress, timer, [timer] { timer->start(); });
+        timer->start(transferTimeout);
+#endif
+        _running.insert(reply, url);
+    }
+}
+
+void ImageDownloadPool::replyFinished(QNetworkReply *reply) {
+    reply->deleteLater();
+
+    const QUrl url = _running.take(reply);
+    const QString host = url.host();
+    if (--_runningPerHost[host] <= 0) {
+        _runningPerHost.remove(host);
+    }
+
+    if (reply->error() != QNetworkReply::NoError) {
+        qWarning() << __func__ << " - could not download: " << url << ": "
+                   << reply->errorString();
+        Q_EMIT failed(url);
+    } else {
+        // the suffix of the url, otherwise the subtype of the content type
+        static const QRegularExpression suffixRe(QStringLiteral("^[a-zA-Z0-9]{1,5}$"));
+        QString suffix = QFileInfo(url.path()).suffix().toLower();
+
+        if (!suffixRe.match(suffix).hasMatch()) {
+            const QString contentType =
+                reply->header(QNetworkRequest::ContentTypeHeader).toString().toLower();
+            suffix = contentType.section(QLatin1Char('/'), 1).section(QLatin1Char(';'), 0, 0);
+            suffix = suffix.section(QLatin1Char('+'), 0, 0).trimmed();
+
+            if (suffix == QLatin1String("jpeg")) {
+                suffix = QStringLiteral("jpg");
+            } else if (!suffixRe.match(suffix).hasMatch()) {
+                suffix = QStringLiteral("png");
+            }
+        }
+
+        Q_EMIT downloaded(url, reply->readAll(), suffix);
+    }
+
+    startNext();
+}
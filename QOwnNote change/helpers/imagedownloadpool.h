@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QUrl>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+/**
+ * Downloads images in parallel without blocking the event loop
+ *
+ * A url is only downloaded once while it is queued or running, no more than
+ * maxDownloadsPerHost downloads run against one host and a download without
+ * progress for transferTimeout ms is aborted.
+ */
+class ImageDownloadPool : public QObject {
+    Q_OBJECT
+
+   public:
+    static const int maxDownloads = 8;
+    static const int maxDownloadsPerHost = 4;
+    static const int transferTimeout = 30000;
+
+    explicit ImageDownloadPool(QObject *parent = nullptr);
+
+    void download(const QUrl &url);
+
+   Q_SIGNALS:
+    /**
+     * @param suffix file suffix for the image, from the url or the content type
+     */
+    void downloaded(const QUrl &url, const QByteArray &data, const QString &suffix);
+    void failed(const QUrl &url);
+
+   private:
+    QNetworkAccessManager *_networkManager;
+    QList<QUrl> _pending;
+    QHash<QNetworkReply *, QUrl> _running;
+    QHash<QString, int> _runningPerHost;
+
+    void startNext();
+    void replyFinished(QNetworkReply *reply);
+};
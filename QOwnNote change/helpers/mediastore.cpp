@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "mediastore.h"
+
+#include <entities/note.h>
+#include <entities/notefolder.h>
+#include <utils/misc.h>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QUrl>
+
+/**
+ * Returns the hex encoded SHA-256 hash of the content of a file or an empty
+ * string if it can't be read
+ */
+QString MediaStore::hash(const QString &filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    if (!hash.addData(&file)) {
+        return QString();
+    }
+
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+/**
+ * Returns the absolute path of the media file that was stored for a source
+ * file with the content hash or an empty string if there is none
+ *
+ * The stored file can differ from the source, e.g. if the image was scaled
+ * down, so it is checked by the size and modification date it was stored
+ * with instead of its hash.
+ */
+QString MediaStore::findFile(const QString &hash) {
+    if (hash.isEmpty() || !setupTables()) {
+        return QString();
+    }
+
+    QSqlQuery query(QSqlDatabase::database(QStringLiteral("note_folder")));
+    query.prepare(
+        QStringLiteral("SELECT file_path, file_size, file_last_modified FROM mediaFile "
+                       "WHERE hash = :hash"));
+    query.bindValue(QStringLiteral(":hash"), hash);
+
+    if (!query.exec() || !query.next()) {
+        return QString();
+    }
+
+    const QString filePath =
+        QDir(NoteFolder::currentLocalPath()).absoluteFilePath(query.value(0).toString());
+    const QFileInfo fileInfo(filePath);
+    const bool hasStamp = !query.value(1).isNull();
+    const bool isStampMatching = hasStamp && fileInfo.exists() &&
+                                 query.value(1).toLongLong() == fileInfo.size() &&
+                                 query.value(2).toLongLong() ==
+                                     fileInfo.lastModified().toMSecsSinceEpoch();
+    query.finish();
+
+    if (isStampMatching) {
+        return filePath;
+    }
+
+    // files recorded before the stamp was kept were stored unchanged
+    if (!hasStamp && MediaStore::hash(filePath) == hash) {
+        addFile(hash, filePath);
+        return filePath;
+    }
+
+    // the file was removed or changed outside of QOwnNotes
+    query.prepare(QStringLiteral("DELETE FROM mediaFile WHERE hash = :hash"));
+    query.bindValue(QStringLiteral(":hash"), hash);
+    query.exec();
+
+    return QString();
+}
+
+/**
+ * Records a media file that was stored in the note folder
+ *
+ * @param hash content hash of the file the media file was stored from
+ */
+void MediaStore::addFile(const QString &hash, const QString &filePath) {
+    if (hash.isEmpty() || !setupTables()) {
+        return;
+    }
+
+    const QFileInfo fileInfo(filePath);
+    QSqlQuery query(QSqlDatabase::database(QStringLiteral("note_folder")));
+    query.prepare(
+        QStringLiteral("INSERT OR REPLACE INTO mediaFile "
+                       "(hash, file_path, created, file_size, file_last_modified) "
+                       "VALUES (:hash, :filePath, :created, :fileSize, :fileLastModified)"));
+    query.bindValue(QStringLiteral(":hash"), hash);
+    query.bindValue(QStringLiteral(":filePath"),
+                    QDir(NoteFolder::currentLocalPath()).relativeFilePath(filePath));
+    query.bindValue(QStringLiteral(":created"), QDateTime::currentDateTime());
+    query.bindValue(QStringLiteral(":fileSize"), fileInfo.size());
+    query.bindValue(QStringLiteral(":fileLastModified"),
+                    fileInfo.lastModified().toMSecsSinceEpoch());
+
+    if (!query.exec()) {
+        qWarning() << __func__ << ": " << query.lastError();
+    }
+}
+
+/**
+ * Returns the media files of the store that no note file links to
+ *
+ * The note files are read from the disk, so notes that aren't indexed yet are
+ * taken into account too. Nothing is returned if there are encrypted notes,
+ * we can't see which files they use. Files that are gone are dropped from the
+ * store.
+ */
+QStringList MediaStore::unusedFiles() {
+    if (!setupTables()) {
+        return {};
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(QStringLiteral("note_folder"));
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+
+    // the file names of the media files by their absolute path
+    QHash<QString, QString> mediaFiles;
+    QStringList removedHashes;
+    const QString noteFolderPath = NoteFolder::currentLocalPath();
+    const QDir noteFolderDir(noteFolderPath);
+    if (!query.exec(QStringLiteral("SELECT hash, file_path FROM mediaFile"))) {
+        qWarning() << __func__ << ": " << query.lastError();
+        return {};
+    }
+    while (query.next()) {
+        const QString filePath = noteFolderDir.absoluteFilePath(query.value(1).toString());
+        if (QFileInfo::exists(filePath)) {
+            mediaFiles.insert(filePath, QFileInfo(filePath).fileName());
+        } else {
+            removedHashes << query.value(0).toString();
+        }
+    }
+    query.finish();
+
+    for (const QString &hash : Utils::asConst(removedHashes)) {
+        query.prepare(QStringLiteral("DELETE FROM mediaFile WHERE hash = :hash"));
+        query.bindValue(QStringLiteral(":hash"), hash);
+        query.exec();
+    }
+
+    QDirIterator it(noteFolderPath, Note::noteFileExtensionList(QStringLiteral("*.")),
+                    QDir::Files | QDir::NoSymLinks, QDirIterator::Subdirectories);
+
+    while (it.hasNext() && !mediaFiles.isEmpty()) {
+        QFile file(it.next());
+        if (!file.open(QIODevice::ReadOnly)) {
+            // we can't tell which files a note we can't read uses
+            qWarning() << __func__ << ": " << file.fileName() << file.errorString();
+            return {};
+        }
+
+        const QByteArray data = file.readAll();
+        const QString text = QString::fromUtf8(data);
+        if (text.contains(QLatin1String("<!-- BEGIN ENCRYPTED TEXT --"))) {
+            return {};
+        }
+
+        // links are usually percent encoded, like "media/my%20image.png"
+        const QString decodedText = QUrl::fromPercentEncoding(data);
+
+        for (auto mediaFile = mediaFiles.begin(); mediaFile != mediaFiles.end();) {
+            if (text.contains(mediaFile.value()) || decodedText.contains(mediaFile.value())) {
+                mediaFile = mediaFiles.erase(mediaFile);
+            } else {
+                ++mediaFile;
+            }
+        }
+    }
+
+    QStringList filePaths = mediaFiles.keys();
+    filePaths.sort();
+    return filePaths;
+}
+
+/**
+ * Removes media files of the store from the disk
+ *
+ * @return the files that were removed
+ */
+QStringList MediaStore::removeFiles(const QStringList &filePaths) {
+    if (!setupTables()) {
+        return {};
+    }
+
+    QSqlQuery query(QSqlDatabase::database(QStringLiteral("note_folder")));
+    const QDir noteFolderDir(NoteFolder::currentLocalPath());
+    QStringList removedFiles;
+
+    for (const QString &filePath : filePaths) {
+        if (!QFile::remove(filePath)) {
+            qWarning() << __func__ << ": could not remove " << filePath;
+            continue;
+        }
+
+        removedFiles << filePath;
+        query.prepare(QStringLiteral("DELETE FROM mediaFile WHERE file_path = :filePath"));
+        query.bindValue(QStringLiteral(":filePath"), noteFolderDir.relativeFilePath(filePath));
+        if (!query.exec()) {
+            qWarning() << __func__ << ": " << query.lastError();
+        }
+    }
+
+    return removedFiles;
+}
+
+/**
+ * Creates the tables of the store in the note folder database if needed
+ */
+bool MediaStore::setupTables() {
+    QSqlDatabase db = QSqlDatabase::database(QStringLiteral("note_folder"));
+    if (!db.isOpen()) {
+        return false;
+    }
+
+    QSqlQuery query(db);
+    if (!query.exec(
+            QStringLiteral("CREATE TABLE IF NOT EXISTS mediaFile ("
+                           "hash VARCHAR(64) PRIMARY KEY, "
+                           "file_path VARCHAR(255) NOT NULL, "
+                           "created DATETIME, "
+                           "file_size INTEGER, "
+                           "file_last_modified INTEGER)"))) {
+        return false;
+    }
+
+    // the stamp of the stored file wasn't kept at first
+    if (!query.exec(QStringLiteral("SELECT file_size FROM mediaFile LIMIT 0"))) {
+        return query.exec(QStringLiteral("ALTER TABLE mediaFile ADD COLUMN file_size INTEGER")) &&
+               query.exec(QStringLiteral(
+                   "ALTER TABLE mediaFile ADD COLUMN file_last_modified INTEGER"));
+    }
+
+    return true;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#pragma once
+
+#include <QString>
+#include <QStringList>
+
+/**
+ * Content addressed index of the media files of the current note folder
+ *
+ * The SHA-256 hash of the file every media file was stored from is kept in
+ * the note folder database, so inserting the same image again reuses the file
+ * that is already there, even if it was scaled down when it was stored. Files
+ * are never removed on their own, unusedFiles() only lists the ones no note
+ * file links to, for the user to confirm their removal.
+ */
+class MediaStore {
+   public:
+    static QString hash(const QString &filePath);
+
+    static QString findFile(const QString &hash);
+
+    static void addFile(const QString &hash, const QString &filePath);
+
+    static QStringList unusedFiles();
+
+    static QStringList removeFiles(const QStringList &filePaths);
+
+   private:
+    static bool setupTables();
+};
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "notechangereconciler.h"
+
+#include <utils/misc.h>
+
+#include <QDebug>
+#include <QFile>
+#include <QHash>
+#include <QStringView>
+
+NoteChangeReconciler::Result NoteChangeReconciler::reconcile(const Snapshot &snapshot) {
+    Result result;
+    result.noteId = snapshot.noteId;
+
+    QFile file(snapshot.filePath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << __func__ << " - could not read: " << snapshot.filePath;
+        return result;
+    }
+
+    // we are transforming line feeds, because in some instances Windows
+    // managed to sneak some "special" line feeds in
+    const QString diskText = Utils::Misc::transformLineFeeds(QString::fromUtf8(file.readAll()));
+    file.close();
+
+    // the file has the text of the current note (e.g. our own last write)
+    if (fingerprint(diskText) == snapshot.noteTextHash) {
+        result.verdict = Unchanged;
+        return result;
+    }
+
+    const QVector<Block> diskBlocks = splitBlocks(diskText);
+
+    if (isSimilar(snapshot.storedText, splitBlocks(snapshot.storedText), diskText, diskBlocks,
+                  snapshot.threshold) ||
+        isSimilar(snapshot.editorText, splitBlocks(snapshot.editorText), diskText, diskBlocks,
+                  snapshot.threshold)) {
+        result.verdict = Similar;
+        return result;
+    }
+
+    result.verdict = Conflict;
+    return result;
+}
+
+quint64 NoteChangeReconciler::fingerprint(const QString &text) { return qHash(text, 0); }
+
+/**
+ * Splits text into its lines, the line breaks aren't part of the blocks
+ */
+QVector<NoteChangeReconciler::Block> NoteChangeReconciler::splitBlocks(const QString &text) {
+    QVector<Block> blocks;
+    int position = 0;
+
+    while (true) {
+        int end = text.indexOf(QLatin1Char('\n'), position);
+        if (end == -1) {
+            end = text.size();
+        }
+
+        const int length = end - position;
+        blocks.append({position, length, qHash(QStringView(text).mid(position, length), 0)});
+
+        if (end == text.size()) {
+            break;
+        }
+        position = end + 1;
+    }
+
+    return blocks;
+}
+
+/**
+ * Utils::Misc::isSimilar() for the part of the texts between the blocks they
+ * start and end with, the text both have in common doesn't add differences
+ */
+bool NoteChangeReconciler::isSimilar(const QString &text1, const QVector<Block> &blocks1,
+                                     const QString &text2, const QVector<Block> &blocks2,
+                                     int threshold) {
+    if (text1 == text2) {
+        return true;
+    }
+
+    const auto isSameBlock = [](const Block &block1, const Block &block2) {
+        return block1.length == block2.length && block1.hash == block2.hash;
+    };
+
+    const int count = qMin(blocks1.size(), blocks2.size());
+    int prefix = 0;
+    while (prefix < count && isSameBlock(blocks1.at(prefix), blocks2.at(prefix))) {
+        prefix++;
+    }
+
+    int suffix = 0;
+    while (suffix < count - prefix && isSameBlock(blocks1.at(blocks1.size() - 1 - suffix),
+                                                  blocks2.at(blocks2.size() - 1 - suffix))) {
+        suffix++;
+    }
+
+    int prefixLength = 0;
+    if (prefix > 0) {
+        const Block &block = blocks1.at(prefix - 1);
+        prefixLength = block.position + block.length;
+    }
+
+    const int suffixLength =
+        suffix > 0 ? text1.size() - blocks1.at(blocks1.size() - suffix).position : 0;
+
+    // the hashes only point to the common blocks, make sure they really are
+    const QStringView view1(text1);
+    const QStringView view2(text2);
+    if (view1.left(prefixLength) != view2.left(prefixLength) ||
+        view1.right(suffixLength) != view2.right(suffixLength)) {
+        return Utils::Misc::isSimilar(text1, text2, threshold);
+    }
+
+    return Utils::Misc::isSimilar(
+        text1.mid(prefixLength, text1.size() - prefixLength - suffixLength),
+        text2.mid(prefixLength, text2.size() - prefixLength - suffixLength), threshold);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#pragma once
+
+#include <QString>
+#include <QVector>
+
+/**
+ * Compares the file of the current note with the texts we know of it
+ *
+ * reconcile() only works on the snapshot it gets (no database, no widgets),
+ * so it can run in a worker thread. The GUI thread only has to step in if
+ * the result is a conflict.
+ */
+class NoteChangeReconciler {
+   public:
+    enum Verdict {
+        Unchanged,    // the file has the text of the current note
+        Similar,      // the file text is within the similarity threshold
+        Conflict,     // the user has to decide
+        Unreadable,
+    };
+
+    struct Snapshot {
+        int noteId = 0;
+        QString filePath;
+        QString storedText;    // note text in the database
+        QString editorText;
+        quint64 noteTextHash = 0;    // see fingerprint()
+        int threshold = 0;           // see Utils::Misc::isSimilar()
+    };
+
+    struct Result {
+        int noteId = 0;
+        Verdict verdict = Unreadable;
+    };
+
+    static Result reconcile(const Snapshot &snapshot);
+
+    /**
+     * Fast non-cryptographic hash to tell note texts apart
+     */
+    static quint64 fingerprint(const QString &text);
+
+   private:
+    struct Block {
+        int position;
+        int length;
+        quint64 hash;
+    };
+
+    static QVector<Block> splitBlocks(const QString &text);
+    static bool isSimilar(const QString &text1, const QVector<Block> &blocks1,
+                          const QString &text2, const QVector<Block> &blocks2, int threshold);
+};
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "notefolderdatabasemerger.h"
+
+#include <utils/misc.h>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QPointer>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QtConcurrent>
+
+static const QString mergeConnectionName = QStringLiteral("note_folder_merge");
+
+NoteFolderDatabaseMerger::NoteFolderDatabaseMerger(QObject *parent) : QObject(parent) {
+    connect(&_watcher, &QFutureWatcher<QVector<Result>>::finished, this,
+            [this] { Q_EMIT finished(_watcher.result()); });
+}
+
+/**
+ * Waits for a running merge, its connection must not outlive the application
+ */
+NoteFolderDatabaseMerger::~NoteFolderDatabaseMerger() { _watcher.waitForFinished(); }
+
+bool NoteFolderDatabaseMerger::isRunning() const { return _watcher.isRunning(); }
+
+void NoteFolderDatabaseMerger::start(const QString &databasePath, const QStringList &copyPaths) {
+    if (isRunning()) {
+        return;
+    }
+
+    // the worker doesn't touch this object, the progress is queued to the GUI
+    // thread and only emitted there if the merger still exists
+    const QPointer<NoteFolderDatabaseMerger> merger(this);
+    const auto reportProgress = [merger](int done, int total) {
+        QMetaObject::invokeMethod(
+            qApp,
+            [merger, done, total] {
+                if (merger) {
+                    Q_EMIT merger->progress(done, total);
+                }
+            },
+            Qt::QueuedConnection);
+    };
+
+    _watcher.setFuture(QtConcurrent::run([databasePath, copyPaths, reportProgress] {
+        return mergeAll(databasePath, copyPaths, reportProgress);
+    }));
+}
+
+QVector<NoteFolderDatabaseMerger::Result> NoteFolderDatabaseMerger::mergeAll(
+    const QString &databasePath, const QStringList &copyPaths,
+    const std::function<void(int, int)> &reportProgress) {
+    QVector<Result> results;
+    results.reserve(copyPaths.size());
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), mergeConnectionName);
+        db.setDatabaseName(databasePath);
+        // the GUI thread may write to the database meanwhile
+        db.setConnectOptions(QStringLiteral("QSQLITE_BUSY_TIMEOUT=10000"));
+        const bool isOpen = db.open();
+        if (!isOpen) {
+            qWarning() << __func__ << " - could not open: " << databasePath << ": "
+                       << db.lastError();
+        }
+
+        for (int i = 0; i < copyPaths.size(); i++) {
+            Result result;
+            result.path = copyPaths.at(i);
+
+            if (Utils::Misc::isSameFile(result.path, databasePath)) {
+                result.outcome = Duplicate;
+            } else if (isOpen && merge(db, result.path)) {
+                result.outcome = Merged;
+            }
+
+            results << result;
+            reportProgress(i + 1, copyPaths.size());
+        }
+
+        db.close();
+    }
+
+    QSqlDatabase::removeDatabase(mergeConnectionName);
+    return results;
+}
+
+/**
+ * Attaches the copy at copyPath and merges it in one transaction
+ */
+bool NoteFolderDatabaseMerger::merge(QSqlDatabase &db, const QString &copyPath) {
+    QSqlQuery query(db);
+    query.prepare(QStringLiteral("ATTACH DATABASE :path AS conflicted"));
+    query.bindValue(QStringLiteral(":path"), copyPath);
+    if (!query.exec()) {
+        qWarning() << __func__ << " - could not attach: " << copyPath << ": "
+                   << query.lastError();
+        return false;
+    }
+
+    // a copy of another database version would need its own migration first
+    bool success = query.exec(
+                       QStringLiteral("SELECT (SELECT value FROM main.appData WHERE name = "
+                                      "'database_version') IS (SELECT value FROM "
+                                      "conflicted.appData WHERE name = 'database_version')")) &&
+                   query.next() && query.value(0).toBool();
+
+    if (success) {
+        db.transaction();
+        success = mergeAttached(db);
+
+        if (success) {
+            success = db.commit();
+        } else {
+            db.rollback();
+        }
+    }
+
+    if (!success) {
+        qWarning() << __func__ << " - could not merge: " << copyPath << ": " << query.lastError();
+    }
+
+    query.exec(QStringLiteral("DETACH DATABASE conflicted"));
+    return success;
+}
+
+/**
+ * Merges the tags and note links of the attached database "conflicted"
+ */
+bool NoteFolderDatabaseMerger::mergeAttached(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    const auto exec = [&query](const QString &sql) {
+        if (!query.exec(sql)) {
+            qWarning() << "NoteFolderDatabaseMerger: " << query.lastError() << " - " << sql;
+            return false;
+        }
+        return true;
+    };
+
+    // the tags of the copy that can be reached from the top level, with
+    // their depth in the tag tree
+    if (!exec(QStringLiteral("DROP TABLE IF EXISTS temp.merge_tag")) ||
+        !exec(QStringLiteral("DROP TABLE IF EXISTS temp.merge_tag_map")) ||
+        !exec(QStringLiteral(
+            "CREATE TEMP TABLE merge_tag AS "
+            "WITH RECURSIVE tree(id, depth) AS ("
+            "SELECT id, 0 FROM conflicted.tag WHERE parent_id IS NULL OR parent_id = 0 "
+            "UNION ALL "
+            "SELECT t.id, tree.depth + 1 FROM conflicted.tag t JOIN tree ON t.parent_id = tree.id) "
+            "SELECT t.id, t.name, t.parent_id, t.priority, t.color, t.created, t.updated, "
+            "tree.depth FROM conflicted.tag t JOIN tree ON tree.id = t.id")) ||
+        !exec(QStringLiteral("CREATE TEMP TABLE merge_tag_map "
+                             "(conflicted_id INTEGER PRIMARY KEY, main_id INTEGER)"))) {
+        return false;
+    }
+
+    // maps the tags of one level to the tags with the same name below the
+    // already mapped parent tag
+    const auto mapLevel = [&](int depth) {
+        return exec(QStringLiteral(
+                        "INSERT INTO temp.merge_tag_map (conflicted_id, main_id) "
+                        "SELECT c.id, MIN(m.id) FROM temp.merge_tag c "
+                        "LEFT JOIN temp.merge_tag_map p ON p.conflicted_id = c.parent_id "
+                        "JOIN main.tag m ON m.name = c.name "
+                        "AND COALESCE(m.parent_id, 0) = COALESCE(p.main_id, 0) "
+                        "WHERE c.depth = %1 "
+                        "AND c.id NOT IN (SELECT conflicted_id FROM temp.merge_tag_map) "
+                        "GROUP BY c.id")
+                        .arg(depth));
+    };
+
+    if (!exec(QStringLiteral("SELECT COALESCE(MAX(depth), -1) FROM temp.merge_tag")) ||
+        !query.next()) {
+        return false;
+    }
+    const int maxDepth = query.value(0).toInt();
+
+    // the missing tags of a level are inserted, then mapped like the others;
+    // siblings with the same name in the copy become one tag, which takes the
+    // other columns from the sibling that was updated last
+    for (int depth = 0; depth <= maxDepth; depth++) {
+        if (!mapLevel(depth) ||
+            !exec(QStringLiteral(
+                      "INSERT INTO main.tag (name, parent_id, priority, color, created, updated) "
+                      "SELECT c.name, COALESCE(p.main_id, 0), c.priority, c.color, c.created, "
+                      "MAX(c.updated) FROM temp.merge_tag c "
+                      "LEFT JOIN temp.merge_tag_map p ON p.conflicted_id = c.parent_id "
+                      "WHERE c.depth = %1 "
+                      "AND c.id NOT IN (SELECT conflicted_id FROM temp.merge_tag_map) "
+                      "GROUP BY c.name, COALESCE(p.main_id, 0)")
+                      .arg(depth)) ||
+            !mapLevel(depth)) {
+            return false;
+        }
+    }
+
+    // the later change of a tag wins
+    return exec(QStringLiteral(
+               "UPDATE main.tag SET "
+               "priority = (SELECT c.priority FROM temp.merge_tag c JOIN temp.merge_tag_map m "
+               "ON m.conflicted_id = c.id WHERE m.main_id = tag.id ORDER BY c.updated DESC), "
+               "color = (SELECT c.color FROM temp.merge_tag c JOIN temp.merge_tag_map m "
+               "ON m.conflicted_id = c.id WHERE m.main_id = tag.id ORDER BY c.updated DESC), "
+               "updated = (SELECT MAX(c.updated) FROM temp.merge_tag c JOIN temp.merge_tag_map m "
+               "ON m.conflicted_id = c.id WHERE m.main_id = tag.id) "
+               "WHERE EXISTS (SELECT 1 FROM temp.merge_tag c JOIN temp.merge_tag_map m "
+               "ON m.conflicted_id = c.id WHERE m.main_id = tag.id "
+               "AND c.updated > tag.updated)")) &&
+           exec(QStringLiteral(
+               "INSERT INTO main.noteTagLink (tag_id, note_file_name, note_sub_folder_path, "
+               "created) "
+               "SELECT m.main_id, l.note_file_name, l.note_sub_folder_path, MIN(l.created) "
+               "FROM conflicted.noteTagLink l "
+               "JOIN temp.merge_tag_map m ON m.conflicted_id = l.tag_id "
+               "WHERE NOT EXISTS (SELECT 1 FROM main.noteTagLink o WHERE o.tag_id = m.main_id "
+               "AND o.note_file_name = l.note_file_name "
+               "AND o.note_sub_folder_path IS l.note_sub_folder_path) "
+               "GROUP BY m.main_id, l.note_file_name, l.note_sub_folder_path")) &&
+           exec(QStringLiteral("DROP TABLE temp.merge_tag")) &&
+           exec(QStringLiteral("DROP TABLE temp.merge_tag_map"));
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+
+#include <QFutureWatcher>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class QSqlDatabase;
+
+/**
+ * Merges conflicted copies of the note folder database in a worker thread
+ *
+ * Every copy is attached to its own connection to the note folder database
+ * and merged with a few set based statements in one transaction: tags are
+ * matched by their name and parent tag level by level, missing tags and
+ * note links are inserted and tags that were changed later in the copy
+ * take over its priority and color.
+ */
+class NoteFolderDatabaseMerger : public QObject {
+    Q_OBJECT
+
+   public:
+    enum Outcome {
+        Duplicate,    // the copy is the same file as the database
+        Merged,
+        Failed,
+    };
+
+    struct Result {
+        QString path;
+        Outcome outcome = Failed;
+    };
+
+    explicit NoteFolderDatabaseMerger(QObject *parent = nullptr);
+    ~NoteFolderDatabaseMerger() override;
+
+    bool isRunning() const;
+
+    void start(const QString &databasePath, const QStringList &copyPaths);
+
+   Q_SIGNALS:
+    void progress(int done, int total);
+
+    void finished(const QVector<NoteFolderDatabaseMerger::Result> &results);
+
+   private:
+    QFutureWatcher<QVector<Result>> _watcher;
+
+    static QVector<Result> mergeAll(const QString &databasePath, const QStringList &copyPaths,
+                                    const std::function<void(int, int)> &reportProgress);
+    static bool merge(QSqlDatabase &db, const QString &copyPath);
+    static bool mergeAttached(QSqlDatabase &db);
+};
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "notefolderwatcher.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSet>
+#include <QSocketNotifier>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// no IN_MODIFY: a save would fire it once per write() call, IN_CLOSE_WRITE once
+static const uint32_t watchMask = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM |
+                                  IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR |
+                                  IN_EXCL_UNLINK;
+#endif
+
+NoteFolderWatcher::NoteFolderWatcher(QObject *parent) : QObject(parent) {
+#ifdef Q_OS_LINUX
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd < 0) {
+        qWarning() << "inotify_init1 failed: " << strerror(errno);
+        return;
+    }
+
+    _notifier = new QSocketNotifier(_fd, QSocketNotifier::Read, this);
+    connect(_notifier, &QSocketNotifier::activated, this, &NoteFolderWatcher::readEvents);
+#endif
+}
+
+NoteFolderWatcher::~NoteFolderWatcher() {
+#ifdef Q_OS_LINUX
+    if (_fd >= 0) {
+        // closing the descriptor drops all watches
+        delete _notifier;
+        ::close(_fd);
+    }
+#endif
+}
+
+bool NoteFolderWatcher::isSupported() {
+#ifdef Q_OS_LINUX
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool NoteFolderWatcher::watch(const QString &rootPath, bool recursive,
+                              const std::function<bool(const QString &)> &ignoreDirectory) {
+    clear();
+    if (_fd < 0) {
+        return false;
+    }
+
+    _recursive = recursive;
+    _ignoreDirectory = ignoreDirectory;
+
+    if (!addDirectoryTree(QDir::cleanPath(rootPath))) {
+        clear();
+        return false;
+    }
+
+    qDebug() << __func__ << " - watching " << _pathByWatch.size() << " directories";
+    return true;
+}
+
+bool NoteFolderWatcher::addDirectory(const QString &path) {
+#ifdef Q_OS_LINUX
+    const QString cleanPath = QDir::cleanPath(path);
+    if (_fd < 0 || _watchByPath.contains(cleanPath)) {
+        return _fd >= 0;
+    }
+
+    const int wd = inotify_add_watch(_fd, QFile::encodeName(cleanPath).constData(), watchMask);
+    if (wd < 0) {
+        qWarning() << "inotify_add_watch failed for " << cleanPath << ": " << strerror(errno);
+        return false;
+    }
+
+    _pathByWatch.insert(wd, cleanPath);
+    _watchByPath.insert(cleanPath, wd);
+    return true;
+#else
+    Q_UNUSED(path)
+    return false;
+#endif
+}
+
+void NoteFolderWatcher::clear() {
+#ifdef Q_OS_LINUX
+    for (auto it = _pathByWatch.constBegin(); it != _pathByWatch.constEnd(); ++it) {
+        inotify_rm_watch(_fd, it.key());
+    }
+#endif
+    _pathByWatch.clear();
+    _watchByPath.clear();
+}
+
+bool NoteFolderWatcher::isIgnoredDirectory(const QString &name) const {
+    return _ignoreDirectory && _ignoreDirectory(name);
+}
+
+/**
+ * Adds a watch for path and, if recursive, for all its subdirectories
+ */
+bool NoteFolderWatcher::addDirectoryTree(const QString &path) {
+    if (!addDirectory(path)) {
+        return false;
+    }
+
+    if (_recursive) {
+        const QStringList subDirectories =
+            QDir(path).entryList(QDir::Dirs | QDir::Hidden | QDir::NoDotAndDotDot);
+        for (const QString &name : subDirectories) {
+            if (!isIgnoredDirectory(name) && !addDirectoryTree(path + QLatin1Char('/') + name)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Forgets the watches of path and everything below it (the kernel drops them
+ * by itself when the directories are gone)
+ */
+void NoteFolderWatcher::removeDirectoryTree(const QString &path) {
+    const QString prefix = path + QLatin1Char('/');
+    for (auto it = _watchByPath.begin(); it != _watchByPath.end();) {
+        if (it.key() == path || it.key().startsWith(prefix)) {
+#ifdef Q_OS_LINUX
+            inotify_rm_watch(_fd, it.value());
+#endif
+            _pathByWatch.remove(it.value());
+            it = _watchByPath.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/**
+ * Drains the inotify queue and emits each changed path once per read
+ */
+void NoteFolderWatcher::readEvents() {
+#ifdef Q_OS_LINUX
+    QStringList files;
+    QStringList directories;
+    QSet<QString> seenFiles;
+    QSet<QString> seenDirectories;
+    bool overflow = false;
+
+    const auto addFile = [&](const QString &path) {
+        if (!seenFiles.contains(path)) {
+            seenFiles.insert(path);
+            files << path;
+        }
+    };
+    const auto addDirectoryPath = [&](const QString &path) {
+        if (!seenDirectories.contains(path)) {
+            seenDirectories.insert(path);
+            directories << path;
+        }
+    };
+
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    for (;;) {
+        const ssize_t length = ::read(_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            // EAGAIN: queue is empty
+            break;
+        }
+
+        for (char *p = buffer; p < buffer + length;) {
+            const auto *event = reinterpret_cast<const struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+
+            const QString directory = _pathByWatch.value(event->wd);
+            if (directory.isEmpty()) {
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED) {
+                _pathByWatch.remove(event->wd);
+                _watchByPath.remove(directory);
+                continue;
+            }
+
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                addDirectoryPath(directory);
+                continue;
+            }
+
+            const QString name = event->len ? QFile::decodeName(event->name) : QString();
+            if (name.isEmpty()) {
+                continue;
+            }
+            const QString path = directory + QLatin1Char('/') + name;
+
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    // watch it before anything lands in it, then report the new
+                    // directory itself too in case files arrived in between
+                    if (_recursive && !isIgnoredDirectory(name) && addDirectoryTree(path)) {
+                        addDirectoryPath(path);
+                    }
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    removeDirectoryTree(path);
+                }
+                addDirectoryPath(directory);
+                continue;
+            }
+
+            if (event->mask & IN_CLOSE_WRITE) {
+                addFile(path);
+            }
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) {
+                addFile(path);
+                addDirectoryPath(directory);
+            }
+            if (event->mask & IN_CREATE) {
+                addDirectoryPath(directory);
+            }
+        }
+    }
+
+    if (overflow) {
+        qWarning() << "inotify queue overflowed, the note folder needs a rescan";
+        emit overflowed();
+        return;
+    }
+
+    for (const QString &directory : directories) {
+        emit directoryChanged(directory);
+    }
+    for (const QString &file : files) {
+        emit fileChanged(file);
+    }
+#endif
+}
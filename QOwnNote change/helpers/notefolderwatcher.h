@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QObject>
+#include <functional>
+
+class QSocketNotifier;
+
+/**
+ * Watches a note folder tree with one inotify watch per directory and no
+ * watches on individual notes, so the number of file descriptors does not
+ * grow with the number of notes (QFileSystemWatcher needs one per path).
+ *
+ * The signals have the same signatures as the ones of QFileSystemWatcher:
+ * fileChanged() carries the exact path of a written, moved or removed file,
+ * directoryChanged() the directory in which entries were added or removed.
+ * If the kernel queue overflowed, events were lost and overflowed() asks
+ * for a rescan.
+ *
+ * Only available on Linux, see isSupported().
+ */
+class NoteFolderWatcher : public QObject {
+    Q_OBJECT
+
+   public:
+    explicit NoteFolderWatcher(QObject *parent = nullptr);
+    ~NoteFolderWatcher() override;
+
+    static bool isSupported();
+
+    /**
+     * Starts watching rootPath (and its subdirectories if recursive is set,
+     * skipping directories for which ignoreDirectory returns true)
+     *
+     * @return false if the watches could not be set up, e.g. because
+     *         fs.inotify.max_user_watches was reached
+     */
+    bool watch(const QString &rootPath, bool recursive,
+               const std::function<bool(const QString &)> &ignoreDirectory);
+    bool addDirectory(const QString &path);    // one more directory, not recursive
+    void clear();
+    bool isWatching() const { return !_pathByWatch.isEmpty(); }
+    int watchCount() const { return _pathByWatch.size(); }
+
+   Q_SIGNALS:
+    void fileChanged(const QString &path);
+    void directoryChanged(const QString &path);
+    void overflowed();
+
+   private Q_SLOTS:
+    void readEvents();
+
+   private:
+    bool addDirectoryTree(const QString &path);
+    void removeDirectoryTree(const QString &path);
+    bool isIgnoredDirectory(const QString &name) const;
+
+    int _fd = -1;
+    QSocketNotifier *_notifier = nullptr;
+    QHash<int, QString> _pathByWatch;
+    QHash<QString, int> _watchByPath;
+    bool _recursive = true;
+    std::function<bool(const QString &)> _ignoreDirectory;
+};
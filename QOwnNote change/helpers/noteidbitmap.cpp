@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "noteidbitmap.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QtGlobal>
+#include <algorithm>
+#include <iterator>
+
+// above this many ids a bitmap (1024 words) is smaller than the array
+static const int arrayContainerLimit = 4096;
+static const int bitmapWords = 65536 / 64;
+
+void NoteIdBitmap::Container::toBitmap() {
+    words = QVector<quint64>(bitmapWords, 0);
+    for (const quint16 value : values) {
+        words[value >> 6] |= quint64(1) << (value & 63);
+    }
+    values.clear();
+    values.squeeze();
+}
+
+NoteIdBitmap NoteIdBitmap::fromIds(const QVector<int> &ids) {
+    NoteIdBitmap bitmap;
+    for (const int id : ids) {
+        bitmap.add(id);
+    }
+    return bitmap;
+}
+
+void NoteIdBitmap::add(int id) {
+    if (id < 0) {
+        return;
+    }
+
+    Container &container = _containers[quint16(quint32(id) >> 16)];
+    const auto low = quint16(id & 0xffff);
+
+    if (container.isBitmap()) {
+        quint64 &word = container.words[low >> 6];
+        const quint64 bit = quint64(1) << (low & 63);
+        if ((word & bit) == 0) {
+            word |= bit;
+            container.cardinality++;
+        }
+        return;
+    }
+
+    const auto it = std::lower_bound(container.values.begin(), container.values.end(), low);
+    if (it != container.values.end() && *it == low) {
+        return;
+    }
+    container.values.insert(it, low);
+    container.cardinality++;
+
+    if (container.cardinality > arrayContainerLimit) {
+        container.toBitmap();
+    }
+}
+
+bool NoteIdBitmap::contains(int id) const {
+    if (id < 0) {
+        return false;
+    }
+
+    const auto it = _containers.constFind(quint16(quint32(id) >> 16));
+    if (it == _containers.constEnd()) {
+        return false;
+    }
+
+    const auto low = quint16(id & 0xffff);
+    if (it->isBitmap()) {
+        return (it->words.at(low >> 6) >> (low & 63)) & 1;
+    }
+    return std::binary_search(it->values.constBegin(), it->values.constEnd(), low);
+}
+
+int NoteIdBitmap::count() const {
+    int count = 0;
+    for (const Container &container : _containers) {
+        count += container.cardinality;
+    }
+    return count;
+}
+
+NoteIdBitmap &NoteIdBitmap::operator|=(const NoteIdBitmap &other) {
+    for (auto it = other._containers.constBegin(); it != other._containers.constEnd(); ++it) {
+        auto mine = _containers.find(it.key());
+        if (mine == _containers.end()) {
+            _containers.insert(it.key(), it.value());
+            continue;
+        }
+
+        Container &container = mine.value();
+        const Container &theirs = it.value();
+
+        if (!container.isBitmap() && !theirs.isBitmap() &&
+            container.cardinality + theirs.cardinality <= arrayContainerLimit) {
+            QVector<quint16> merged;
+            merged.reserve(container.cardinality + theirs.cardinality);
+            std::set_union(container.values.constBegin(), container.values.constEnd(),
+                           theirs.values.constBegin(), theirs.values.constEnd(),
+                           std::back_inserter(merged));
+            container.values = merged;
+            container.cardinality = merged.size();
+            continue;
+        }
+
+        if (!container.isBitmap()) {
+            container.toBitmap();
+        }
+
+        if (theirs.isBitmap()) {
+            for (int i = 0; i < bitmapWords; ++i) {
+                container.words[i] |= theirs.words.at(i);
+            }
+        } else {
+            for (const quint16 value : theirs.values) {
+                container.words[value >> 6] |= quint64(1) << (value & 63);
+            }
+        }
+
+        container.cardinality = 0;
+        for (int i = 0; i < bitmapWords; ++i) {
+            container.cardinality += qPopulationCount(container.words.at(i));
+        }
+    }
+
+    return *this;
+}
+
+void NoteIdBitmapCache::validate() {
+    // total_changes() counts our own writes, data_version the ones of other
+    // connections to the same file
+    QString state;
+    const QStringList connections{QStringLiteral("memory"), QStringLiteral("note_folder")};
+    for (const QString &connection : connections) {
+        QSqlDatabase db = QSqlDatabase::database(connection);
+        QSqlQuery query(db);
+        state += db.databaseName() + QLatin1Char('|');
+        if (query.exec(QStringLiteral("SELECT total_changes()")) && query.next()) {
+            state += query.value(0).toString() + QLatin1Char('|');
+        }
+        if (query.exec(QStringLiteral("PRAGMA data_version")) && query.next()) {
+            state += query.value(0).toString() + QLatin1Char('|');
+        }
+    }
+
+    if (state != _databaseState) {
+        _databaseState = state;
+        _bitmaps.clear();
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QMap>
+#include <QString>
+#include <QVector>
+
+/**
+ * Compressed set of note ids, organized like a roaring bitmap
+ *
+ * The ids are split by their upper 16 bits into containers. A container
+ * holds a sorted array while it is sparse and switches to a 65536 bit
+ * bitmap once it has more than 4096 ids, so a set never takes more than
+ * 8 KiB per 65536 ids and unions of dense sets are word-wise ORs.
+ */
+class NoteIdBitmap {
+   public:
+    static NoteIdBitmap fromIds(const QVector<int> &ids);
+
+    void add(int id);
+    bool contains(int id) const;
+    bool isEmpty() const { return _containers.isEmpty(); }
+    int count() const;
+
+    NoteIdBitmap &operator|=(const NoteIdBitmap &other);
+
+   private:
+    struct Container {
+        QVector<quint16> values;    // sorted, while the container is sparse
+        QVector<quint64> words;     // the bitmap, once it is dense
+        int cardinality = 0;
+
+        bool isBitmap() const { return !words.isEmpty(); }
+        void toBitmap();
+    };
+
+    QMap<quint16, Container> _containers;
+};
+
+/**
+ * Note id sets of the tag and note subfolder filters, keyed by the filter
+ *
+ * Instead of hooking every place that links tags or (re)creates notes, the
+ * cache compares the change counters of the "memory" and "note_folder"
+ * databases and starts over once one of them moved.
+ */
+class NoteIdBitmapCache {
+   public:
+    void validate();
+
+    template <typename FetchIds>
+    const NoteIdBitmap &value(const QString &key, FetchIds fetchIds) {
+        auto it = _bitmaps.find(key);
+        if (it == _bitmaps.end()) {
+            it = _bitmaps.insert(key, NoteIdBitmap::fromIds(fetchIds()));
+        }
+        return it.value();
+    }
+
+   private:
+    QString _databaseState;
+    QHash<QString, NoteIdBitmap> _bitmaps;
+};
@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "notelinkindex.h"
+
+#include <entities/note.h>
+#include <entities/notesubfolder.h>
+#include <utils/misc.h>
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QRegularExpression>
+#include <QSet>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QUrl>
+
+static QString joinPath(const QString &subFolderPath, const QString &fileName) {
+    return subFolderPath.isEmpty() ? fileName : subFolderPath + QLatin1Char('/') + fileName;
+}
+
+/**
+ * Returns the path of a note relative to the note folder
+ */
+QString NoteLinkIndex::notePath(const Note &note) {
+    return joinPath(note.getNoteSubFolder().relativePath(), note.getFileName());
+}
+
+/**
+ * Returns the paths of the notes the text of the note at notePath links to
+ *
+ * Only relative links to files with a note file extension are taken, like
+ * "[Note](../Other%20note.md)", "[Note](<My note.md>)" or "<Note.md>".
+ */
+QStringList NoteLinkIndex::parseLinks(const QString &notePath, const QString &text) {
+    static const QRegularExpression linkRe(QStringLiteral(
+        R"(\[[^\]]*\]\((?:<([^>\n]+)>|([^)\s]+))[^)]*\)|<([^>\s]+)>)"));
+    static const QRegularExpression schemeRe(QStringLiteral(R"(^[a-zA-Z][a-zA-Z0-9+.-]*:)"));
+
+    const QFileInfo noteFileInfo(notePath);
+    const QString dirPath = noteFileInfo.path();
+    const QString noteSuffix = noteFileInfo.suffix().toLower();
+    QStringList paths;
+
+    QRegularExpressionMatchIterator i = linkRe.globalMatch(text);
+    while (i.hasNext()) {
+        const QRegularExpressionMatch match = i.next();
+        QString url = match.captured(1);
+        if (url.isEmpty()) {
+            url = match.captured(2);
+        }
+        if (url.isEmpty()) {
+            url = match.captured(3);
+        }
+
+        // web links, note:// links, ...
+        if (schemeRe.match(url).hasMatch()) {
+            continue;
+        }
+
+        url = QUrl::fromPercentEncoding(url.section(QLatin1Char('#'), 0, 0).toUtf8());
+
+        const QString suffix = QFileInfo(url).suffix().toLower();
+        if (suffix != QLatin1String("md") && suffix != QLatin1String("txt") &&
+            suffix != noteSuffix) {
+            continue;
+        }
+
+        const QString path = QDir::cleanPath(dirPath + QLatin1Char('/') + url);
+        if (path != notePath && !path.startsWith(QLatin1String("../"))) {
+            paths << path;
+        }
+    }
+
+    paths.removeDuplicates();
+    return paths;
+}
+
+/**
+ * Parses the links of the notes that were stored since they were indexed
+ *
+ * @param noteIds the notes to check, all notes if empty; notes that are gone
+ *                are only removed from the index if all notes are checked
+ * @return true if the index was changed
+ */
+bool NoteLinkIndex::update(const QVector<int> &noteIds) {
+    if (!setupTables()) {
+        return false;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(QStringLiteral("memory"));
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+
+    // the file size and modification date the notes were indexed with
+    QHash<QString, QString> indexedStamps;
+    if (query.exec(QStringLiteral("SELECT path, stamp FROM noteLinkSource"))) {
+        while (query.next()) {
+            indexedStamps.insert(query.value(0).toString(), query.value(1).toString());
+        }
+    }
+    query.finish();
+
+    QString sql = QStringLiteral(
+        "SELECT id, file_name, note_sub_folder_id, file_size, file_last_modified FROM note");
+    if (!noteIds.isEmpty()) {
+        QStringList ids;
+        for (const int noteId : noteIds) {
+            ids << QString::number(noteId);
+        }
+        sql += QStringLiteral(" WHERE id IN (") + ids.join(QLatin1Char(',')) + QLatin1Char(')');
+    }
+
+    struct ChangedNote {
+        int id;
+        QString path;
+        QString stamp;
+    };
+
+    QVector<ChangedNote> changedNotes;
+    QSet<QString> notePaths;
+    QHash<int, QString> subFolderPaths;
+    QSqlQuery noteQuery(db);
+    noteQuery.setForwardOnly(true);
+    if (!noteQuery.exec(sql)) {
+        qWarning() << __func__ << ": " << noteQuery.lastError();
+        return false;
+    }
+    while (noteQuery.next()) {
+        const int noteSubFolderId = noteQuery.value(2).toInt();
+        auto subFolderPath = subFolderPaths.constFind(noteSubFolderId);
+        if (subFolderPath == subFolderPaths.constEnd()) {
+            subFolderPath = subFolderPaths.insert(
+                noteSubFolderId,
+                noteSubFolderId > 0 ? NoteSubFolder::fetch(noteSubFolderId).relativePath()
+                                    : QString());
+        }
+
+        ChangedNote note;
+        note.id = noteQuery.value(0).toInt();
+        note.path = joinPath(*subFolderPath, noteQuery.value(1).toString());
+        note.stamp = noteQuery.value(3).toString() + QLatin1Char(' ') +
+                     noteQuery.value(4).toDateTime().toString(Qt::ISODateWithMs);
+        notePaths << note.path;
+
+        if (indexedStamps.value(note.path) != note.stamp) {
+            changedNotes << note;
+        }
+    }
+    noteQuery.finish();
+
+    QStringList removedPaths;
+    if (noteIds.isEmpty()) {
+        for (auto it = indexedStamps.constBegin(); it != indexedStamps.constEnd(); ++it) {
+            if (!notePaths.contains(it.key())) {
+                removedPaths << it.key();
+            }
+        }
+    }
+
+    if (changedNotes.isEmpty() && removedPaths.isEmpty()) {
+        return false;
+    }
+
+    const auto removeLinks = [&query](const QString &path) {
+        query.prepare(QStringLiteral("DELETE FROM noteLink WHERE source_path = :path"));
+        query.bindValue(QStringLiteral(":path"), path);
+        return query.exec();
+    };
+
+    db.transaction();
+    bool success = true;
+
+    for (const QString &path : Utils::asConst(removedPaths)) {
+        success = success && removeLinks(path);
+        query.prepare(QStringLiteral("DELETE FROM noteLinkSource WHERE path = :path"));
+        query.bindValue(QStringLiteral(":path"), path);
+        success = success && query.exec();
+    }
+
+    for (const ChangedNote &changedNote : Utils::asConst(changedNotes)) {
+        const QString text = Note::fetch(changedNote.id).getNoteText();
+        const QStringList targetPaths = parseLinks(changedNote.path, text);
+        success = success && removeLinks(changedNote.path);
+
+        if (!targetPaths.isEmpty()) {
+            QVariantList sourcePaths;
+            QVariantList targets;
+            for (const QString &targetPath : targetPaths) {
+                sourcePaths << changedNote.path;
+                targets << targetPath;
+            }
+
+            query.prepare(QStringLiteral("INSERT INTO noteLink (source_path, target_path) "
+                                         "VALUES (?, ?)"));
+            query.addBindValue(sourcePaths);
+            query.addBindValue(targets);
+            success = success && query.execBatch();
+        }
+
+        query.prepare(
+            QStringLiteral("INSERT OR REPLACE INTO noteLinkSource (path, stamp, legacy) "
+                           "VALUES (:path, :stamp, :legacy)"));
+        query.bindValue(QStringLiteral(":path"), changedNote.path);
+        query.bindValue(QStringLiteral(":stamp"), changedNote.stamp);
+        query.bindValue(QStringLiteral(":legacy"),
+                        text.contains(QLatin1String("note://")) ? 1 : 0);
+        success = success && query.exec();
+    }
+
+    if (!success) {
+        qWarning() << __func__ << ": " << query.lastError();
+        db.rollback();
+        return false;
+    }
+
+    return db.commit();
+}
+
+/**
+ * Returns the notes that link to the note at notePath
+ */
+QVector<NoteLinkIndex::Link> NoteLinkIndex::backlinks(const QString &notePath) {
+    QVector<Link> links;
+    if (!setupTables()) {
+        return links;
+    }
+
+    QSqlQuery query(QSqlDatabase::database(QStringLiteral("memory")));
+    query.prepare(
+        QStringLiteral("SELECT l.source_path, s.stamp FROM noteLink l "
+                       "LEFT JOIN noteLinkSource s ON s.path = l.source_path "
+                       "WHERE l.target_path = :path ORDER BY l.source_path"));
+    query.bindValue(QStringLiteral(":path"), notePath);
+
+    if (query.exec()) {
+        while (query.next()) {
+            links.append({query.value(0).toString(), query.value(1).toString()});
+        }
+    }
+
+    return links;
+}
+
+/**
+ * Returns the notes the note at notePath links to and the notes that link to it
+ */
+QVector<NoteLinkIndex::Link> NoteLinkIndex::neighbours(const QString &notePath) {
+    QVector<Link> links;
+    if (!setupTables()) {
+        return links;
+    }
+
+    QSqlQuery query(QSqlDatabase::database(QStringLiteral("memory")));
+    query.prepare(
+        QStringLiteral("SELECT l.target_path, s.stamp FROM noteLink l "
+                       "LEFT JOIN noteLinkSource s ON s.path = l.target_path "
+                       "WHERE l.source_path = :sourcePath "
+                       "UNION "
+                       "SELECT l.source_path, s.stamp FROM noteLink l "
+                       "LEFT JOIN noteLinkSource s ON s.path = l.source_path "
+                       "WHERE l.target_path = :targetPath ORDER BY 1"));
+    query.bindValue(QStringLiteral(":sourcePath"), notePath);
+    query.bindValue(QStringLiteral(":targetPath"), notePath);
+
+    if (query.exec()) {
+        while (query.next()) {
+            links.append({query.value(0).toString(), query.value(1).toString()});
+        }
+    }
+
+    return links;
+}
+
+/**
+ * Returns true if a note uses legacy note:// links, those are resolved by note
+ * name and not in the index
+ */
+bool NoteLinkIndex::hasLegacyLinks() {
+    if (!setupTables()) {
+        return false;
+    }
+
+    QSqlQuery query(QSqlDatabase::database(QStringLiteral("memory")));
+    return query.exec(
+               QStringLiteral("SELECT 1 FROM noteLinkSource WHERE legacy = 1 LIMIT 1")) &&
+           query.next();
+}
+
+/**
+ * Forgets the links of all notes, e.g. when another note folder is loaded
+ */
+void NoteLinkIndex::clear() {
+    if (!setupTables()) {
+        return;
+    }
+
+    QSqlQuery query(QSqlDatabase::database(QStringLiteral("memory")));
+    query.exec(QStringLiteral("DELETE FROM noteLink"));
+    query.exec(QStringLiteral("DELETE FROM noteLinkSource"));
+}
+
+/**
+ * Creates the tables of the index in the memory database if needed
+ *
+ * The stamps are local to this machine, in the synced note folder database
+ * every machine would parse all notes again and write the database.
+ */
+bool NoteLinkIndex::setupTables() {
+    QSqlDatabase db = QSqlDatabase::database(QStringLiteral("memory"));
+    if (!db.isOpen()) {
+        return false;
+    }
+
+    QSqlQuery query(db);
+    return query.exec(
+               QStringLiteral("CREATE TABLE IF NOT EXISTS noteLinkSource ("
+                              "path TEXT PRIMARY KEY, "
+                              "stamp VARCHAR(64), "
+                              "legacy INTEGER NOT NULL DEFAULT 0)")) &&
+           query.exec(
+               QStringLiteral("CREATE TABLE IF NOT EXISTS noteLink ("
+                              "source_path TEXT NOT NULL, "
+                              "target_path TEXT NOT NULL, "
+                              "PRIMARY KEY (source_path, target_path))")) &&
+           query.exec(
+               QStringLiteral("CREATE INDEX IF NOT EXISTS idxNoteLinkTarget "
+                              "ON noteLink (target_path)"));
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class Note;
+
+/**
+ * Index of the links between the notes of the current note folder
+ *
+ * The links of every note are kept in the memory database together with the
+ * file size and modification date of the note they were parsed from, so
+ * update() only parses notes that were stored since. Paths are relative to
+ * the note folder, like "Subfolder/Note.md". Legacy note:// links are not
+ * indexed, see hasLegacyLinks().
+ */
+class NoteLinkIndex {
+   public:
+    struct Link {
+        QString path;     // the note on the other end of the link
+        QString stamp;    // when that note was indexed, empty if it isn't
+    };
+
+    static QString notePath(const Note &note);
+
+    static QStringList parseLinks(const QString &notePath, const QString &text);
+
+    static bool update(const QVector<int> &noteIds = QVector<int>());
+
+    static QVector<Link> backlinks(const QString &notePath);
+
+    static QVector<Link> neighbours(const QString &notePath);
+
+    static bool hasLegacyLinks();
+
+    static void clear();
+
+   private:
+    static bool setupTables();
+};
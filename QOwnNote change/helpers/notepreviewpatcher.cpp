@@ -0,0 +1,440 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "notepreviewpatcher.h"
+
+#include <QCryptographicHash>
+#include <QHash>
+#include <QRegularExpression>
+#include <QSet>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextFrame>
+#include <QTextList>
+
+static const QString markerPrefix = QStringLiteral("qownnotes-preview-block-");
+
+// a comment or an opening, closing or self-closing tag
+static const QRegularExpression tagExpression(
+    QStringLiteral(R"(<!--.*?-->|<(/?)([a-zA-Z][a-zA-Z0-9]*)\b[^>]*?(/?)>)"),
+    QRegularExpression::DotMatchesEverythingOption);
+
+static bool isVoidElement(const QString &name) {
+    static const QSet<QString> voidElements{
+        QStringLiteral("area"),  QStringLiteral("base"),  QStringLiteral("br"),
+        QStringLiteral("col"),   QStringLiteral("embed"), QStringLiteral("hr"),
+        QStringLiteral("img"),   QStringLiteral("input"), QStringLiteral("link"),
+        QStringLiteral("meta"),  QStringLiteral("param"), QStringLiteral("source"),
+        QStringLiteral("track"), QStringLiteral("wbr")};
+    return voidElements.contains(name);
+}
+
+/**
+ * Returns the position of the blocks that contain the markers
+ */
+static QHash<int, int> findMarkers(const QTextDocument *document, QSet<int> markers) {
+    QHash<int, int> positions;
+    for (QTextBlock block = document->begin(); block.isValid() && !markers.isEmpty();
+         block = block.next()) {
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+            const QStringList anchorNames = it.fragment().charFormat().anchorNames();
+            for (const QString &anchorName : anchorNames) {
+                if (!anchorName.startsWith(markerPrefix)) {
+                    continue;
+                }
+
+                const int marker = anchorName.mid(markerPrefix.size()).toInt();
+                if (markers.remove(marker)) {
+                    positions.insert(marker, block.position());
+                }
+            }
+        }
+    }
+
+    return positions;
+}
+
+/**
+ * Checks if the blocks are plain paragraphs of the root frame and every list
+ * they are in lies completely in the range
+ */
+static bool isPlainRange(const QTextBlock &first, const QTextBlock &last) {
+    const QTextFrame *rootFrame = first.document()->rootFrame();
+    for (QTextBlock block = first; block.isValid(); block = block.next()) {
+        if (QTextCursor(block).currentFrame() != rootFrame) {
+            return false;
+        }
+
+        const QTextList *list = block.textList();
+        if (list != nullptr && (list->item(0).blockNumber() < first.blockNumber() ||
+                                list->item(list->count() - 1).blockNumber() > last.blockNumber())) {
+            return false;
+        }
+
+        if (block == last) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+void NotePreviewPatcher::show(QTextDocument *document, const QString &html,
+                              const std::function<void(const QString &)> &setHtml) {
+    QString head;
+    QString tail;
+    QStringList blocks;
+
+    if (!split(html, &head, &blocks, &tail)) {
+        reset();
+        setHtml(html);
+        return;
+    }
+
+    QVector<QByteArray> hashes;
+    hashes.reserve(blocks.size());
+    for (int i = 0; i < blocks.size(); ++i) {
+        hashes << QCryptographicHash::hash(blocks.at(i).toUtf8(), QCryptographicHash::Sha1);
+    }
+
+    if (!patch(document, head, blocks, hashes, tail)) {
+        QVector<int> markers;
+        markers.reserve(blocks.size());
+        QString markedHtml = head;
+        for (int i = 0; i < blocks.size(); ++i) {
+            markedHtml += markBlock(blocks.at(i), &markers);
+        }
+        markedHtml += tail;
+
+        setHtml(markedHtml);
+
+        _head = head;
+        _tail = tail;
+        _blockHashes = hashes;
+        _blockMarkers = markers;
+    }
+
+    _document = document;
+    _revision = document->revision();
+}
+
+void NotePreviewPatcher::reset() {
+    _document = nullptr;
+    _blockHashes.clear();
+    _blockMarkers.clear();
+}
+
+/**
+ * Splits html into everything up to <body>, the top-level blocks of the body
+ * and everything from </body> on
+ */
+bool NotePreviewPatcher::split(const QString &html, QString *head, QStringList *blocks,
+                               QString *tail) {
+    static const QRegularExpression bodyExpression(QStringLiteral(R"(<body\b[^>]*>)"),
+                                                   QRegularExpression::CaseInsensitiveOption);
+    const QRegularExpressionMatch bodyMatch = bodyExpression.match(html);
+    const int bodyEnd = html.lastIndexOf(QLatin1String("</body>"), -1, Qt::CaseInsensitive);
+    if (!bodyMatch.hasMatch() || bodyEnd < bodyMatch.capturedEnd()) {
+        return false;
+    }
+
+    *head = html.left(bodyMatch.capturedEnd());
+    *tail = html.mid(bodyEnd);
+    const QString body = html.mid(bodyMatch.capturedEnd(), bodyEnd - bodyMatch.capturedEnd());
+
+    int depth = 0;
+    int start = 0;
+    int pos = 0;
+    forever {
+        const QRegularExpressionMatch match = tagExpression.match(body, pos);
+        if (!match.hasMatch()) {
+            break;
+        }
+
+        // comments don't change the depth
+        const QString name = match.captured(2).toLower();
+        if (name.isEmpty()) {
+            pos = match.capturedEnd();
+            continue;
+        }
+
+        const bool isClosing = !match.captured(1).isEmpty();
+        if (!isClosing && depth == 0 && match.capturedStart() > start) {
+            // text between top-level elements is a block of its own,
+            // whitespace belongs to the previous block
+            const QString text = body.mid(start, match.capturedStart() - start);
+            if (!text.trimmed().isEmpty()) {
+                blocks->append(text);
+                start = match.capturedStart();
+            } else if (!blocks->isEmpty()) {
+                blocks->last() += text;
+                start = match.capturedStart();
+            }
+        }
+
+        pos = match.capturedEnd();
+        if (isClosing) {
+            depth = qMax(0, depth - 1);
+        } else if (match.captured(3).isEmpty() && !isVoidElement(name)) {
+            depth++;
+
+            // the content of scripts and style sheets isn't html
+            if (name == QLatin1String("script") || name == QLatin1String("style")) {
+                const int close =
+                    body.indexOf(QStringLiteral("</") + name, pos, Qt::CaseInsensitive);
+                if (close < 0) {
+                    return false;
+                }
+                pos = close;
+                continue;
+            }
+        }
+
+        if (depth == 0) {
+            blocks->append(body.mid(start, pos - start));
+            start = pos;
+        }
+    }
+
+    const QString rest = body.mid(start);
+    if (!rest.trimmed().isEmpty() || blocks->isEmpty()) {
+        blocks->append(rest);
+    } else {
+        blocks->last() += rest;
+    }
+
+    return true;
+}
+
+/**
+ * Puts a named anchor into the first paragraph of a top-level block
+ *
+ * Tables and horizontal rules can't hold an anchor, they (and blocks without
+ * a tag) are only ever replaced together with the block before them.
+ */
+QString NotePreviewPatcher::markBlock(const QString &block, QVector<int> *markers) {
+    int pos = 0;
+    int insertPos = -1;
+    forever {
+        while (pos < block.size() && block.at(pos).isSpace()) {
+            pos++;
+        }
+
+        const QRegularExpressionMatch match = tagExpression.match(
+            block, pos, QRegularExpression::NormalMatch,
+            QRegularExpression::AnchorAtOffsetMatchOption);
+        if (!match.hasMatch() || !match.captured(1).isEmpty()) {
+            break;
+        }
+
+        const QString name = match.captured(2).toLower();
+        if (name == QLatin1String("table") || name == QLatin1String("hr")) {
+            insertPos = -1;
+            break;
+        }
+
+        if (name.isEmpty() || !match.captured(3).isEmpty() || isVoidElement(name)) {
+            break;
+        }
+
+        insertPos = match.capturedEnd();
+        pos = insertPos;
+
+        if (name == QLatin1String("pre") || name == QLatin1String("code")) {
+            break;
+        }
+    }
+
+    if (insertPos < 0) {
+        *markers << -1;
+        return block;
+    }
+
+    const int marker = _nextMarker++;
+    *markers << marker;
+    return block.left(insertPos) + QStringLiteral("<a name=\"") + markerPrefix +
+           QString::number(marker) + QStringLiteral("\"></a>") + block.mid(insertPos);
+}
+
+/**
+ * Replaces the range of blocks that changed since the last update
+ *
+ * @return false if the whole html has to be set
+ */
+bool NotePreviewPatcher::patch(QTextDocument *document, const QString &head,
+                               const QStringList &blocks, const QVector<QByteArray> &hashes,
+                               const QString &tail) {
+    if (_document != document || document->revision() != _revision || head != _head ||
+        tail != _tail) {
+        return false;
+    }
+
+    const int oldCount = _blockHashes.size();
+    const int newCount = hashes.size();
+
+    int prefix = 0;
+    while (prefix < oldCount && prefix < newCount &&
+           _blockHashes.at(prefix) == hashes.at(prefix)) {
+        prefix++;
+    }
+
+    if (prefix == oldCount && oldCount == newCount) {
+        return true;
+    }
+
+    int suffix = 0;
+    while (suffix < oldCount - prefix && suffix < newCount - prefix &&
+           _blockHashes.at(oldCount - 1 - suffix) == hashes.at(newCount - 1 - suffix)) {
+        suffix++;
+    }
+
+    // widen the range until it starts and ends at a marker and neither the
+    // removed nor the inserted blocks are empty
+    int from = prefix;
+    int to = oldCount - suffix;
+    forever {
+        while (from > 0 && (from >= oldCount || _blockMarkers.at(from) < 0)) {
+            from--;
+        }
+        while (to < oldCount && _blockMarkers.at(to) < 0) {
+            to++;
+        }
+
+        if (from < to && from < newCount - (oldCount - to)) {
+            break;
+        }
+
+        if (to < oldCount) {
+            to++;
+        } else if (from > 0) {
+            from--;
+        } else {
+            break;
+        }
+    }
+
+    const int newTo = newCount - (oldCount - to);
+    if ((from == 0 && to == oldCount) || from >= to || from >= newTo) {
+        return false;
+    }
+
+    // images are left to the preview widget
+    for (int i = from; i < newTo; ++i) {
+        if (blocks.at(i).contains(QLatin1String("<img"), Qt::CaseInsensitive)) {
+            return false;
+        }
+    }
+
+    QSet<int> markers;
+    if (from > 0) {
+        markers << _blockMarkers.at(from);
+    }
+    if (to < oldCount) {
+        markers << _blockMarkers.at(to);
+    }
+    const QHash<int, int> positions = findMarkers(document, markers);
+    if (positions.size() != markers.size()) {
+        return false;
+    }
+
+    const int fromPos = from > 0 ? positions.value(_blockMarkers.at(from)) : 0;
+    const int toPos = to < oldCount ? positions.value(_blockMarkers.at(to)) : -1;
+    if (toPos >= 0 && toPos <= fromPos) {
+        return false;
+    }
+
+    QVector<int> newMarkers;
+    QString markedHtml = head;
+    for (int i = from; i < newTo; ++i) {
+        markedHtml += markBlock(blocks.at(i), &newMarkers);
+    }
+    markedHtml += tail;
+
+    if (!replaceBlocks(document, fromPos, toPos, markedHtml)) {
+        return false;
+    }
+
+    _blockHashes = hashes;
+    _blockMarkers = _blockMarkers.mid(0, from) + newMarkers + _blockMarkers.mid(to);
+    return true;
+}
+
+/**
+ * Replaces the document blocks from position "from" up to the block at
+ * position "to" (-1 for the end) with the blocks of html
+ *
+ * The blocks are recreated one by one with their formats and text fragments,
+ * inserting html with a cursor would merge the first and last block with
+ * their neighbours.
+ */
+bool NotePreviewPatcher::replaceBlocks(QTextDocument *document, int from, int to,
+                                       const QString &html) {
+    const QTextBlock first = document->findBlock(from);
+    const QTextBlock last = to < 0 ? document->lastBlock() : document->findBlock(to - 1);
+    if (!first.isValid() || !last.isValid() || !isPlainRange(first, last)) {
+        return false;
+    }
+
+    QTextDocument replacement;
+    replacement.setDefaultStyleSheet(document->defaultStyleSheet());
+    replacement.setHtml(html);
+    if (!isPlainRange(replacement.firstBlock(), replacement.lastBlock())) {
+        return false;
+    }
+
+    // the preview isn't editable, there is nothing to undo
+    const bool undoRedoEnabled = document->isUndoRedoEnabled();
+    document->setUndoRedoEnabled(false);
+
+    QTextCursor cursor(document);
+    cursor.beginEditBlock();
+    cursor.setPosition(first.position());
+    cursor.setPosition(last.position() + last.length() - 1, QTextCursor::KeepAnchor);
+    cursor.removeSelectedText();
+
+    if (QTextList *list = cursor.block().textList()) {
+        list->remove(cursor.block());
+    }
+
+    QHash<const QTextList *, QTextList *> lists;
+    for (QTextBlock block = replacement.firstBlock(); block.isValid(); block = block.next()) {
+        QTextBlockFormat blockFormat = block.blockFormat();
+        blockFormat.clearProperty(QTextFormat::ObjectIndex);
+
+        if (block == replacement.firstBlock()) {
+            cursor.setBlockFormat(blockFormat);
+            cursor.setBlockCharFormat(block.charFormat());
+        } else {
+            cursor.insertBlock(blockFormat, block.charFormat());
+        }
+
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+            const QTextFragment fragment = it.fragment();
+            cursor.insertText(fragment.text(), fragment.charFormat());
+        }
+
+        if (const QTextList *list = block.textList()) {
+            if (QTextList *documentList = lists.value(list)) {
+                documentList->add(cursor.block());
+            } else {
+                lists.insert(list, cursor.createList(list->format()));
+            }
+        }
+    }
+
+    cursor.endEditBlock();
+    document->setUndoRedoEnabled(undoRedoEnabled);
+
+    return true;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QPointer>
+#include <QString>
+#include <QStringList>
+#include <QTextDocument>
+#include <QVector>
+#include <functional>
+
+/**
+ * Updates the note preview document block by block
+ *
+ * The preview html is split into its top-level blocks (paragraphs, headings,
+ * lists, code blocks, ...) and a hash of every block is kept. On the next
+ * update only the range of blocks whose hash changed is imported and
+ * replaced in the document, so the text layout of the rest of the note is
+ * kept and the cost of an update follows the size of the edit instead of
+ * the size of the note.
+ *
+ * Every block that can start a replaced range gets an empty named anchor,
+ * that's how its position in the document is found again. Whenever a patch
+ * isn't safe (tables, new images, a changed style sheet, a document that
+ * was changed by someone else, ...) the whole html is set instead.
+ */
+class NotePreviewPatcher {
+   public:
+    /**
+     * Shows html in document
+     *
+     * @param setHtml sets the whole (marked) html if the document can't be patched
+     */
+    void show(QTextDocument *document, const QString &html,
+              const std::function<void(const QString &)> &setHtml);
+
+    /**
+     * The next show() will set the whole html, e.g. to reload the images
+     */
+    void reset();
+
+   private:
+    QPointer<QTextDocument> _document;
+    int _revision = -1;
+    QString _head;
+    QString _tail;
+    QVector<QByteArray> _blockHashes;
+    // marker of every block, -1 if a replaced range can't start at the block
+    QVector<int> _blockMarkers;
+    int _nextMarker = 0;
+
+    static bool split(const QString &html, QString *head, QStringList *blocks, QString *tail);
+    QString markBlock(const QString &block, QVector<int> *markers);
+    bool patch(QTextDocument *document, const QString &head, const QStringList &blocks,
+               const QVector<QByteArray> &hashes, const QString &tail);
+    static bool replaceBlocks(QTextDocument *document, int from, int to, const QString &html);
+};
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "notesearchindex.h"
+
+#include <QDebug>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+
+// we only try once per run, an SQLite without FTS5 won't get it later
+static bool s_unavailable = false;
+
+bool NoteSearchIndex::ensure() {
+    if (s_unavailable) {
+        return false;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(QStringLiteral("memory"));
+    QSqlQuery query(db);
+
+    // the triggers are gone if the note table was ever recreated
+    if (query.exec(QStringLiteral("SELECT COUNT(*) FROM sqlite_master WHERE name IN "
+                                  "('note_fts', 'note_fts_ai', 'note_fts_ad', 'note_fts_au')")) &&
+        query.next() && query.value(0).toInt() == 4) {
+        return true;
+    }
+
+    const QStringList statements{
+        QStringLiteral("DROP TRIGGER IF EXISTS note_fts_ai"),
+        QStringLiteral("DROP TRIGGER IF EXISTS note_fts_ad"),
+        QStringLiteral("DROP TRIGGER IF EXISTS note_fts_au"),
+        QStringLiteral("DROP TABLE IF EXISTS note_fts"),
+        QStringLiteral("CREATE VIRTUAL TABLE note_fts USING fts5(name, note_text, "
+                       "content='note', content_rowid='id', tokenize='trigram')"),
+        QStringLiteral("CREATE TRIGGER note_fts_ai AFTER INSERT ON note BEGIN "
+                       "INSERT INTO note_fts (rowid, name, note_text) "
+                       "VALUES (new.id, new.name, new.note_text); END"),
+        QStringLiteral("CREATE TRIGGER note_fts_ad AFTER DELETE ON note BEGIN "
+                       "INSERT INTO note_fts (note_fts, rowid, name, note_text) "
+                       "VALUES ('delete', old.id, old.name, old.note_text); END"),
+        QStringLiteral("CREATE TRIGGER note_fts_au AFTER UPDATE OF name, note_text ON note BEGIN "
+                       "INSERT INTO note_fts (note_fts, rowid, name, note_text) "
+                       "VALUES ('delete', old.id, old.name, old.note_text); "
+                       "INSERT INTO note_fts (rowid, name, note_text) "
+                       "VALUES (new.id, new.name, new.note_text); END"),
+        // index the notes that are already there
+        QStringLiteral("INSERT INTO note_fts (note_fts) VALUES ('rebuild')")};
+
+    db.transaction();
+    for (const QString &statement : statements) {
+        if (!query.exec(statement)) {
+            qWarning() << "Full-text note search is not available: " << query.lastError().text();
+            db.rollback();
+            s_unavailable = true;
+            return false;
+        }
+    }
+    db.commit();
+
+    return true;
+}
+
+bool NoteSearchIndex::canSearch(const QVector<Term> &terms) {
+    if (terms.isEmpty()) {
+        return false;
+    }
+
+    // shorter terms have no trigram, they would match nothing; the trigrams
+    // are made of characters, not of UTF-16 units
+    for (const Term &term : terms) {
+        if (term.text.toUcs4().size() < 3) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool NoteSearchIndex::search(const QVector<Term> &terms, int noteSubFolderId,
+                             QHash<int, int> *counts) {
+    if (!canSearch(terms) || !ensure()) {
+        return false;
+    }
+
+    // every term is one quoted FTS5 string, so operators in it have no meaning
+    QStringList matchList;
+    for (const Term &term : terms) {
+        QString text = term.text;
+        text.replace(QLatin1Char('"'), QStringLiteral("\"\""));
+        const QString column = term.nameOnly ? QStringLiteral("name") : QStringLiteral("note_text");
+        matchList << column + QStringLiteral(" : \"") + text + QLatin1Char('"');
+    }
+
+    // the occurrences are counted here, SQLite's LOWER() only knows ASCII
+    // while the trigram tokenizer folds the case of all characters
+    QString sql =
+        QStringLiteral("SELECT note.id, note.note_text FROM note_fts "
+                       "JOIN note ON note.id = note_fts.rowid WHERE note_fts MATCH ?");
+    if (noteSubFolderId >= 0) {
+        sql += QStringLiteral(" AND note.note_sub_folder_id = ?");
+    }
+
+    QSqlQuery query(QSqlDatabase::database(QStringLiteral("memory")));
+    query.setForwardOnly(true);
+    query.prepare(sql);
+    query.addBindValue(matchList.join(QStringLiteral(" AND ")));
+    if (noteSubFolderId >= 0) {
+        query.addBindValue(noteSubFolderId);
+    }
+
+    if (!query.exec()) {
+        qWarning() << __func__ << ": " << query.lastError().text();
+        return false;
+    }
+
+    counts->clear();
+    while (query.next()) {
+        const QString noteText = query.value(1).toString();
+        int count = 0;
+        for (const Term &term : terms) {
+            count += noteText.count(term.text, Qt::CaseInsensitive);
+        }
+
+        counts->insert(query.value(0).toInt(), count);
+    }
+
+    return true;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+/**
+ * Full-text index of the note table for the note search
+ *
+ * An FTS5 table with the trigram tokenizer next to the note table in the
+ * "memory" database. It is kept up to date by triggers on the note table,
+ * so every Note::store() and Note::remove() updates it incrementally and
+ * there is nothing to rebuild after an index run.
+ *
+ * The trigram tokenizer gives the same case-insensitive substring semantics
+ * as the LIKE search of Note::searchInNotes(), but it needs at least three
+ * characters per term, see canSearch().
+ */
+class NoteSearchIndex {
+   public:
+    struct Term {
+        QString text;
+        bool nameOnly = false;    // "name:" search, otherwise the note text is searched
+    };
+
+    /**
+     * Creates the index and its triggers if they don't exist (yet)
+     *
+     * @return false if SQLite was built without FTS5 or the trigram tokenizer
+     */
+    static bool ensure();
+
+    static bool canSearch(const QVector<Term> &terms);
+
+    /**
+     * Finds the notes that contain all terms with one query
+     *
+     * @param noteSubFolderId only notes of this note subfolder, -1 for all
+     * @param counts note id -> occurrences of all terms in the note text
+     * @return false if the index can't be used, the caller has to fall back
+     */
+    static bool search(const QVector<Term> &terms, int noteSubFolderId, QHash<int, int> *counts);
+};
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "notewritequeue.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtConcurrent>
+
+NoteWriteQueue::NoteWriteQueue(QObject *parent) : QObject(parent) {
+    connect(&_watcher, &QFutureWatcher<QVector<Write>>::finished, this,
+            &NoteWriteQueue::writesFinished);
+}
+
+bool NoteWriteQueue::isBusy() const { return _watcher.isRunning(); }
+
+bool NoteWriteQueue::enqueue(const QVector<Write> &writes) {
+    if (isBusy()) {
+        return false;
+    }
+
+    // the tokens have to be in place before the first watcher event comes in
+    for (const Write &write : writes) {
+        const QString filePath = QDir::cleanPath(write.filePath);
+        WriteToken token;
+        token.hash = QCryptographicHash::hash(write.data, QCryptographicHash::Sha1);
+        token.directoryPath = QFileInfo(filePath).absolutePath();
+        _writeTokens.insert(filePath, token);
+    }
+
+    _watcher.setFuture(QtConcurrent::run(&NoteWriteQueue::writeFiles, writes));
+    return true;
+}
+
+void NoteWriteQueue::waitForFinished() { _watcher.waitForFinished(); }
+
+/**
+ * Adds the size and modification date of the written files to their tokens
+ */
+void NoteWriteQueue::writesFinished() {
+    const QVector<Write> writes = _watcher.result();
+    dropExpiredWriteTokens();
+
+    for (const Write &write : writes) {
+        const QString filePath = QDir::cleanPath(write.filePath);
+        if (!write.written) {
+            _writeTokens.remove(filePath);
+            continue;
+        }
+
+        const auto token = _writeTokens.find(filePath);
+        if (token != _writeTokens.end()) {
+            token->fileSize = write.fileSize;
+            token->fileLastModified = write.fileLastModified;
+            token->finished.start();
+        }
+    }
+
+    Q_EMIT finished(writes);
+}
+
+/**
+ * Returns true if the file still has the content of our last write to it
+ *
+ * The token is used up by the first event that matches it, the file is only
+ * hashed if the size and modification date don't tell.
+ */
+bool NoteWriteQueue::isOwnWrite(const QString &filePath) {
+    dropExpiredWriteTokens();
+
+    const auto token = _writeTokens.find(filePath);
+    if (token == _writeTokens.end() || !token->fileEventPending) {
+        return false;
+    }
+
+    const QFileInfo info(filePath);
+    bool isOwn = info.exists() && (token->fileSize < 0 || info.size() == token->fileSize);
+
+    if (isOwn && info.lastModified() != token->fileLastModified) {
+        QFile file(filePath);
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        isOwn = file.open(QIODevice::ReadOnly) && hash.addData(&file) &&
+                hash.result() == token->hash;
+    }
+
+    // a file that was changed after our write is not ours anymore
+    token->fileEventPending = false;
+    if (!token->directoryEventPending || !isOwn) {
+        _writeTokens.erase(token);
+    }
+
+    return isOwn;
+}
+
+/**
+ * Returns true if a change of the directory comes from the temporary file of
+ * one of our writes, every write accounts for one directory change
+ */
+bool NoteWriteQueue::isOwnDirectoryChange(const QString &directoryPath) {
+    dropExpiredWriteTokens();
+
+    for (auto token = _writeTokens.begin(); token != _writeTokens.end(); ++token) {
+        if (!token->directoryEventPending || token->directoryPath != directoryPath) {
+            continue;
+        }
+
+        token->directoryEventPending = false;
+        if (!token->fileEventPending) {
+            _writeTokens.erase(token);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * A token that didn't see its events by now would only hide a real change
+ */
+void NoteWriteQueue::dropExpiredWriteTokens() {
+    for (auto token = _writeTokens.begin(); token != _writeTokens.end();) {
+        if (token->finished.isValid() && token->finished.hasExpired(writeTokenLifetime)) {
+            token = _writeTokens.erase(token);
+        } else {
+            ++token;
+        }
+    }
+}
+
+QVector<NoteWriteQueue::Write> NoteWriteQueue::writeFiles(QVector<Write> writes) {
+    for (Write &write : writes) {
+        // binary, the line endings are already in the data and the write
+        // token has to match the bytes on disk
+        QSaveFile file(write.filePath);
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning() << __func__ << " - could not open: " << write.filePath;
+            continue;
+        }
+
+        file.write(write.data);
+
+        // syncs the temporary file and renames it over the note file
+        if (!file.commit()) {
+            qWarning() << __func__ << " - could not write: " << write.filePath << ": "
+                       << file.errorString();
+            continue;
+        }
+
+        const QFileInfo info(write.filePath);
+        write.written = true;
+        write.fileSize = info.size();
+        write.fileLastModified = info.lastModified();
+    }
+
+    return writes;
+}
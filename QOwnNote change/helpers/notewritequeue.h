@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+/**
+ * Writes note files in a worker thread
+ *
+ * A batch of snapshots is written one file after the other with QSaveFile,
+ * so every file is written to a temporary file, synced and renamed over the
+ * note file. A half written note never shows up in the note folder.
+ *
+ * A write token with the hash, size and modification date of every written
+ * file is kept until the watcher event of the write came in, isOwnWrite() and
+ * isOwnDirectoryChange() tell the file watcher handling which events were
+ * caused by our own writes. Tokens whose events never came are dropped after
+ * writeTokenLifetime ms.
+ */
+class NoteWriteQueue : public QObject {
+    Q_OBJECT
+
+   public:
+    static const int writeTokenLifetime = 10000;
+
+    struct Write {
+        int noteId = 0;
+        QString noteText;    // the text data was made from
+        QString filePath;
+        QByteArray data;     // written as is, with the line endings of the file
+
+        // set by the worker
+        bool written = false;
+        qint64 fileSize = 0;
+        QDateTime fileLastModified;
+    };
+
+    explicit NoteWriteQueue(QObject *parent = nullptr);
+
+    bool isBusy() const;
+
+    /**
+     * Starts writing a batch in the worker thread
+     *
+     * @return false if the last batch is still being written
+     */
+    bool enqueue(const QVector<Write> &writes);
+
+    /**
+     * Blocks until the batch that is being written is on disk
+     */
+    void waitForFinished();
+
+    bool isOwnWrite(const QString &filePath);
+
+    bool isOwnDirectoryChange(const QString &directoryPath);
+
+   Q_SIGNALS:
+    void finished(const QVector<NoteWriteQueue::Write> &writes);
+
+   private:
+    struct WriteToken {
+        QByteArray hash;    // SHA-1 of the data
+        qint64 fileSize = -1;
+        QDateTime fileLastModified;
+        QString directoryPath;
+        QElapsedTimer finished;    // started once the file is written
+        bool fileEventPending = true;
+        // QSaveFile creates a temporary file next to the note and renames it
+        bool directoryEventPending = true;
+    };
+
+    QFutureWatcher<QVector<Write>> _watcher;
+    // cleaned file path -> token of the data we wrote last
+    QHash<QString, WriteToken> _writeTokens;
+
+    void writesFinished();
+    void dropExpiredWriteTokens();
+
+    static QVector<Write> writeFiles(QVector<Write> writes);
+};
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "settingssnapshot.h"
+
+#include <services/settingsservice.h>
+
+SettingsSnapshot::SettingsSnapshot() { reload(); }
+
+void SettingsSnapshot::reload() {
+    const SettingsService settings;
+    const Values defaults;
+    auto values = QSharedPointer<Values>::create();
+
+    values->notesPanelSort =
+        settings.value(QStringLiteral("notesPanelSort"), defaults.notesPanelSort).toInt();
+    values->showMatches =
+        settings.value(QStringLiteral("showMatches"), defaults.showMatches).toBool();
+    values->tagsPanelHideNoteCount =
+        settings.value(QStringLiteral("tagsPanelHideNoteCount"), defaults.tagsPanelHideNoteCount)
+            .toBool();
+    values->navigationPanelAutoSelect =
+        settings
+            .value(QStringLiteral("navigationPanelAutoSelect"), defaults.navigationPanelAutoSelect)
+            .toBool();
+    values->markdownViewEnabled =
+        settings.value(QStringLiteral("markdownViewEnabled"), defaults.markdownViewEnabled)
+            .toBool();
+    values->removeTrailingSpaces =
+        settings.value(QStringLiteral("Editor/removeTrailingSpaces")).toBool();
+    values->ignoreAllExternalNoteFolderChanges =
+        settings.value(QStringLiteral("ignoreAllExternalNoteFolderChanges")).toBool();
+
+    _values = values;
+}
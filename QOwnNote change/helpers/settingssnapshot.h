@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2014-2025 Patrizio Bekerle -- <patrizio@bekerle.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#pragma once
+
+#include <QSharedPointer>
+
+/**
+ * Typed copy of the settings that are read in hot paths, like on every key
+ * press, for every note list item or for every file watcher event
+ *
+ * The values are read from SettingsService once and only read again by
+ * reload(), which has to be called after one of the settings was changed.
+ * reload() replaces the whole snapshot, so a reference from values() always
+ * shows the values of one point in time. The views that show one of the
+ * values are reloaded by the code that calls reload().
+ */
+class SettingsSnapshot {
+   public:
+    struct Values {
+        int notesPanelSort = 1;    // SORT_BY_LAST_CHANGE
+        bool showMatches = true;
+        bool tagsPanelHideNoteCount = false;
+        bool navigationPanelAutoSelect = true;
+        bool markdownViewEnabled = true;
+        bool removeTrailingSpaces = false;
+        bool ignoreAllExternalNoteFolderChanges = false;
+    };
+
+    SettingsSnapshot();
+
+    const Values &values() const { return *_values; }
+
+    void reload();
+
+   private:
+    QSharedPointer<const Values> _values;
+};
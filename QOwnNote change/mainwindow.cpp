@@ -45,6 +45,8 @@
 #include <helpers/clientproxy.h>
 #include <helpers/fakevimproxy.h>
 #include <helpers/flowlayout.h>
+#include <helpers/notefolderwatcher.h>
+#include <helpers/notesearchindex.h>
 #include <helpers/toolbarcontainer.h>
 #include <libraries/qtwaitingspinner/waitingspinnerwidget.h>
 #include <services/cryptoservice.h>
@@ -64,12 +66,16 @@
 #include <QColorDialog>
 #include <QCompleter>
 #include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QDebug>
 #include <QDesktopServices>
 #include <QDir>
 #include <QDirIterator>
 #include <QDockWidget>
+#include <QEventLoop>
 #include <QFile>
+#include <QFutureWatcher>
 #include <QGraphicsView>
 #include <QInputDialog>
 #include <QJSEngine>
@@ -89,10 +95,17 @@
 #include <QRegularExpression>
 #include <QRegularExpressionMatch>
 #include <QRegularExpressionMatchIterator>
+#include <QSaveFile>
+#include <QScopeGuard>
 #include <QScreen>
 #include <QScrollBar>
 #include <QShortcut>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStandardPaths>
 #include <QSystemTrayIcon>
+#include <QTemporaryDir>
 #include <QTemporaryFile>
 #include <QTextBlock>
 #include <QTextDocumentFragment>
@@ -142,10 +155,15 @@
 
 static MainWindow *s_self = nullptr;
 
+// set on note tree widget items whose tooltip, tag color and preview widget
+// are still missing, see MainWindow::decorateVisibleNoteTreeWidgetItems()
+static const int noteItemUndecoratedRole = Qt::UserRole + 2;
+
 struct FileWatchDisabler {
     FileWatchDisabler(MainWindow *mw) : _mainWindow(mw) {
         Q_ASSERT(mw);
         QObject::disconnect(&mw->noteDirectoryWatcher, nullptr, nullptr, nullptr);
+        QObject::disconnect(mw->_noteFolderWatcher, nullptr, nullptr, nullptr);
     }
 
     ~FileWatchDisabler() {
@@ -315,13 +333,54 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
 
     createSystemTrayIcon();
 
+    // has to exist before the first index run, which sets up the watches
+    _noteFolderWatcher = new NoteFolderWatcher(this);
+
+    // external changes are applied in batches, see queueNoteFolderChange()
+    _noteFolderChangeTimer = new QTimer(this);
+    _noteFolderChangeTimer->setSingleShot(true);
+    connect(_noteFolderChangeTimer, &QTimer::timeout, this, &MainWindow::processNoteFolderChanges);
+
+    _noteWriteQueue = new NoteWriteQueue(this);
+    connect(_noteWriteQueue, &NoteWriteQueue::finished, this, &MainWindow::noteWritesFinished);
+
+    // conflicted copies of the note folder database are merged in the background
+    _noteFolderDatabaseMerger = new NoteFolderDatabaseMerger(this);
+    connect(_noteFolderDatabaseMerger, &NoteFolderDatabaseMerger::progress, this,
+            &MainWindow::noteFolderDatabaseMergeProgress);
+    connect(_noteFolderDatabaseMerger, &NoteFolderDatabaseMerger::finished, this,
+            &MainWindow::noteFolderDatabasesMerged);
+
+    // unused media files are only removed on request, next to the dialog of
+    // the stored images
+    auto *removeUnusedMediaAction = new QAction(tr("Remove unused media files…"), this);
+    removeUnusedMediaAction->setObjectName(QStringLiteral("actionRemove_unused_media_files"));
+    connect(removeUnusedMediaAction, &QAction::triggered, this,
+            &MainWindow::removeUnusedMediaFiles);
+    const QList<QMenu *> menus = menuList();
+    for (QMenu *menu : menus) {
+        const QList<QAction *> actions = menu->actions();
+        const int index = actions.indexOf(ui->actionManage_stored_images);
+        if (index >= 0) {
+            menu->insertAction(actions.value(index + 1), removeUnusedMediaAction);
+            break;
+        }
+    }
+
+    _imageDownloadPool = new ImageDownloadPool(this);
+    connect(_imageDownloadPool, &ImageDownloadPool::downloaded, this,
+            &MainWindow::imageDownloadFinished);
+    connect(_imageDownloadPool, &ImageDownloadPool::failed, this,
+            [this](const QUrl &url) { imageDownloadFinished(url); });
+
     buildNotesIndexAndLoadNoteDirectoryList(false, false, false);
 
     this->noteDiffDialog = new NoteDiffDialog();
 
     // look if we need to save something every 10 sec (default)
     this->noteSaveTimer = new QTimer(this);
-    connect(this->noteSaveTimer, &QTimer::timeout, this, &MainWindow::storeUpdatedNotesToDisk);
+    connect(this->noteSaveTimer, &QTimer::timeout, this,
+            &MainWindow::storeUpdatedNotesToDiskInBackground);
 
     this->noteSaveTimer->start(this->noteSaveIntervalTime * 1000);
 
@@ -332,6 +391,14 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
 
     _noteViewUpdateTimer->start(2000);
 
+    _notePreviewWatcher = new QFutureWatcher<QPair<int, QString>>(this);
+    connect(_notePreviewWatcher, &QFutureWatcher<QPair<int, QString>>::finished, this,
+            &MainWindow::notePreviewJobFinished);
+
+    _externalChangeWatcher = new QFutureWatcher<NoteChangeReconciler::Result>(this);
+    connect(_externalChangeWatcher, &QFutureWatcher<NoteChangeReconciler::Result>::finished, this,
+            &MainWindow::externalChangeCheckFinished);
+
     // commit changes from the current note folder to git every 30 sec
     gitCommitCurrentNoteFolder();
     _gitCommitTimer = new QTimer(this);
@@ -532,6 +599,14 @@ void MainWindow::initTreeWidgets() {
         connect(ui->noteTreeWidget, &QTreeWidget::itemCollapsed, ui->noteSubFolderTreeWidget,
                 &NoteSubFolderTree::onItemExpanded);
     }
+
+    // note items get their expensive data once they are scrolled into view,
+    // the range changes with resizing and filtering
+    QScrollBar *scrollBar = ui->noteTreeWidget->verticalScrollBar();
+    connect(scrollBar, &QScrollBar::valueChanged, this,
+            &MainWindow::scheduleNoteTreeWidgetDecoration);
+    connect(scrollBar, &QScrollBar::rangeChanged, this,
+            &MainWindow::scheduleNoteTreeWidgetDecoration);
 }
 
 void MainWindow::initNotePreviewAndTextEdits() {
@@ -612,21 +687,43 @@ void MainWindow::initNotePreviewAndTextEdits() {
 }
 
 void MainWindow::connectFileWatcher(bool delayed) {
-    if (!delayed) {
+    const auto connectWatchers = [this] {
         connect(&noteDirectoryWatcher, &QFileSystemWatcher::directoryChanged, this,
                 &MainWindow::notesDirectoryWasModified, Qt::UniqueConnection);
         connect(&noteDirectoryWatcher, &QFileSystemWatcher::fileChanged, this,
                 &MainWindow::notesWereModified, Qt::UniqueConnection);
+        connect(_noteFolderWatcher, &NoteFolderWatcher::directoryChanged, this,
+                &MainWindow::notesDirectoryWasModified, Qt::UniqueConnection);
+        connect(_noteFolderWatcher, &NoteFolderWatcher::fileChanged, this,
+                &MainWindow::notesWereModified, Qt::UniqueConnection);
+        connect(_noteFolderWatcher, &NoteFolderWatcher::overflowed, this,
+                &MainWindow::noteFolderWatcherOverflowed, Qt::UniqueConnection);
+    };
+
+    if (!delayed) {
+        connectWatchers();
     } else {
         // In some cases, there are delayed signals coming in which we don't want to handle
         // so reconnect with delay
-        QTimer::singleShot(300, this, [this] {
-            connect(&noteDirectoryWatcher, &QFileSystemWatcher::directoryChanged, this,
-                    &MainWindow::notesDirectoryWasModified, Qt::UniqueConnection);
-            connect(&noteDirectoryWatcher, &QFileSystemWatcher::fileChanged, this,
-                    &MainWindow::notesWereModified, Qt::UniqueConnection);
-        });
+        QTimer::singleShot(300, this, connectWatchers);
+    }
+}
+
+/**
+ * The kernel dropped watcher events, so we don't know what changed anymore
+ */
+void MainWindow::noteFolderWatcherOverflowed() {
+    if (_settingsSnapshot.values().ignoreAllExternalNoteFolderChanges) {
+        return;
     }
+
+    // the rescan covers everything that was queued
+    _pendingNoteFileChanges.clear();
+    _pendingNoteDirectoryChanges.clear();
+
+    showStatusBarMessage(tr("Too many external changes at once, rescanning the note folder"),
+                         QStringLiteral("🔄"), 5000);
+    buildNotesIndexAndLoadNoteDirectoryList();
 }
 
 /**
@@ -2043,6 +2140,9 @@ bool MainWindow::changeNoteFolder(const int noteFolderId, const bool forceChange
         // switching to another note folder
         unsetCurrentNote();
 
+        // the links of the other note folder could have the same paths
+        NoteLinkIndex::clear();
+
         buildNotesIndexAndLoadNoteDirectoryList(false, false, false);
 
         // update the current folder tooltip
@@ -2183,7 +2283,11 @@ void MainWindow::loadNoteDirectoryList() {
     Q_UNUSED(blocker2)
 
     const bool isCurrentNoteTreeEnabled = NoteFolder::isCurrentNoteTreeEnabled();
+    _noteTreeWidgetItems.clear();
     ui->noteTreeWidget->clear();
+
+    // in the note tree the items are nested and owned by NoteSubFolderTree too
+    _noteTreeWidgetItemIndexEnabled = !isCurrentNoteTreeEnabled;
     //    ui->noteTreeWidget->setRootIsDecorated(isCurrentNoteTreeEnabled);
     int itemCount;
 
@@ -2201,11 +2305,22 @@ void MainWindow::loadNoteDirectoryList() {
 
         itemCount = Note::countAll();
     } else {
-        // load all notes and add them to the note list widget
+        // load all notes and add them to the note list widget in one go,
+        // tooltips, tag colors and preview widgets only get computed for the
+        // rows that are shown
         const QVector<Note> noteList = Note::fetchAll();
+        QList<QTreeWidgetItem *> noteItems;
+        noteItems.reserve(noteList.count());
+        _noteTreeWidgetItems.reserve(noteList.count());
         for (const Note &note : noteList) {
-            addNoteToNoteTreeWidget(note);
+            // skip notes without name
+            if (!note.getName().isEmpty()) {
+                QTreeWidgetItem *noteItem = createNoteTreeWidgetItem(note);
+                _noteTreeWidgetItems.insert(note.getId(), noteItem);
+                noteItems << noteItem;
+            }
         }
+        ui->noteTreeWidget->addTopLevelItems(noteItems);
 
         itemCount = noteList.count();
     }
@@ -2245,53 +2360,133 @@ void MainWindow::loadNoteDirectoryList() {
             ui->noteTreeWidget->setCurrentItem(item);
         }
     }
+
+    scheduleNoteTreeWidgetDecoration();
 }
 
 /**
- * Adds a note to the note tree widget
+ * Creates the note tree widget item of a note, without the data that is
+ * expensive to compute, see decorateNoteTreeWidgetItem()
  */
-bool MainWindow::addNoteToNoteTreeWidget(const Note &note, QTreeWidgetItem *parent) {
-    const QString name = note.getName();
-
-    // skip notes without name
-    if (name.isEmpty()) {
-        return false;
-    }
-
-    const bool isNoteListPreview = Utils::Misc::isNoteListPreview();
-
-    // add a note item to the tree
+QTreeWidgetItem *MainWindow::createNoteTreeWidgetItem(const Note &note) const {
     auto *noteItem = new QTreeWidgetItem();
-    Utils::Gui::setTreeWidgetItemToolTipForNote(noteItem, note);
-    noteItem->setText(0, name);
+    noteItem->setText(0, note.getName());
     noteItem->setData(0, Qt::UserRole, note.getId());
     noteItem->setData(0, Qt::UserRole + 1, NoteType);
+    noteItem->setData(0, noteItemUndecoratedRole, true);
     noteItem->setIcon(0, Utils::Gui::noteIcon());
 
-    const Tag tag = Tag::fetchOneOfNoteWithColor(note);
-    if (tag.isFetched()) {
-        // set the color of the note tree widget item
-        Utils::Gui::handleTreeWidgetItemTagColor(noteItem, tag);
-    }
-
     const bool isEditable = Note::allowDifferentFileName();
     if (isEditable) {
         noteItem->setFlags(noteItem->flags() | Qt::ItemIsEditable);
     }
 
+    return noteItem;
+}
+
+/**
+ * Sets the tooltip, the tag color and the preview widget of a note item
+ */
+void MainWindow::decorateNoteTreeWidgetItem(const Note &note, QTreeWidgetItem *noteItem) {
+    const QSignalBlocker blocker(ui->noteTreeWidget);
+    Q_UNUSED(blocker)
+
+    noteItem->setData(0, noteItemUndecoratedRole, QVariant());
+    Utils::Gui::setTreeWidgetItemToolTipForNote(noteItem, note);
+
+    // set the color of the note tree widget item
+    Utils::Gui::handleTreeWidgetItemTagColor(noteItem, Tag::fetchOneOfNoteWithColor(note));
+
+    if (Utils::Misc::isNoteListPreview()) {
+        updateNoteTreeWidgetItem(note, noteItem);
+    }
+}
+
+/**
+ * Decorates the note items in the visible part of the note tree widget
+ * that weren't decorated yet, the work doesn't grow with the number of notes
+ */
+void MainWindow::decorateVisibleNoteTreeWidgetItems() {
+    _noteTreeWidgetDecorationScheduled = false;
+    const int viewportHeight = ui->noteTreeWidget->viewport()->height();
+
+    // itemBelow() skips hidden (filtered) items
+    for (QTreeWidgetItem *item = ui->noteTreeWidget->itemAt(0, 0); item != nullptr;
+         item = ui->noteTreeWidget->itemBelow(item)) {
+        if (ui->noteTreeWidget->visualItemRect(item).top() > viewportHeight) {
+            break;
+        }
+
+        if (!item->data(0, noteItemUndecoratedRole).toBool()) {
+            continue;
+        }
+
+        const Note note = Note::fetch(item->data(0, Qt::UserRole).toInt());
+        if (note.isFetched()) {
+            decorateNoteTreeWidgetItem(note, item);
+        } else {
+            item->setData(0, noteItemUndecoratedRole, QVariant());
+        }
+    }
+}
+
+/**
+ * Decorates the visible note items once the event loop is back, so a burst
+ * of scrolling, resizing and filtering results in one pass
+ */
+void MainWindow::scheduleNoteTreeWidgetDecoration() {
+    if (_noteTreeWidgetDecorationScheduled) {
+        return;
+    }
+
+    _noteTreeWidgetDecorationScheduled = true;
+    QTimer::singleShot(0, this, &MainWindow::decorateVisibleNoteTreeWidgetItems);
+}
+
+/**
+ * Drops the tooltips and tag colors of all note items, for example after a
+ * tag color was changed, and decorates the visible ones again
+ */
+void MainWindow::invalidateNoteTreeWidgetDecoration() {
+    QTreeWidgetItemIterator it(ui->noteTreeWidget);
+    while (*it) {
+        if ((*it)->data(0, Qt::UserRole + 1) == NoteType) {
+            (*it)->setData(0, noteItemUndecoratedRole, true);
+        }
+        ++it;
+    }
+
+    scheduleNoteTreeWidgetDecoration();
+}
+
+/**
+ * Adds a note to the note tree widget
+ */
+bool MainWindow::addNoteToNoteTreeWidget(const Note &note, QTreeWidgetItem *parent) {
+    // skip notes without name
+    if (note.getName().isEmpty()) {
+        return false;
+    }
+
+    // add a note item to the tree
+    QTreeWidgetItem *noteItem = createNoteTreeWidgetItem(note);
+
     const QSignalBlocker blocker(ui->noteTreeWidget);
     Q_UNUSED(blocker)
 
     if (parent == nullptr) {
         // strange things happen if we insert with insertTopLevelItem
         ui->noteTreeWidget->addTopLevelItem(noteItem);
+
+        if (_noteTreeWidgetItemIndexEnabled) {
+            _noteTreeWidgetItems.insert(note.getId(), noteItem);
+        }
     } else {
         parent->addChild(noteItem);
     }
 
-    if (isNoteListPreview) {
-        updateNoteTreeWidgetItem(note, noteItem);
-    }
+    // a single item is decorated right away
+    decorateNoteTreeWidgetItem(note, noteItem);
 
     //    SettingsService settings;
     //    if (settings.value("notesPanelSort", SORT_BY_LAST_CHANGE).toInt() ==
@@ -2340,12 +2535,18 @@ void MainWindow::makeCurrentNoteFirstInNoteList() {
         const QSignalBlocker blocker(ui->noteTreeWidget);
         Q_UNUSED(blocker)
 
-        ui->noteTreeWidget->takeTopLevelItem(ui->noteTreeWidget->indexOfTopLevelItem(item));
-        ui->noteTreeWidget->insertTopLevelItem(0, item);
+        // while typing, the note is the first one already after the first keystroke
+        const bool isFirst = ui->noteTreeWidget->topLevelItem(0) == item;
+        if (!isFirst) {
+            ui->noteTreeWidget->takeTopLevelItem(ui->noteTreeWidget->indexOfTopLevelItem(item));
+            ui->noteTreeWidget->insertTopLevelItem(0, item);
+        }
 
         // set the item as current item if it is visible
         if (!item->isHidden()) {
-            ui->noteTreeWidget->setCurrentItem(item);
+            if (!isFirst || ui->noteTreeWidget->currentItem() != item) {
+                ui->noteTreeWidget->setCurrentItem(item);
+            }
 
             if (Utils::Misc::isNoteListPreview()) {
                 // ui->noteTreeWidget->setCurrentItem seems to destroy the
@@ -2373,11 +2574,19 @@ void MainWindow::makeCurrentNoteFirstInNoteList() {
 /**
  * Finds a note in the note tree widget and returns its item
  *
+ * In the note list this is a lookup in _noteTreeWidgetItems, which follows
+ * every insert and removal of a note item (moving or hiding an item keeps it).
+ *
  * @param note
  * @return
  */
 QTreeWidgetItem *MainWindow::findNoteInNoteTreeWidget(const Note &note) {
     const int noteId = note.getId();
+
+    if (_noteTreeWidgetItemIndexEnabled) {
+        return _noteTreeWidgetItems.value(noteId);
+    }
+
     const int count = ui->noteTreeWidget->topLevelItemCount();
 
     for (int i = 0; i < count; ++i) {
@@ -2598,6 +2807,11 @@ void MainWindow::restoreToolbars() {
 void MainWindow::readSettingsFromSettingsDialog(const bool isAppLaunch) {
     SettingsService settings;
 
+    _settingsSnapshot.reload();
+
+    // the scripts may have been changed
+    _noteTaggingHookResults.clear();
+
     this->notifyAllExternalModifications =
         settings.value(QStringLiteral("notifyAllExternalModifications")).toBool();
     this->noteSaveIntervalTime = settings.value(QStringLiteral("noteSaveIntervalTime"), 10).toInt();
@@ -2801,13 +3015,19 @@ void MainWindow::updateNoteTextFromDisk(Note note) {
 }
 
 void MainWindow::notesWereModified(const QString &str) {
+    // let the knowledge base of the AI assistant pick up the change, even if
+    // we are ignoring it below
+    if (!str.contains(QStringLiteral("/.git/"))) {
+        appendAiAssistantNoteEvent(str);
+    }
+
     // workaround when signal block doesn't work correctly
     if (_isNotesWereModifiedDisabled) {
         return;
     }
 
     // if we should ignore all changes return here
-    if (SettingsService().value(QStringLiteral("ignoreAllExternalNoteFolderChanges")).toBool()) {
+    if (_settingsSnapshot.values().ignoreAllExternalNoteFolderChanges) {
         return;
     }
 
@@ -2816,199 +3036,228 @@ void MainWindow::notesWereModified(const QString &str) {
         return;
     }
 
-    QFileInfo fi(str);
-    Note note = Note::fetchByFileUrl(QUrl::fromLocalFile(str));
-
     qDebug() << __func__ << " - 'str': " << str;
-    qDebug() << __func__ << " - 'note': " << note;
-    qDebug() << __func__ << " - 'currentNote': " << currentNote;
-
-    // load note from disk if current note was changed
-    if ((note.getFileName() == this->currentNote.getFileName()) &&
-        (note.getNoteSubFolderId() == this->currentNote.getNoteSubFolderId())) {
-        if (note.fileExists()) {
-            // If the modified date of the file is the same as the one
-            // from the current note it was a false alarm
-            if (fi.lastModified() == this->currentNote.getFileLastModified()) {
-                qDebug() << __func__ << " - Modification date didn't change, ignoring";
-                return;
-            }
+    queueNoteFolderChange(str, false);
+}
 
-            const QString oldNoteText = note.getNoteText();
+void MainWindow::notesDirectoryWasModified(const QString &str) {
+    if (!str.contains(QStringLiteral("/.git/"))) {
+        appendAiAssistantNoteEvent(str, true);
+    }
 
-            // fetch text of note from disk
-            note.updateNoteTextFromDisk();
-            const QString noteTextOnDisk = Utils::Misc::transformLineFeeds(note.getNoteText());
-            const bool isCurrentNoteNotEditedForAWhile =
-                this->currentNoteLastEdited.addSecs(60) < QDateTime::currentDateTime();
-            // If the current note wasn't edited for a while, we want that it is possible
-            // to get updated even with small changes, so we are setting a threshold of 0
-            const int threshold = isCurrentNoteNotEditedForAWhile ? 0 : 8;
+    // workaround when signal block doesn't work correctly
+    if (_isNotesDirectoryWasModifiedDisabled) {
+        return;
+    }
 
-            // Check if the old note text is the same or similar as the one on disk
-            if (Utils::Misc::isSimilar(oldNoteText, noteTextOnDisk, threshold)) {
-                qDebug() << __func__ << " - Old and new text are same or similar, ignoring";
-                return;
-            }
+    // if we should ignore all changes return here
+    if (_settingsSnapshot.values().ignoreAllExternalNoteFolderChanges) {
+        return;
+    }
 
-            const QString noteTextOnDiskHash = QString(
-                QCryptographicHash::hash(noteTextOnDisk.toLocal8Bit(), QCryptographicHash::Sha1)
-                    .toHex());
+    // We are ignoring changes in the .git folder
+    if (str.contains(QStringLiteral("/.git/"))) {
+        return;
+    }
 
-            // skip dialog if text of note file on disk and current note are
-            // equal
-            if (noteTextOnDiskHash == _currentNoteTextHash) {
-                qDebug() << __func__
-                         << " - Note text and _currentNoteTextHash are the same, ignoring";
-                return;
-            }
+    qDebug() << "notesDirectoryWasModified: " << str;
+    queueNoteFolderChange(str, true);
+}
 
-            // fetch current text
-            const QString noteTextEditText = this->ui->noteTextEdit->toPlainText();
+/**
+ * Checks if the file of the current note was changed or removed outside of
+ * the application and asks what to do about it
+ *
+ * A changed file is compared with the note text in a worker thread, see
+ * NoteChangeReconciler, only a conflict comes back to
+ * handleCurrentNoteExternalChange().
+ */
+void MainWindow::checkCurrentNoteForExternalChange() {
+    if (currentNote.getFileName().isEmpty()) {
+        return;
+    }
 
-            // skip dialog if text of note file on disk text from note text
-            // edit are equal or similar
-            if (Utils::Misc::isSimilar(noteTextEditText, noteTextOnDisk, threshold)) {
-                qDebug() << __func__ << " - Note text and text on disk are too similar, ignoring";
-                return;
-            }
+    const QString str = currentNote.fullNoteFilePath();
+    QFileInfo fi(str);
+    Note note = Note::fetchByFileUrl(QUrl::fromLocalFile(str));
 
-            showStatusBarMessage(tr("Current note was modified externally"), QStringLiteral("🔄"),
-                                 5000);
+    qDebug() << __func__ << " - 'note': " << note;
+    qDebug() << __func__ << " - 'currentNote': " << currentNote;
 
-            // if we don't want to get notifications at all
-            // external modifications check if we really need one
-            if (!this->notifyAllExternalModifications) {
-                // reloading the current note text straight away
-                // if we didn't change it for a minute
-                if (!this->currentNote.getHasDirtyData() && isCurrentNoteNotEditedForAWhile) {
-                    updateNoteTextFromDisk(std::move(note));
-                    return;
-                }
-            }
+    if ((note.getFileName() != this->currentNote.getFileName()) ||
+        (note.getNoteSubFolderId() != this->currentNote.getNoteSubFolderId())) {
+        return;
+    }
 
-            const int result = openNoteDiffDialog(note);
-            switch (result) {
-                // overwrite file with local changes
-                case NoteDiffDialog::Overwrite: {
-                    // disconnect the watcher before saving on disk
-                    FileWatchDisabler disable(this);
+    if (note.fileExists()) {
+        // If the modified date of the file is the same as the one
+        // from the current note it was a false alarm
+        if (fi.lastModified() == this->currentNote.getFileLastModified()) {
+            qDebug() << __func__ << " - Modification date didn't change, ignoring";
+            return;
+        }
 
-                    showStatusBarMessage(
-                        tr("Overwriting external changes of: %1").arg(currentNote.getFileName()),
-                        QStringLiteral("💾"), 3000);
+        // the file is compared again when the running check is done
+        if (_externalChangeWatcher->isRunning()) {
+            _externalChangeCheckPending = true;
+            return;
+        }
 
-                    // the note text has to be stored newly because the
-                    // external change is already in the note table entry
-                    currentNote.storeNewText(ui->noteTextEdit->toPlainText());
-                    currentNote.storeNoteTextFileToDisk();
-                } break;
+        const bool isCurrentNoteNotEditedForAWhile =
+            this->currentNoteLastEdited.addSecs(60) < QDateTime::currentDateTime();
+
+        NoteChangeReconciler::Snapshot snapshot;
+        snapshot.noteId = currentNote.getId();
+        snapshot.filePath = str;
+        snapshot.storedText = note.getNoteText();
+        snapshot.noteTextHash = _currentNoteTextHash;
+        // If the current note wasn't edited for a while, we want that it is possible
+        // to get updated even with small changes, so we are setting a threshold of 0
+        snapshot.threshold = isCurrentNoteNotEditedForAWhile ? 0 : 8;
+
+        // the text edit has the note text as long as it wasn't edited since
+        // the text was stored, see noteTextEditTextWasUpdated()
+        snapshot.editorText = ui->noteTextEdit->document()->revision() == _noteTextStoredRevision
+                                  ? currentNote.getNoteText()
+                                  : ui->noteTextEdit->toPlainText();
+
+        _externalChangeWatcher->setFuture(
+            QtConcurrent::run(&NoteChangeReconciler::reconcile, snapshot));
+    } else if (_noteExternallyRemovedCheckEnabled && (currentNote.getNoteSubFolderId() == 0)) {
+        // only allow the check if current note was removed externally in
+        // the root note folder, because it gets triggered every time
+        // a note gets renamed in subfolders
+
+        qDebug() << "Current note was removed externally!";
+
+        if (Utils::Gui::questionNoSkipOverride(
+                this, tr("Note was removed externally!"),
+                tr("Current note was removed outside of this application!\n"
+                   "Restore current note?"),
+                QStringLiteral("restore-note")) == QMessageBox::Yes) {
+            const QSignalBlocker blocker(this->noteDirectoryWatcher);
+            Q_UNUSED(blocker)
 
-                // reload note file from disk
-                case NoteDiffDialog::Reload:
-                    showStatusBarMessage(
-                        tr("Loading external changes from: %1").arg(currentNote.getFileName()),
-                        QStringLiteral("🔄"), 3000);
-                    updateNoteTextFromDisk(note);
-                    break;
+            QString text = this->ui->noteTextEdit->toPlainText();
+            note.storeNewText(std::move(text));
 
-                    //                case NoteDiffDialog::Cancel:
-                    //                case NoteDiffDialog::Ignore:
-                default:
-                    // do nothing
-                    break;
-            }
-        } else if (_noteExternallyRemovedCheckEnabled && (currentNote.getNoteSubFolderId() == 0)) {
-            // only allow the check if current note was removed externally in
-            // the root note folder, because it gets triggered every time
-            // a note gets renamed in subfolders
-
-            qDebug() << "Current note was removed externally!";
-
-            if (Utils::Gui::questionNoSkipOverride(
-                    this, tr("Note was removed externally!"),
-                    tr("Current note was removed outside of this application!\n"
-                       "Restore current note?"),
-                    QStringLiteral("restore-note")) == QMessageBox::Yes) {
-                const QSignalBlocker blocker(this->noteDirectoryWatcher);
-                Q_UNUSED(blocker)
-
-                QString text = this->ui->noteTextEdit->toPlainText();
-                note.storeNewText(std::move(text));
-
-                // store note to disk again
-                const bool noteWasStored = note.storeNoteTextFileToDisk();
-                showStatusBarMessage(noteWasStored ? tr("Stored current note to disk")
-                                                   : tr("Current note could not be stored to disk"),
-                                     noteWasStored ? QStringLiteral("💾") : QStringLiteral("❌"),
-                                     3000);
+            // store note to disk again
+            const bool noteWasStored = note.storeNoteTextFileToDisk();
+            showStatusBarMessage(noteWasStored ? tr("Stored current note to disk")
+                                               : tr("Current note could not be stored to disk"),
+                                 noteWasStored ? QStringLiteral("💾") : QStringLiteral("❌"),
+                                 3000);
 
-                // rebuild and reload the notes directory list
-                buildNotesIndexAndLoadNoteDirectoryList();
+            // rebuild and reload the notes directory list
+            buildNotesIndexAndLoadNoteDirectoryList();
 
-                // fetch note new (because all the IDs have changed
-                // after the buildNotesIndex()
-                note.refetch();
+            // fetch note new (because all the IDs have changed
+            // after the buildNotesIndex()
+            note.refetch();
 
-                // restore old selected row (but don't update the note text)
-                setCurrentNote(note, false);
-            } else {
-                // rebuild and reload the notes directory list
-                buildNotesIndexAndLoadNoteDirectoryList();
+            // restore old selected row (but don't update the note text)
+            setCurrentNote(note, false);
+        } else {
+            // rebuild and reload the notes directory list
+            buildNotesIndexAndLoadNoteDirectoryList();
 
-                resetCurrentNote(true);
-            }
+            resetCurrentNote(true);
         }
-    } else {
-        qDebug() << "other note was changed: " << str;
-
-        showStatusBarMessage(tr("Note was modified externally: %1").arg(str), QStringLiteral("🔄"),
-                             5000);
-
-        // rebuild and reload the notes directory list
-        buildNotesIndexAndLoadNoteDirectoryList();
-        setCurrentNote(std::move(this->currentNote), false);
     }
 }
 
-void MainWindow::notesDirectoryWasModified(const QString &str) {
-    // workaround when signal block doesn't work correctly
-    if (_isNotesDirectoryWasModifiedDisabled) {
+/**
+ * Collects the result of the comparison started by checkCurrentNoteForExternalChange()
+ */
+void MainWindow::externalChangeCheckFinished() {
+    const NoteChangeReconciler::Result result = _externalChangeWatcher->result();
+
+    // the file was changed again meanwhile, only the newest state counts
+    if (_externalChangeCheckPending) {
+        _externalChangeCheckPending = false;
+        checkCurrentNoteForExternalChange();
         return;
     }
 
-    // if we should ignore all changes return here
-    if (SettingsService().value(QStringLiteral("ignoreAllExternalNoteFolderChanges")).toBool()) {
+    if (result.noteId != currentNote.getId()) {
         return;
     }
 
-    // We are ignoring changes in the .git folder
-    if (str.contains(QStringLiteral("/.git/"))) {
-        return;
+    switch (result.verdict) {
+        case NoteChangeReconciler::Unchanged:
+            qDebug() << __func__ << " - Note text and text on disk are the same, ignoring";
+            return;
+        case NoteChangeReconciler::Similar:
+            qDebug() << __func__ << " - Note text and text on disk are too similar, ignoring";
+            return;
+        case NoteChangeReconciler::Unreadable:
+            return;
+        case NoteChangeReconciler::Conflict:
+            break;
     }
 
-    qDebug() << "notesDirectoryWasModified: " << str;
-    showStatusBarMessage(tr("Notes directory was modified externally"), QStringLiteral("🔄"), 5000);
+    handleCurrentNoteExternalChange();
+}
 
-    // rebuild and reload the notes directory list
-    buildNotesIndexAndLoadNoteDirectoryList();
+/**
+ * Reloads the current note or asks what to do about the external change of
+ * its file, which differs too much from the note text
+ */
+void MainWindow::handleCurrentNoteExternalChange() {
+    Note note = Note::fetchByFileUrl(QUrl::fromLocalFile(currentNote.fullNoteFilePath()));
+    if (!note.isFetched()) {
+        return;
+    }
 
-    // check if the current note was modified
-    // this fixes not detected external note changes of the current note if the
-    // event for the change in the current note comes after the event that the
-    // note folder was modified
-    QString noteFileName = currentNote.getFileName();
-    if (!noteFileName.isEmpty()) {
-        // Use the full path, like a filesystem watcher would, instead of just the file-name
-        notesWereModified(currentNote.fullNoteFilePath());
+    // fetch text of note from disk
+    note.updateNoteTextFromDisk();
+    const bool isCurrentNoteNotEditedForAWhile =
+        this->currentNoteLastEdited.addSecs(60) < QDateTime::currentDateTime();
+
+    showStatusBarMessage(tr("Current note was modified externally"), QStringLiteral("🔄"), 5000);
+
+    // if we don't want to get notifications at all
+    // external modifications check if we really need one
+    if (!this->notifyAllExternalModifications) {
+        // reloading the current note text straight away
+        // if we didn't change it for a minute
+        if (!this->currentNote.getHasDirtyData() && isCurrentNoteNotEditedForAWhile) {
+            updateNoteTextFromDisk(std::move(note));
+            return;
+        }
     }
 
-    // also update the text of the text edit if current note has changed
-    bool updateNoteText = !this->currentNote.exists();
-    qDebug() << "updateNoteText: " << updateNoteText;
+    const int result = openNoteDiffDialog(note);
+    switch (result) {
+        // overwrite file with local changes
+        case NoteDiffDialog::Overwrite: {
+            // disconnect the watcher before saving on disk
+            FileWatchDisabler disable(this);
 
-    // restore old selected row (but don't update the note text)
-    setCurrentNote(std::move(this->currentNote), updateNoteText);
+            showStatusBarMessage(
+                tr("Overwriting external changes of: %1").arg(currentNote.getFileName()),
+                QStringLiteral("💾"), 3000);
+
+            // the note text has to be stored newly because the
+            // external change is already in the note table entry
+            currentNote.storeNewText(ui->noteTextEdit->toPlainText());
+            currentNote.storeNoteTextFileToDisk();
+        } break;
+
+        // reload note file from disk
+        case NoteDiffDialog::Reload:
+            showStatusBarMessage(
+                tr("Loading external changes from: %1").arg(currentNote.getFileName()),
+                QStringLiteral("🔄"), 3000);
+            updateNoteTextFromDisk(note);
+            break;
+
+            //                case NoteDiffDialog::Cancel:
+            //                case NoteDiffDialog::Ignore:
+        default:
+            // do nothing
+            break;
+    }
 }
 
 /**
@@ -3035,6 +3284,10 @@ void MainWindow::autoReadOnlyModeTimerSlot() {
 }
 
 void MainWindow::storeUpdatedNotesToDisk() {
+    // a background write of the current note has to be on disk before we
+    // write the note again
+    _noteWriteQueue->waitForFinished();
+
     // disconnect the watcher before saving on disk
     FileWatchDisabler disable(this);
 
@@ -3047,6 +3300,17 @@ void MainWindow::storeUpdatedNotesToDisk() {
     bool noteWasRenamed = false;
     bool currentNoteTextChanged = false;
 
+    // the notes whose links have to be parsed again
+    QVector<int> dirtyNoteIds;
+    QSqlQuery query(QSqlDatabase::database(QStringLiteral("memory")));
+    query.setForwardOnly(true);
+    if (query.exec(QStringLiteral("SELECT id FROM note WHERE has_dirty_data = 1"))) {
+        while (query.next()) {
+            dirtyNoteIds << query.value(0).toInt();
+        }
+    }
+    query.finish();
+
     // currentNote will be set by this method if the filename has changed
     const int count = Note::storeDirtyNotesToDisk(currentNote, &currentNoteChanged, &noteWasRenamed,
                                                   &currentNoteTextChanged);
@@ -3054,6 +3318,11 @@ void MainWindow::storeUpdatedNotesToDisk() {
     if (count > 0) {
         _noteViewNeedsUpdate = true;
 
+        // a note rename can also change the links in other notes and the
+        // renamed note is gone under its old path, which only a full update
+        // notices
+        NoteLinkIndex::update(noteWasRenamed ? QVector<int>() : dirtyNoteIds);
+
         MetricsService::instance()->sendEventIfEnabled(
             QStringLiteral("note/notes/stored"), QStringLiteral("note"),
             QStringLiteral("notes stored"), QString::number(count) + QStringLiteral(" notes"),
@@ -3064,9 +3333,16 @@ void MainWindow::storeUpdatedNotesToDisk() {
         showStatusBarMessage(tr("Stored %n note(s) to disk", "", count), QStringLiteral("💾"),
                              3000);
 
+        // our own writes don't reach notesWereModified because the watcher is disabled
+        if (noteWasRenamed) {
+            appendAiAssistantNoteEvent(currentNote.fullNoteFileDirPath(), true);
+        } else if (currentNoteChanged) {
+            appendAiAssistantNoteEvent(currentNote.fullNoteFilePath());
+        }
+
         if (currentNoteChanged) {
             // strip trailing spaces of the current note (if enabled)
-            if (SettingsService().value(QStringLiteral("Editor/removeTrailingSpaces")).toBool()) {
+            if (_settingsSnapshot.values().removeTrailingSpaces) {
                 const bool wasStripped =
                     currentNote.stripTrailingSpaces(activeNoteTextEdit()->textCursor().position());
 
@@ -3112,35 +3388,176 @@ void MainWindow::storeUpdatedNotesToDisk() {
 }
 
 /**
- * Shows alerts for calendar items with an alarm date in the current minute
- * Also checks for expired note crypto keys
+ * Stores the dirty notes on the note save timer
+ *
+ * While typing only the text of the current note changes, then its file is
+ * written by _noteWriteQueue and the GUI thread doesn't wait for the disk.
+ * Everything else (several dirty notes, a note that has to be renamed,
+ * trailing spaces to strip, ...) goes through storeUpdatedNotesToDisk().
  */
-void MainWindow::frequentPeriodicChecker() {
-    CalendarItem::alertTodoReminders();
-    Note::expireCryptoKeys();
+void MainWindow::storeUpdatedNotesToDiskInBackground() {
+    if (_noteWriteQueue->isBusy()) {
+        return;
+    }
 
-    if (QDateTime::currentDateTime().addSecs(-1200) >= _lastHeartbeat) {
-        _lastHeartbeat = QDateTime::currentDateTime();
-        MetricsService::instance()->sendHeartbeat();
+    QSqlQuery query(QSqlDatabase::database(QStringLiteral("memory")));
+    query.setForwardOnly(true);
+    if (!query.exec(QStringLiteral("SELECT id FROM note WHERE has_dirty_data = 1 LIMIT 2"))) {
+        storeUpdatedNotesToDisk();
+        return;
     }
 
-    SettingsService settings;
-    QDateTime lastUpdateCheck = settings.value(QStringLiteral("LastUpdateCheck")).toDateTime();
-    if (!lastUpdateCheck.isValid()) {
-        // set the LastUpdateCheck if it wasn't set
-        settings.setValue(QStringLiteral("LastUpdateCheck"), QDateTime::currentDateTime());
-    } else if (lastUpdateCheck.addSecs(3600) <= QDateTime::currentDateTime()) {
-        // check for updates every 1h
-        updateService->checkForUpdates(UpdateService::Periodic);
+    QVector<int> noteIds;
+    while (query.next()) {
+        noteIds << query.value(0).toInt();
+    }
 
-        // expire trashed items
-        TrashItem::expireItems();
+    if (noteIds.isEmpty()) {
+        return;
     }
-}
 
-/**
- * Does the setup the status bar widgets
- */
+    const Note note = Note::fetch(noteIds.constFirst());
+    const QString filePath = note.fullNoteFilePath();
+
+    // Note::storeNoteTextFileToDisk() decides about renaming the file, this
+    // path must never skip a rename: only a note whose headline still is its
+    // name goes here, not if the note name hook or a front matter title could
+    // make another name (with Note::allowDifferentFileName() there is no
+    // rename in that case either)
+    static const QRegularExpression headlinePrefix(QStringLiteral(R"(^#+\s+)"));
+    const QString noteText = note.getNoteText();
+    const QString headline =
+        noteText.section(QLatin1Char('\n'), 0, 0).remove(headlinePrefix).trimmed();
+    const bool mayBeRenamed = headline != note.getName() ||
+                              noteText.startsWith(QLatin1String("---")) ||
+                              ScriptingService::instance()->handleNoteNameHookExists();
+
+    if (noteIds.size() > 1 || note.getId() != currentNote.getId() || !QFile::exists(filePath) ||
+        mayBeRenamed || _settingsSnapshot.values().removeTrailingSpaces) {
+        storeUpdatedNotesToDisk();
+        return;
+    }
+
+    NoteWriteQueue::Write write;
+    write.noteId = note.getId();
+    write.noteText = noteText;
+    write.filePath = filePath;
+    write.data = write.noteText.toUtf8();
+
+#ifdef Q_OS_WIN
+    // the line endings Note::storeNoteTextFileToDisk() gets from the text mode
+    if (!SettingsService().value(QStringLiteral("useUNIXNewline")).toBool()) {
+        write.data.replace("\n", "\r\n");
+    }
+#endif
+
+    // the temporary file is renamed over the note file, that drops its watch
+    _noteWriteWasWatched = noteDirectoryWatcher.files().contains(filePath);
+    _noteWriteQueue->enqueue({write});
+}
+
+/**
+ * Marks the notes that were written in the background as stored
+ */
+void MainWindow::noteWritesFinished(const QVector<NoteWriteQueue::Write> &writes) {
+    QVector<int> noteIds;
+    bool currentNoteWritten = false;
+
+    for (const NoteWriteQueue::Write &write : writes) {
+        if (!write.written) {
+            continue;
+        }
+
+        // a synchronous store after the write, e.g. storeUpdatedNotesToDisk()
+        // waits for the write but this slot runs later, already put newer
+        // data into the database
+        const QFileInfo fileInfo(write.filePath);
+        if (fileInfo.size() != write.fileSize ||
+            fileInfo.lastModified() != write.fileLastModified) {
+            continue;
+        }
+
+        // the note stays dirty if it was changed again while it was written
+        QSqlQuery query(QSqlDatabase::database(QStringLiteral("memory")));
+        query.prepare(
+            QStringLiteral("UPDATE note SET file_size = :size, file_last_modified = :modified, "
+                           "has_dirty_data = CASE WHEN note_text = :text THEN 0 "
+                           "ELSE has_dirty_data END WHERE id = :id"));
+        query.bindValue(QStringLiteral(":size"), write.fileSize);
+        query.bindValue(QStringLiteral(":modified"), write.fileLastModified);
+        query.bindValue(QStringLiteral(":text"), write.noteText);
+        query.bindValue(QStringLiteral(":id"), write.noteId);
+
+        if (!query.exec()) {
+            qWarning() << __func__ << ": " << query.lastError();
+            continue;
+        }
+
+        if (_noteWriteWasWatched && !noteDirectoryWatcher.files().contains(write.filePath)) {
+            noteDirectoryWatcher.addPath(write.filePath);
+        }
+
+        // the watchers are connected, but our own writes are dropped in
+        // processNoteFolderChanges()
+        appendAiAssistantNoteEvent(write.filePath);
+
+        currentNoteWritten |= write.noteId == currentNote.getId();
+        noteIds << write.noteId;
+    }
+
+    const int count = noteIds.size();
+    if (count == 0) {
+        return;
+    }
+
+    _noteViewNeedsUpdate = true;
+    NoteLinkIndex::update(noteIds);
+
+    MetricsService::instance()->sendEventIfEnabled(
+        QStringLiteral("note/notes/stored"), QStringLiteral("note"), QStringLiteral("notes stored"),
+        QString::number(count) + QStringLiteral(" notes"), count);
+
+    showStatusBarMessage(tr("Stored %n note(s) to disk", "", count), QStringLiteral("💾"), 3000);
+
+    if (currentNoteWritten) {
+        // checkCurrentNoteForExternalChange() compares the file modification date
+        currentNote.refetch();
+        updateCurrentNoteTextHash();
+    }
+
+    updateNoteGraphicsView();
+}
+
+/**
+ * Shows alerts for calendar items with an alarm date in the current minute
+ * Also checks for expired note crypto keys
+ */
+void MainWindow::frequentPeriodicChecker() {
+    CalendarItem::alertTodoReminders();
+    Note::expireCryptoKeys();
+
+    if (QDateTime::currentDateTime().addSecs(-1200) >= _lastHeartbeat) {
+        _lastHeartbeat = QDateTime::currentDateTime();
+        MetricsService::instance()->sendHeartbeat();
+    }
+
+    SettingsService settings;
+    QDateTime lastUpdateCheck = settings.value(QStringLiteral("LastUpdateCheck")).toDateTime();
+    if (!lastUpdateCheck.isValid()) {
+        // set the LastUpdateCheck if it wasn't set
+        settings.setValue(QStringLiteral("LastUpdateCheck"), QDateTime::currentDateTime());
+    } else if (lastUpdateCheck.addSecs(3600) <= QDateTime::currentDateTime()) {
+        // check for updates every 1h
+        updateService->checkForUpdates(UpdateService::Periodic);
+
+        // expire trashed items
+        TrashItem::expireItems();
+    }
+}
+
+/**
+ * Does the setup the status bar widgets
+ */
 void MainWindow::setupStatusBarWidgets() {
     /*
      * setup of file path label
@@ -3212,336 +3629,1136 @@ void MainWindow::showUpdateAvailableButton(const QString &version) {
 
 void MainWindow::hideUpdateAvailableButton() { _updateAvailableButton->hide(); }
 
+namespace {
+/**
+ * One directory of the note folder, filled by the parallel enumeration stage
+ * of MainWindow::buildNotesIndex()
+ */
+struct NoteIndexDir {
+    QString relativePath;    // empty for the root of the scan
+    QString name;
+    int parent = -1;         // index into the directory list
+    int noteSubFolderId = 0;
+    QFileInfoList files;     // newest first
+    QStringList subFolders;
+};
+
+/**
+ * One note file, compared against the database by the parallel read stage
+ */
+struct NoteIndexFile {
+    int dir = 0;
+    QString fileName;        // relative to the note folder, as used by Note
+    QString filePath;
+    qint64 size = 0;
+    QDateTime created;
+    QDateTime lastModified;
+    int noteId = 0;          // 0 if the database doesn't know the file yet
+    bool needsRead = true;   // fingerprint differs from the manifest
+    bool changed = true;     // has to be written to the database
+    bool dbChanged = true;   // the database test, used if there is no manifest entry
+    QByteArray previousHash;
+    QByteArray hash;         // MD5 of the file, only for files that were read
+    QString text;            // only for changed files, until they are written
+};
+
+/**
+ * Fingerprint of one note file in the note index manifest
+ */
+struct NoteIndexManifestEntry {
+    qint64 size = 0;
+    qint64 lastModified = 0;    // msecs since epoch
+    QByteArray hash;
+};
+typedef QHash<QString, NoteIndexManifestEntry> NoteIndexManifest;
+
+const quint32 noteIndexManifestMagic = 0x514e4d31;    // "QNM1"
+
+/**
+ * The manifest is local to this machine (mtimes differ between synced copies),
+ * so it lives in the app data folder and not in the note folder
+ */
+QString noteIndexManifestPath() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) +
+           QStringLiteral("/note-index/") + QString::number(NoteFolder::currentNoteFolderId()) +
+           QStringLiteral(".manifest");
+}
+
+NoteIndexManifest loadNoteIndexManifest() {
+    NoteIndexManifest manifest;
+    QFile file(noteIndexManifestPath());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return manifest;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_12);
+    quint32 magic = 0;
+    quint32 count = 0;
+    in >> magic >> count;
+    if (magic != noteIndexManifestMagic) {
+        return manifest;
+    }
+
+    manifest.reserve(int(count));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString fileName;
+        NoteIndexManifestEntry entry;
+        in >> fileName >> entry.size >> entry.lastModified >> entry.hash;
+        manifest.insert(fileName, entry);
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "Ignoring damaged note index manifest: " << file.fileName();
+        manifest.clear();
+    }
+    return manifest;
+}
+
+bool saveNoteIndexManifest(const NoteIndexManifest &manifest) {
+    const QString path = noteIndexManifestPath();
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << noteIndexManifestMagic << quint32(manifest.size());
+    for (auto it = manifest.constBegin(); it != manifest.constEnd(); ++it) {
+        out << it.key() << it->size << it->lastModified << it->hash;
+    }
+    return file.commit();
+}
+
+/**
+ * Database state of one note, enough to decide if its file has to be read
+ */
+struct NoteIndexRow {
+    int id = 0;
+    qint64 fileSize = 0;
+    QDateTime modified;
+};
+
+QString noteIndexKey(int noteSubFolderId, const QString &fileName) {
+    return QString::number(noteSubFolderId) + QLatin1Char('/') + fileName;
+}
+
+/**
+ * Runs a concurrent stage while the progress dialog (and the event loop) stay alive
+ *
+ * @return false if the user canceled
+ */
+bool waitForNotesIndexStage(QFuture<void> future, QProgressDialog &progress,
+                            int progressOffset = 0) {
+    QFutureWatcher<void> watcher;
+    QEventLoop loop;
+    QObject::connect(&watcher, &QFutureWatcher<void>::finished, &loop, &QEventLoop::quit);
+    QObject::connect(&watcher, &QFutureWatcher<void>::progressValueChanged, &progress,
+                     [&progress, progressOffset](int value) {
+                         progress.setValue(progressOffset + value);
+                     });
+    QObject::connect(&progress, &QProgressDialog::canceled, &watcher,
+                     &QFutureWatcher<void>::cancel);
+    watcher.setFuture(future);
+    if (!future.isFinished()) {
+        loop.exec(QEventLoop::ExcludeSocketNotifiers);
+    }
+    return !future.isCanceled() && !progress.wasCanceled();
+}
+
+/**
+ * Reads and hashes a note file in the parallel stage of buildNotesIndex()
+ *
+ * A file with a hash from the note index manifest isn't hashed again. The
+ * text is only kept if the note has to be written, decoded the way
+ * Note::createFromFile() does it, so the writer doesn't open the file again
+ */
+void readNoteIndexFile(NoteIndexFile &file) {
+    if (!file.needsRead) {
+        return;
+    }
+
+    QFile f(file.filePath);
+    if (!f.open(QIODevice::ReadOnly)) {
+        // keep what the database has, the next run tries again
+        file.changed = false;
+        return;
+    }
+    const QByteArray data = f.readAll();
+    if (file.hash.isEmpty()) {
+        file.hash = QCryptographicHash::hash(data, QCryptographicHash::Md5);
+    }
+
+    if (file.noteId != 0) {
+        if (file.previousHash.isEmpty()) {
+            // not in the manifest yet (first run), trust the database
+            file.changed = file.dbChanged;
+        } else {
+            // touched, but the content is the same
+            file.changed = file.hash != file.previousHash;
+        }
+    }
+
+    if (file.changed) {
+        file.text = QString::fromUtf8(data);
+        file.text.replace(QStringLiteral("\r\n"), QStringLiteral("\n"));
+    }
+}
+
+/**
+ * Returns true if a note text contains encrypted text, Note::store() keeps
+ * more state for those than storeNoteIndexFile() writes
+ */
+bool isEncryptedNoteText(const QString &text) {
+    return text.contains(QLatin1String("<!-- BEGIN ENCRYPTED TEXT --"));
+}
+
+/**
+ * Writes a note file the parallel stage read to the note table
+ *
+ * Stores the fields Note::createFromFile() stores, without reading the file
+ * a second time. What Note::store() does besides that is left out on purpose:
+ * - note_sub_folder_id comes from stage 1, which fetched or created the note
+ *   subfolder rows, so there is nothing to look up
+ * - created is only set for new rows and modified is always now, like store()
+ * - the share and crypto columns are not touched, an update keeps them and
+ *   a new row gets their defaults, like a new Note
+ * - encrypted notes don't come here (the cached decrypted text would go
+ *   stale), see isEncryptedNoteText()
+ *
+ * @return the id of the note, 0 if it couldn't be stored
+ */
+int storeNoteIndexFile(const NoteIndexFile &file, int noteSubFolderId) {
+    const QDateTime now = QDateTime::currentDateTime();
+    QSqlQuery query(QSqlDatabase::database(QStringLiteral("memory")));
+
+    if (file.noteId != 0) {
+        query.prepare(
+            QStringLiteral("UPDATE note SET note_text = :text, file_size = :size, "
+                           "file_created = :fileCreated, file_last_modified = :fileModified, "
+                           "has_dirty_data = 0, modified = :modified WHERE id = :id"));
+        query.bindValue(QStringLiteral(":id"), file.noteId);
+    } else {
+        // a nicer name without the extension
+        const QString fileName = QFileInfo(file.filePath).fileName();
+        query.prepare(QStringLiteral(
+            "INSERT INTO note (name, file_name, note_sub_folder_id, note_text, file_size, "
+            "file_created, file_last_modified, has_dirty_data, created, modified) "
+            "VALUES (:name, :fileName, :noteSubFolderId, :text, :size, :fileCreated, "
+            ":fileModified, 0, :created, :modified)"));
+        query.bindValue(QStringLiteral(":name"),
+                        fileName.left(fileName.lastIndexOf(QLatin1Char('.'))));
+        query.bindValue(QStringLiteral(":fileName"), fileName);
+        query.bindValue(QStringLiteral(":noteSubFolderId"), noteSubFolderId);
+        query.bindValue(QStringLiteral(":created"), now);
+    }
+
+    query.bindValue(QStringLiteral(":text"), file.text);
+    query.bindValue(QStringLiteral(":size"), file.size);
+    query.bindValue(QStringLiteral(":fileCreated"), file.created);
+    query.bindValue(QStringLiteral(":fileModified"), file.lastModified);
+    query.bindValue(QStringLiteral(":modified"), now);
+
+    if (!query.exec()) {
+        qWarning() << __func__ << ": " << query.lastError();
+        return 0;
+    }
+
+    return file.noteId != 0 ? file.noteId : query.lastInsertId().toInt();
+}
+
+// watcher events are collected until the note folder was quiet for this long
+const int noteFolderChangeDebounce = 250;
+// but a constant stream of events still gets processed this often
+const int noteFolderChangeMaxDelay = 2000;
+// more touched paths than this and one (manifest backed) index run is cheaper
+const int noteFolderChangeDeltaLimit = 500;
+}    // namespace
+
 /**
  * Builds the index of notes and note sub folders
+ *
+ * The work is split into stages so a large note folder uses all cores and
+ * the UI keeps painting:
+ *   1. directory enumeration, one level of subfolders at a time in parallel
+ *   2. reading and hashing of the files whose size or mtime differs from the
+ *      note index manifest, in parallel; a file whose hash didn't change is
+ *      not written to the database again
+ *   3. one writer on the GUI thread (the database connection lives here)
+ *      that stores the texts read in stage 2 in batched transactions
+ * Stages 2 and 3 alternate slice by slice, so the texts of a large note
+ * folder are never all in memory at once.
+ *   4. set-based reconciliation of removed notes and note subfolders
  */
 bool MainWindow::buildNotesIndex(int noteSubFolderId, bool forceRebuild) {
-    QString notePath = Utils::Misc::removeIfEndsWith(this->notesPath, QDir::separator());
+    // the nested event loop below could start a second run
+    if (_buildingNotesIndex) {
+        return false;
+    }
+    _buildingNotesIndex = true;
+    const QScopeGuard resetBuilding([this] { _buildingNotesIndex = false; });
+
+    const QString notePath = Utils::Misc::removeIfEndsWith(this->notesPath, QDir::separator());
     NoteSubFolder noteSubFolder;
-    bool hasNoteSubFolder = false;
+    const bool hasNoteSubFolder = noteSubFolderId != 0;
     bool wasModified = false;
+    QSet<int> beforeNoteIds;
+    QSet<int> beforeNoteSubFolderIds;
+    QSet<int> afterNoteIds;
+    QSet<int> afterNoteSubFolderIds;
 
-    if (noteSubFolderId == 0) {
+    if (!hasNoteSubFolder) {
         qDebug() << __func__ << " - 'noteSubFolderId': " << noteSubFolderId;
 
-        // make sure we destroy nothing
-        storeUpdatedNotesToDisk();
+        // make sure we destroy nothing
+        storeUpdatedNotesToDisk();
+
+        // init the sets to check for removed items
+        const QVector<int> noteIds = Note::fetchAllIds();
+        const QVector<int> noteSubFolderIds = NoteSubFolder::fetchAllIds();
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
+        beforeNoteIds = QSet<int>(noteIds.begin(), noteIds.end());
+        beforeNoteSubFolderIds = QSet<int>(noteSubFolderIds.begin(), noteSubFolderIds.end());
+#else
+        beforeNoteIds = noteIds.toList().toSet();
+        beforeNoteSubFolderIds = noteSubFolderIds.toList().toSet();
+#endif
+    } else {
+        noteSubFolder = NoteSubFolder::fetch(noteSubFolderId);
+
+        if (!noteSubFolder.isFetched()) {
+            return false;
+        }
+    }
+
+    // get the current crypto key to set it again
+    // after all notes were read again
+    const qint64 cryptoKey = currentNote.getCryptoKey();
+    const QString cryptoPassword = currentNote.getCryptoPassword();
+
+    if (!hasNoteSubFolder && forceRebuild) {
+        // first delete all notes and note sub folders in the database if a
+        // rebuild was forced
+        Note::deleteAll();
+        NoteSubFolder::deleteAll();
+    }
+
+    QProgressDialog progress(tr("Loading notes…"), tr("Abort"), 0, 0, this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setMinimumDuration(500);
+
+    // only show certain files
+    const QStringList filters = Note::noteFileExtensionList(QStringLiteral("*."));
+    const bool showSubfolders = NoteFolder::isCurrentHasSubfolders();
+
+    // stage 1: enumerate the directory tree, every level in parallel
+    QVector<NoteIndexDir> dirs(1);
+    dirs[0].relativePath = hasNoteSubFolder ? noteSubFolder.relativePath() : QString();
+    dirs[0].noteSubFolderId = noteSubFolderId;
+
+    const auto scanDir = [notePath, filters, showSubfolders](NoteIndexDir &dir) {
+        const QDir qDir(dir.relativePath.isEmpty()
+                            ? notePath
+                            : notePath + QDir::separator() + dir.relativePath);
+        // show the newest entry first
+        dir.files = qDir.entryInfoList(filters, QDir::Files, QDir::Time);
+        if (showSubfolders) {
+            dir.subFolders =
+                qDir.entryList(QDir::Dirs | QDir::Hidden | QDir::NoDotAndDotDot, QDir::Time);
+        }
+    };
+
+    // existing note subfolders by "<parent id>/<name>"
+    QHash<QString, int> noteSubFolderIdsByName;
+    if (showSubfolders) {
+        const auto noteSubFolders = NoteSubFolder::fetchAll();
+        for (const NoteSubFolder &folder : noteSubFolders) {
+            noteSubFolderIdsByName.insert(noteIndexKey(folder.getParentId(), folder.getName()),
+                                          folder.getId());
+        }
+    }
+
+    int levelBegin = 0;
+    bool canceled = false;
+    while (levelBegin < dirs.size() && !canceled) {
+        const int levelEnd = dirs.size();
+        QVector<NoteIndexDir> level = dirs.mid(levelBegin, levelEnd - levelBegin);
+        canceled = !waitForNotesIndexStage(QtConcurrent::map(level, scanDir), progress);
+        std::copy(level.begin(), level.end(), dirs.begin() + levelBegin);
+
+        // note subfolders are created here, parents before their children
+        for (int i = levelBegin; i < levelEnd && !canceled; ++i) {
+            // copied, appending to dirs below may reallocate it
+            const QStringList subFolders = dirs[i].subFolders;
+            for (const QString &folder : subFolders) {
+                if (NoteSubFolder::willFolderBeIgnored(folder)) {
+                    continue;
+                }
+
+                // fetch or create the parent note sub folder
+                const QString key = noteIndexKey(dirs[i].noteSubFolderId, folder);
+                int id = noteSubFolderIdsByName.value(key);
+                if (id == 0) {
+                    NoteSubFolder parentNoteSubFolder;
+                    parentNoteSubFolder.setName(folder);
+                    parentNoteSubFolder.setParentId(dirs[i].noteSubFolderId);
+                    parentNoteSubFolder.store();
+                    if (!parentNoteSubFolder.isFetched()) {
+                        continue;
+                    }
+                    id = parentNoteSubFolder.getId();
+                    noteSubFolderIdsByName.insert(key, id);
+                    wasModified = true;
+                }
+
+                // add the note subfolder id to in the end check if note
+                // subfolders need to be removed
+                afterNoteSubFolderIds << id;
+
+                NoteIndexDir child;
+                child.name = folder;
+                child.parent = i;
+                child.noteSubFolderId = id;
+                child.relativePath = dirs[i].relativePath.isEmpty()
+                                         ? folder
+                                         : dirs[i].relativePath + QDir::separator() + folder;
+                dirs << child;
+            }
+        }
+        levelBegin = levelEnd;
+    }
+
+    QStringList rootFiles;
+    for (const QFileInfo &info : Utils::asConst(dirs[0].files)) {
+        rootFiles << info.fileName();
+    }
+    Note::applyIgnoredNotesSetting(rootFiles);
+    bool createDemoNotes = !canceled && rootFiles.isEmpty() && !hasNoteSubFolder;
+
+    if (createDemoNotes) {
+        SettingsService settings;
+        // check if we already have created the demo notes once
+        createDemoNotes = !settings.value(QStringLiteral("demoNotesCreated")).toBool();
+
+        if (createDemoNotes) {
+            // we don't want to create the demo notes again
+            settings.setValue(QStringLiteral("demoNotesCreated"), true);
+        }
+    }
+
+    // add some notes if there aren't any, and we haven't already created them once
+    if (createDemoNotes) {
+        qDebug() << "No notes! We will add some...";
+        const QStringList filenames =
+            QStringList({"Markdown Cheatsheet.md", "Welcome to QOwnNotes.md"});
+
+        // copy note files to the notes path
+        for (const auto &filename : filenames) {
+            const QString destinationFile = this->notesPath + QDir::separator() + filename;
+            QFile sourceFile(QStringLiteral(":/demonotes/") + filename);
+            sourceFile.copy(destinationFile);
+            // set read/write permissions for the owner and user
+            QFile::setPermissions(destinationFile, QFile::ReadOwner | QFile::WriteOwner |
+                                                       QFile::ReadUser | QFile::WriteUser);
+        }
+
+        // fetch all files again
+        scanDir(dirs[0]);
+
+        // jump to the welcome note in the note selector in 500ms
+        QTimer::singleShot(500, this, SLOT(jumpToWelcomeNote()));
+    }
+
+    // stage 2: compare with the database, only what changed is read below
+    QHash<QString, NoteIndexRow> rows;
+    {
+        QSqlDatabase db = QSqlDatabase::database(QStringLiteral("memory"));
+        QSqlQuery query(db);
+        query.setForwardOnly(true);
+        if (query.exec(QStringLiteral(
+                "SELECT id, file_name, note_sub_folder_id, file_size, modified FROM note"))) {
+            while (query.next()) {
+                NoteIndexRow row;
+                row.id = query.value(0).toInt();
+                row.fileSize = query.value(3).toLongLong();
+                row.modified = query.value(4).toDateTime();
+                rows.insert(noteIndexKey(query.value(2).toInt(), query.value(1).toString()), row);
+            }
+        }
+    }
+
+    // a forced rebuild starts from scratch, the database is empty by now anyway
+    const NoteIndexManifest manifest =
+        forceRebuild ? NoteIndexManifest() : loadNoteIndexManifest();
+
+    const int maxNoteFileSize = Utils::Misc::getMaximumNoteFileSize();
+    QVector<NoteIndexFile> files;
+    for (int i = 0; i < dirs.size() && !canceled; ++i) {
+        QStringList names;
+        for (const QFileInfo &info : Utils::asConst(dirs[i].files)) {
+            names << info.fileName();
+        }
+        Note::applyIgnoredNotesSetting(names);
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
+        const QSet<QString> kept(names.begin(), names.end());
+#else
+        const QSet<QString> kept = names.toSet();
+#endif
+
+        for (const QFileInfo &info : Utils::asConst(dirs[i].files)) {
+            if (!kept.contains(info.fileName())) {
+                continue;
+            }
+            if (info.size() > maxNoteFileSize) {
+                qDebug() << "Note file '" << info.fileName() << "' is too large: " << info.size()
+                         << " > " << maxNoteFileSize;
+                continue;
+            }
+
+            NoteIndexFile file;
+            file.dir = i;
+            file.fileName = dirs[i].relativePath.isEmpty()
+                                ? info.fileName()
+                                : dirs[i].relativePath + QDir::separator() + info.fileName();
+            file.filePath = info.filePath();
+            file.size = info.size();
+            file.created = info.birthTime();
+            file.lastModified = info.lastModified();
+
+            const auto entry = manifest.constFind(file.fileName);
+            const bool fingerprintMatches =
+                entry != manifest.constEnd() && entry->size == file.size &&
+                entry->lastModified == file.lastModified.toMSecsSinceEpoch();
+
+            const auto row = rows.constFind(noteIndexKey(dirs[i].noteSubFolderId, info.fileName()));
+            if (row != rows.constEnd()) {
+                file.noteId = row->id;
+                // same test as Note::updateOrCreateFromFile()
+                file.dbChanged = row->fileSize != file.size || file.lastModified > row->modified;
+
+                // one stat and no read if the fingerprint didn't move
+                if (entry != manifest.constEnd()) {
+                    file.previousHash = entry->hash;
+                    if (fingerprintMatches) {
+                        file.needsRead = false;
+                        file.changed = false;
+                        file.hash = entry->hash;
+                    }
+                }
+            } else if (fingerprintMatches) {
+                // the database is new (startup, note folder switch) but the file
+                // isn't: it's read once to create the note, the hash is kept
+                file.hash = entry->hash;
+            }
+            files << file;
+        }
+    }
+
+    // stages 2 and 3 run in slices, so only the texts of one slice are in memory:
+    // the slice is read and hashed in parallel, then the single database writer
+    // on the GUI thread applies its changed notes in one transaction
+    const bool withNoteNameHook = ScriptingService::instance()->handleNoteNameHookExists();
+    const int batchSize = 256;
+    progress.setValue(0);
+    progress.setMaximum(files.size());
+
+    QSqlDatabase db = QSqlDatabase::database(QStringLiteral("memory"));
+    QHash<int, NoteSubFolder> noteSubFolderCache;
+    for (int sliceBegin = 0; sliceBegin < files.size() && !canceled; sliceBegin += batchSize) {
+        const int sliceEnd = qMin(sliceBegin + batchSize, files.size());
+        canceled = !waitForNotesIndexStage(
+            QtConcurrent::map(files.begin() + sliceBegin, files.begin() + sliceEnd,
+                              readNoteIndexFile),
+            progress, sliceBegin);
+        if (canceled) {
+            break;
+        }
+
+        const bool inTransaction = db.transaction();
+        for (int i = sliceBegin; i < sliceEnd; ++i) {
+            NoteIndexFile &file = files[i];
+            if (!file.changed) {
+                // add the note id to in the end check if notes need to be removed
+                if (file.noteId != 0) {
+                    afterNoteIds << file.noteId;
+                }
+                continue;
+            }
+
+            const int fileNoteSubFolderId = dirs[file.dir].noteSubFolderId;
+            int noteId;
+            if (withNoteNameHook || isEncryptedNoteText(file.text)) {
+                // the hook needs a Note, that reads the file itself, and Note
+                // keeps the state of encrypted notes consistent
+                QFile qFile(file.filePath);
+                if (fileNoteSubFolderId != 0 && !noteSubFolderCache.contains(fileNoteSubFolderId)) {
+                    noteSubFolderCache.insert(fileNoteSubFolderId,
+                                              NoteSubFolder::fetch(fileNoteSubFolderId));
+                }
+                noteId = Note::updateOrCreateFromFile(
+                             qFile, noteSubFolderCache.value(fileNoteSubFolderId), true)
+                             .getId();
+            } else {
+                noteId = storeNoteIndexFile(file, fileNoteSubFolderId);
+            }
+            file.text.clear();
+
+            if (noteId == 0) {
+                continue;
+            }
+            afterNoteIds << noteId;
+
+            if (!beforeNoteIds.contains(noteId)) {
+                wasModified = true;
+            }
+        }
+        if (inTransaction) {
+            db.commit();
+        }
+
+        // let the UI breathe once per slice instead of once per note
+        progress.setValue(sliceEnd);
+        QCoreApplication::processEvents(QEventLoop::ExcludeSocketNotifiers);
+        canceled = progress.wasCanceled();
+    }
+    progress.setValue(progress.maximum());
+
+    if (!canceled) {
+        // a full run replaces the manifest, which also drops removed files
+        NoteIndexManifest newManifest = hasNoteSubFolder ? manifest : NoteIndexManifest();
+        newManifest.reserve(files.size());
+        for (const NoteIndexFile &file : Utils::asConst(files)) {
+            if (file.hash.isEmpty()) {
+                continue;
+            }
+            NoteIndexManifestEntry entry;
+            entry.size = file.size;
+            entry.lastModified = file.lastModified.toMSecsSinceEpoch();
+            entry.hash = file.hash;
+            newManifest.insert(file.fileName, entry);
+        }
+        if (!saveNoteIndexManifest(newManifest)) {
+            qWarning() << "Could not write the note index manifest: " << noteIndexManifestPath();
+        }
+    }
+
+    // re-fetch current note (because all the IDs have changed after the
+    // buildNotesIndex()
+    currentNote.refetch();
+
+    if (cryptoKey != 0) {
+        // reset the old crypto key for the current note
+        currentNote.setCryptoKey(cryptoKey);
+        currentNote.setCryptoPassword(cryptoPassword);
+        currentNote.store();
+    }
+
+    // stage 4: reconciliation, skipped if the user aborted (we didn't see everything)
+    if (!hasNoteSubFolder && !canceled) {
+        // remove all missing notes
+        const QSet<int> removedNoteIds = beforeNoteIds - afterNoteIds;
+        const QSet<int> removedNoteSubFolderIds = beforeNoteSubFolderIds - afterNoteSubFolderIds;
+        const bool removeInTransaction =
+            !removedNoteIds.isEmpty() || !removedNoteSubFolderIds.isEmpty() ? db.transaction()
+                                                                            : false;
+
+        for (const int noteId : removedNoteIds) {
+            Note note = Note::fetch(noteId);
+            if (note.isFetched()) {
+                note.remove();
+                wasModified = true;
+            }
+        }
+
+        // remove all missing note subfolders
+        for (const int _noteSubFolderId : removedNoteSubFolderIds) {
+            NoteSubFolder _noteSubFolder = NoteSubFolder::fetch(_noteSubFolderId);
+            if (_noteSubFolder.isFetched()) {
+                _noteSubFolder.remove();
+                wasModified = true;
+            }
+        }
+
+        if (removeInTransaction) {
+            db.commit();
+        }
+    }
+
+    if (!hasNoteSubFolder) {
+        // setup the note folder database
+        DatabaseService::createNoteFolderConnection();
+        DatabaseService::setupNoteFolderTables();
+
+        // set up the full-text index now, not with the first typed character
+        NoteSearchIndex::ensure();
+
+        // update the note directory watcher
+        updateNoteDirectoryWatcher();
+
+        // update the information about shared notes
+        OwnCloudService *ownCloud = OwnCloudService::instance();
+        ownCloud->fetchShares();
+
+        removeConflictedNotesDatabaseCopies();
+
+        // parse the links of the notes that changed since the last time
+        NoteLinkIndex::update();
+        _backlinkSignature.clear();
+        _noteRelationSignature.clear();
+    }
+
+    return wasModified;
+}
+
+/**
+ * Collects a watcher event for processNoteFolderChanges()
+ *
+ * A sync client or a "git pull" fires one event per path, so we wait until
+ * the burst is over and then handle the deduplicated paths at once
+ */
+void MainWindow::queueNoteFolderChange(const QString &path, bool isDirectory) {
+    if (isDirectory) {
+        _pendingNoteDirectoryChanges << QDir::cleanPath(path);
+    } else {
+        _pendingNoteFileChanges << QDir::cleanPath(path);
+    }
+
+    if (!_noteFolderChangeTimer->isActive()) {
+        _noteFolderChangesPendingSince.start();
+    } else if (_noteFolderChangesPendingSince.elapsed() >= noteFolderChangeMaxDelay) {
+        // don't let a never ending stream of events starve the update
+        return;
+    }
+
+    _noteFolderChangeTimer->start(noteFolderChangeDebounce);
+}
+
+/**
+ * Applies one window of external changes to the note index and the note list
+ */
+void MainWindow::processNoteFolderChanges() {
+    if (_pendingNoteFileChanges.isEmpty() && _pendingNoteDirectoryChanges.isEmpty()) {
+        return;
+    }
+
+    // dialogs and progress dialogs below run nested event loops, the changes
+    // that come in meanwhile are handled in the next round, the same goes for
+    // the events of a background write that isn't finished yet
+    if (_processingNoteFolderChanges || _buildingNotesIndex || _noteWriteQueue->isBusy()) {
+        _noteFolderChangeTimer->start(noteFolderChangeDebounce);
+        return;
+    }
+    _processingNoteFolderChanges = true;
+    const QScopeGuard resetProcessing([this] { _processingNoteFolderChanges = false; });
+
+    QSet<QString> files;
+    QSet<QString> directories;
+    files.swap(_pendingNoteFileChanges);
+    directories.swap(_pendingNoteDirectoryChanges);
+
+    // the events of our own background writes
+    for (auto it = files.begin(); it != files.end();) {
+        if (_noteWriteQueue->isOwnWrite(*it)) {
+            it = files.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto it = directories.begin(); it != directories.end();) {
+        if (_noteWriteQueue->isOwnDirectoryChange(*it)) {
+            it = directories.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (_settingsSnapshot.values().ignoreAllExternalNoteFolderChanges) {
+        return;
+    }
+
+    qDebug() << __func__ << " - 'files': " << files.size()
+             << " - 'directories': " << directories.size();
 
-        // init the lists to check for removed items
-        _buildNotesIndexBeforeNoteIdList = Note::fetchAllIds();
-        _buildNotesIndexBeforeNoteSubFolderIdList = NoteSubFolder::fetchAllIds();
-        _buildNotesIndexAfterNoteIdList.clear();
-        _buildNotesIndexAfterNoteSubFolderIdList.clear();
-    } else {
-        noteSubFolder = NoteSubFolder::fetch(noteSubFolderId);
-        hasNoteSubFolder = noteSubFolder.isFetched();
+    // the current note has its own handling with the diff dialog, it has to
+    // see the old note text in the database, so it goes first
+    if (!currentNote.getFileName().isEmpty()) {
+        const QString currentNotePath = QDir::cleanPath(currentNote.fullNoteFilePath());
+        const bool currentNoteTouched = files.remove(currentNotePath);
 
-        if (!hasNoteSubFolder) {
-            return false;
+        if (currentNoteTouched ||
+            directories.contains(QFileInfo(currentNotePath).absolutePath())) {
+            checkCurrentNoteForExternalChange();
         }
-
-        notePath += QDir::separator() + noteSubFolder.relativePath();
     }
 
-    //    qDebug() << __func__ << " - 'notePath': " << notePath;
+    if (files.isEmpty() && directories.isEmpty()) {
+        return;
+    }
 
-    QDir notesDir(notePath);
+    if (files.size() + directories.size() <= noteFolderChangeDeltaLimit &&
+        updateNotesIndexForChanges(files, directories)) {
+        if (NoteLinkIndex::update()) {
+            startNavigationParser();
+            updateNoteGraphicsView();
+        }
 
-    // only show certain files
-    auto filters = Note::noteFileExtensionList(QStringLiteral("*."));
+        return;
+    }
 
-    // show the newest entry first
-    QStringList files = notesDir.entryList(filters, QDir::Files, QDir::Time);
-    qDebug() << __func__ << " - 'files': " << files;
+    showStatusBarMessage(tr("Notes directory was modified externally"), QStringLiteral("🔄"), 5000);
 
-    Note::applyIgnoredNotesSetting(files);
-    //    qDebug() << __func__ << " - 'files': " << files;
+    // one index run for the whole batch, the note index manifest makes sure
+    // only the changed files are read
+    buildNotesIndexAndLoadNoteDirectoryList();
 
-    bool createDemoNotes = (files.count() == 0) && !hasNoteSubFolder;
+    // also update the text of the text edit if current note has changed
+    const bool updateNoteText = !this->currentNote.exists();
 
-    if (createDemoNotes) {
-        SettingsService settings;
-        // check if we already have created the demo notes once
-        createDemoNotes = !settings.value(QStringLiteral("demoNotesCreated")).toBool();
+    // restore old selected row
+    setCurrentNote(std::move(this->currentNote), updateNoteText);
+}
 
-        if (createDemoNotes) {
-            // we don't want to create the demo notes again
-            settings.setValue(QStringLiteral("demoNotesCreated"), true);
+/**
+ * Updates only the notes of the changed files and directories in the note
+ * index and only their rows in the note list
+ *
+ * The current note is left alone, see checkCurrentNoteForExternalChange().
+ *
+ * @return false if the note subfolder structure changed (a full index run is needed)
+ */
+bool MainWindow::updateNotesIndexForChanges(const QSet<QString> &files,
+                                            const QSet<QString> &directories) {
+    const QString notePath = QDir::cleanPath(this->notesPath);
+    const bool showSubfolders = NoteFolder::isCurrentHasSubfolders();
+    const QStringList filters = Note::noteFileExtensionList(QStringLiteral("*."));
+    const QString currentNotePath = currentNote.getFileName().isEmpty()
+                                        ? QString()
+                                        : QDir::cleanPath(currentNote.fullNoteFilePath());
+
+    // note subfolders of the touched directories, a directory we don't know
+    // means new or removed note subfolders
+    QHash<QString, NoteSubFolder> noteSubFolders;
+    const auto lookupNoteSubFolder = [&](const QString &dirPath, NoteSubFolder &noteSubFolder) {
+        const auto it = noteSubFolders.constFind(dirPath);
+        if (it != noteSubFolders.constEnd()) {
+            noteSubFolder = it.value();
+            return true;
         }
-    }
 
-    // add some notes if there aren't any, and we haven't already created them once
-    if (createDemoNotes) {
-        qDebug() << "No notes! We will add some...";
-        const QStringList filenames =
-            QStringList({"Markdown Cheatsheet.md", "Welcome to QOwnNotes.md"});
+        if (dirPath != notePath) {
+            if (!showSubfolders || !dirPath.startsWith(notePath + QLatin1Char('/'))) {
+                return false;
+            }
 
-        // copy note files to the notes path
-        for (const auto &filename : filenames) {
-            const QString destinationFile = this->notesPath + QDir::separator() + filename;
-            QFile sourceFile(QStringLiteral(":/demonotes/") + filename);
-            sourceFile.copy(destinationFile);
-            // set read/write permissions for the owner and user
-            QFile::setPermissions(destinationFile, QFile::ReadOwner | QFile::WriteOwner |
-                                                       QFile::ReadUser | QFile::WriteUser);
+            QString pathData = dirPath.mid(notePath.size() + 1);
+            pathData.replace(QLatin1Char('/'), QLatin1Char('\n'));
+            noteSubFolder = NoteSubFolder::fetchByPathData(std::move(pathData));
+            if (!noteSubFolder.isFetched()) {
+                return false;
+            }
+        } else {
+            noteSubFolder = NoteSubFolder();
         }
 
-        // copy the shortcuts file and handle its file permissions
-        //        destinationFile = this->notesPath + QDir::separator() +
-        //              "Important Shortcuts.txt";
-        //        QFile::copy( ":/shortcuts", destinationFile );
-        //        QFile::setPermissions( destinationFile, QFile::ReadOwner |
-        //                  QFile::WriteOwner | QFile::ReadUser |
-        //                  QFile::WriteUser );
+        noteSubFolders.insert(dirPath, noteSubFolder);
+        return true;
+    };
 
-        // fetch all files again
-        files = notesDir.entryList(filters, QDir::Files, QDir::Time);
+    // database state of the notes in the touched note subfolders
+    QHash<QString, NoteIndexRow> rows;
+    QSet<int> loadedNoteSubFolderIds;
+    const auto loadRows = [&](int noteSubFolderId) {
+        if (loadedNoteSubFolderIds.contains(noteSubFolderId)) {
+            return;
+        }
+        loadedNoteSubFolderIds << noteSubFolderId;
 
-        // jump to the welcome note in the note selector in 500ms
-        QTimer::singleShot(500, this, SLOT(jumpToWelcomeNote()));
-    }
+        QSqlQuery query(QSqlDatabase::database(QStringLiteral("memory")));
+        query.setForwardOnly(true);
+        query.prepare(QStringLiteral("SELECT id, file_name, file_size, modified FROM note "
+                                     "WHERE note_sub_folder_id = :id"));
+        query.bindValue(QStringLiteral(":id"), noteSubFolderId);
+        if (!query.exec()) {
+            return;
+        }
+        while (query.next()) {
+            NoteIndexRow row;
+            row.id = query.value(0).toInt();
+            row.fileSize = query.value(2).toLongLong();
+            row.modified = query.value(3).toDateTime();
+            rows.insert(noteIndexKey(noteSubFolderId, query.value(1).toString()), row);
+        }
+    };
+
+    // plan everything first, so we never fall back halfway through
+    QSet<QString> candidates;
+    QSet<int> removedNoteIds;
+    for (const QString &dirPath : directories) {
+        NoteSubFolder noteSubFolder;
+        if (!QFileInfo::exists(dirPath) || !lookupNoteSubFolder(dirPath, noteSubFolder)) {
+            return false;
+        }
 
-    // get the current crypto key to set it again
-    // after all notes were read again
-    const qint64 cryptoKey = currentNote.getCryptoKey();
-    const QString cryptoPassword = currentNote.getCryptoPassword();
+        const QDir dir(dirPath);
+        if (showSubfolders) {
+            QStringList folderNames = dir.entryList(QDir::Dirs | QDir::Hidden | QDir::NoDotAndDotDot);
+            folderNames.erase(std::remove_if(folderNames.begin(), folderNames.end(),
+                                             [](const QString &name) {
+                                                 return NoteSubFolder::willFolderBeIgnored(name);
+                                             }),
+                              folderNames.end());
 
-    if (!hasNoteSubFolder && forceRebuild) {
-        // first delete all notes and note sub folders in the database if a
-        // rebuild was forced
-        Note::deleteAll();
-        NoteSubFolder::deleteAll();
-    }
+            QStringList knownFolderNames;
+            const auto children = NoteSubFolder::fetchAllByParentId(noteSubFolder.getId());
+            for (const NoteSubFolder &child : children) {
+                knownFolderNames << child.getName();
+            }
 
-    const bool withNoteNameHook = ScriptingService::instance()->handleNoteNameHookExists();
-    const int numFiles = files.count();
-    QProgressDialog progress(tr("Loading notes…"), tr("Abort"), 0, numFiles, this);
-    progress.setWindowModality(Qt::WindowModal);
-    int currentCount = 0;
+            folderNames.sort();
+            knownFolderNames.sort();
+            if (folderNames != knownFolderNames) {
+                return false;
+            }
+        }
 
-    _buildNotesIndexAfterNoteIdList.reserve(files.size());
-    const int maxNoteFileSize = Utils::Misc::getMaximumNoteFileSize();
-    // create all notes from the files
-    for (QString fileName : Utils::asConst(files)) {
-        if (progress.wasCanceled()) {
-            break;
+        QStringList fileNames = dir.entryList(filters, QDir::Files);
+        Note::applyIgnoredNotesSetting(fileNames);
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
+        const QSet<QString> present(fileNames.begin(), fileNames.end());
+#else
+        const QSet<QString> present = fileNames.toSet();
+#endif
+        for (const QString &fileName : Utils::asConst(fileNames)) {
+            candidates << dirPath + QLatin1Char('/') + fileName;
         }
 
-        if (hasNoteSubFolder) {
-            fileName.prepend(noteSubFolder.relativePath() + QDir::separator());
+        // notes whose file is gone from the directory
+        loadRows(noteSubFolder.getId());
+        const QString prefix = noteIndexKey(noteSubFolder.getId(), QString());
+        for (auto it = rows.constBegin(); it != rows.constEnd(); ++it) {
+            if (it.key().startsWith(prefix) && !present.contains(it.key().mid(prefix.size()))) {
+                removedNoteIds << it->id;
+            }
         }
+    }
 
-        // fetching the content of the file
-        QFile file(Note::getFullFilePathForFile(fileName));
+    for (const QString &filePath : files) {
+        NoteSubFolder noteSubFolder;
+        if (!lookupNoteSubFolder(QFileInfo(filePath).absolutePath(), noteSubFolder)) {
+            return false;
+        }
+        if (QDir::match(filters, QFileInfo(filePath).fileName())) {
+            candidates << filePath;
+        }
+    }
 
-        if (file.size() > maxNoteFileSize) {
-            qDebug() << "Note file '" << fileName << "' is too large: " << file.size() << " > "
-                     << maxNoteFileSize;
+    const int maxNoteFileSize = Utils::Misc::getMaximumNoteFileSize();
+    QVector<QPair<QString, NoteSubFolder>> changedFiles;
+    for (const QString &filePath : Utils::asConst(candidates)) {
+        if (filePath == currentNotePath) {
             continue;
         }
 
-        // update or create a note from the file
-        const Note note = Note::updateOrCreateFromFile(file, noteSubFolder, withNoteNameHook);
-
-        // add the note id to in the end check if notes need to be removed
-        _buildNotesIndexAfterNoteIdList << note.getId();
+        const QFileInfo info(filePath);
+        NoteSubFolder noteSubFolder;
+        lookupNoteSubFolder(info.absolutePath(), noteSubFolder);
+        loadRows(noteSubFolder.getId());
+        const auto row = rows.constFind(noteIndexKey(noteSubFolder.getId(), info.fileName()));
 
-        if (!_buildNotesIndexBeforeNoteIdList.contains(note.getId())) {
-            wasModified = true;
+        QStringList fileNames{info.fileName()};
+        Note::applyIgnoredNotesSetting(fileNames);
+        if (!info.exists() || fileNames.isEmpty() || info.size() > maxNoteFileSize) {
+            if (row != rows.constEnd()) {
+                removedNoteIds << row->id;
+            }
+            continue;
         }
 
-        // update the UI
-        // this causes to show notes twice in the ui->noteTreeWidget if a
-        // not selected note is modified externally
-        // https://github.com/pbek/QOwnNotes/issues/242
-        // using a blocker on noteTreeWidget or just processing every 10th
-        // time doesn't work neither
-        //            QCoreApplication::processEvents();
-
-        // we try these two instead to update the UI
-        // QCoreApplication::flush() is obsolete since Qt 5.9
-        //            QCoreApplication::flush();
-
-        // this still causes double entries on OS X and maybe Windows
-#ifdef Q_OS_LINUX
-        QCoreApplication::sendPostedEvents();
-#endif
-        progress.setValue(++currentCount);
+        // same test as Note::updateOrCreateFromFile()
+        if (row == rows.constEnd() || row->fileSize != info.size() ||
+            info.lastModified() > row->modified) {
+            changedFiles << qMakePair(filePath, noteSubFolder);
+        }
     }
+    removedNoteIds.remove(currentNote.getId());
 
-    progress.setValue(numFiles);
-
-    // update the UI and get user input after all the notes were loaded
-    // this still can cause duplicate note subfolders to be viewed
-    //    QCoreApplication::processEvents();
-
-    // re-fetch current note (because all the IDs have changed after the
-    // buildNotesIndex()
-    currentNote.refetch();
-
-    if (cryptoKey != 0) {
-        // reset the old crypto key for the current note
-        currentNote.setCryptoKey(cryptoKey);
-        currentNote.setCryptoPassword(cryptoPassword);
-        currentNote.store();
+    if (changedFiles.isEmpty() && removedNoteIds.isEmpty()) {
+        return true;
     }
 
-    // build the note sub folders
-    const bool showSubfolders = NoteFolder::isCurrentHasSubfolders();
-    if (showSubfolders) {
-        const QStringList folders = notesDir.entryList(QDir::Dirs | QDir::Hidden, QDir::Time);
-
-        for (const QString &folder : folders) {
-            if (NoteSubFolder::willFolderBeIgnored(folder)) {
-                continue;
-            }
+    // apply the whole window in one transaction
+    QSqlDatabase db = QSqlDatabase::database(QStringLiteral("memory"));
+    const bool inTransaction = db.transaction();
+    const bool withNoteNameHook = ScriptingService::instance()->handleNoteNameHookExists();
+    const bool isCurrentNoteTreeEnabled = NoteFolder::isCurrentNoteTreeEnabled();
 
-            // fetch or create the parent note sub folder
-            NoteSubFolder parentNoteSubFolder =
-                NoteSubFolder::fetchByNameAndParentId(folder, noteSubFolderId);
-            if (!parentNoteSubFolder.isFetched()) {
-                parentNoteSubFolder.setName(folder);
-                parentNoteSubFolder.setParentId(noteSubFolderId);
-                parentNoteSubFolder.store();
+    QVector<Note> changedNotes;
+    changedNotes.reserve(changedFiles.size());
+    for (const auto &changedFile : Utils::asConst(changedFiles)) {
+        QFile qFile(changedFile.first);
+        changedNotes << Note::updateOrCreateFromFile(qFile, changedFile.second, withNoteNameHook);
+    }
 
-                wasModified = true;
+    for (const int noteId : Utils::asConst(removedNoteIds)) {
+        Note note = Note::fetch(noteId);
+        if (note.isFetched()) {
+            if (!isCurrentNoteTreeEnabled) {
+                removeNoteFromNoteTreeWidget(note);
             }
+            note.remove();
+        }
+    }
 
-            if (parentNoteSubFolder.isFetched()) {
-                // add the note id to in the end check if notes need to
-                // be removed
-                _buildNotesIndexAfterNoteSubFolderIdList << parentNoteSubFolder.getId();
+    if (inTransaction) {
+        db.commit();
+    }
 
-                // build the notes index for the note subfolder
-                const bool result = buildNotesIndex(parentNoteSubFolder.getId());
-                if (result) {
-                    wasModified = true;
-                }
+    showStatusBarMessage(
+        tr("%n note(s) were modified externally", "", changedNotes.size() + removedNoteIds.size()),
+        QStringLiteral("🔄"), 5000);
 
-                // update the UI
-                // this causes to show sub note folders twice in the
-                // ui->noteSubFolderTreeWidget if a
-                // not selected note is modified externally
-                //                    QCoreApplication::processEvents();
+    if (isCurrentNoteTreeEnabled) {
+        loadNoteDirectoryList();
+        return true;
+    }
 
-                // we try these two instead to update the UI
-                // QCoreApplication::flush() is obsolete since Qt 5.9
-                //                    QCoreApplication::flush();
+    // refresh only the rows of the changed notes
+    const QSignalBlocker blocker(ui->noteTreeWidget);
+    Q_UNUSED(blocker)
 
-                // this still causes double entries on OS X and maybe
-                // Windows
-#ifdef Q_OS_LINUX
-                QCoreApplication::sendPostedEvents();
-#endif
-            }
-        }
-    }
+    const int sort = _settingsSnapshot.values().notesPanelSort;
+    const bool isNoteListPreview = Utils::Misc::isNoteListPreview();
 
-    if (!hasNoteSubFolder) {
-        // check for removed notes
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
-        const QList<int> removedNoteIdList =
-            QSet<int>(_buildNotesIndexBeforeNoteIdList.begin(),
-                      _buildNotesIndexBeforeNoteIdList.end())
-                .subtract(QSet<int>(_buildNotesIndexAfterNoteIdList.begin(),
-                                    _buildNotesIndexAfterNoteIdList.end()))
-                .values();
-#else
-        const QList<int> removedNoteIdList = _buildNotesIndexBeforeNoteIdList.toList()
-                                                 .toSet()
-                                                 .subtract(_buildNotesIndexAfterNoteIdList.toSet())
-                                                 .toList();
-#endif
+    for (const Note &note : Utils::asConst(changedNotes)) {
+        QTreeWidgetItem *item = findNoteInNoteTreeWidget(note);
 
-        // remove all missing notes
-        for (const int noteId : removedNoteIdList) {
-            Note note = Note::fetch(noteId);
-            if (note.isFetched()) {
-                note.remove();
-                wasModified = true;
+        if (item == nullptr) {
+            if (!addNoteToNoteTreeWidget(note)) {
+                continue;
             }
+            item = findNoteInNoteTreeWidget(note);
+        } else {
+            item->setText(0, note.getName());
+            Utils::Gui::setTreeWidgetItemToolTipForNote(item, note);
+            Utils::Gui::handleTreeWidgetItemTagColor(item, Tag::fetchOneOfNoteWithColor(note));
         }
 
-        // check for removed note subfolders
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
-        QList<int> removedNoteSubFolderIdList =
-            QSet<int>(_buildNotesIndexBeforeNoteSubFolderIdList.begin(),
-                      _buildNotesIndexBeforeNoteSubFolderIdList.end())
-                .subtract(QSet<int>(_buildNotesIndexAfterNoteSubFolderIdList.begin(),
-                                    _buildNotesIndexAfterNoteSubFolderIdList.end()))
-                .values();
-#else
-        const QList<int> removedNoteSubFolderIdList =
-            _buildNotesIndexBeforeNoteSubFolderIdList.toList()
-                .toSet()
-                .subtract(_buildNotesIndexAfterNoteSubFolderIdList.toSet())
-                .toList();
-#endif
+        if (item != nullptr && sort == SORT_BY_LAST_CHANGE) {
+            // the newest note goes to the top, like after a full reload
+            ui->noteTreeWidget->takeTopLevelItem(ui->noteTreeWidget->indexOfTopLevelItem(item));
+            ui->noteTreeWidget->insertTopLevelItem(0, item);
 
-        // remove all missing note subfolders
-        for (const int _noteSubFolderId : removedNoteSubFolderIdList) {
-            NoteSubFolder _noteSubFolder = NoteSubFolder::fetch(_noteSubFolderId);
-            if (_noteSubFolder.isFetched()) {
-                _noteSubFolder.remove();
-                wasModified = true;
+            if (isNoteListPreview) {
+                // moving the item destroys its NoteTreeWidgetItem
+                updateNoteTreeWidgetItem(note, item);
             }
+        } else if (item != nullptr && isNoteListPreview) {
+            updateNoteTreeWidgetItem(note, item);
         }
+    }
 
-        // setup the note folder database
-        DatabaseService::createNoteFolderConnection();
-        DatabaseService::setupNoteFolderTables();
-
-        // update the note directory watcher
-        updateNoteDirectoryWatcher();
+    if (sort == SORT_ALPHABETICAL) {
+        ui->noteTreeWidget->sortItems(
+            0, Utils::Gui::toQtOrder(
+                   SettingsService().value(QStringLiteral("notesPanelOrder")).toInt()));
+    }
 
-        // update the information about shared notes
-        OwnCloudService *ownCloud = OwnCloudService::instance();
-        ownCloud->fetchShares();
+    // new rows, and changed rows whose text or tags may match differently now,
+    // have to go through the search, tag and subfolder filters
+    if (!changedNotes.isEmpty()) {
+        filterNotes(false);
     }
 
-    if (noteSubFolderId == 0) {
-        removeConflictedNotesDatabaseCopies();
+    // the current item may have moved
+    if (QTreeWidgetItem *item = findNoteInNoteTreeWidget(currentNote)) {
+        ui->noteTreeWidget->setCurrentItem(item);
     }
 
-    return wasModified;
+    return true;
 }
 
 /**
- * Asks to remove conflicted copies of the notes.sqlite database
+ * Merges conflicted copies of the notes.sqlite database in the background,
+ * see noteFolderDatabasesMerged()
  */
 void MainWindow::removeConflictedNotesDatabaseCopies() {
+    // the copies that are left are picked up the next time
+    if (_noteFolderDatabaseMerger->isRunning()) {
+        return;
+    }
+
     const QStringList filter{"notes (*conflicted copy *).sqlite"};
     QDirIterator it(NoteFolder::currentLocalPath(), filter,
                     QDir::AllEntries | QDir::NoSymLinks | QDir::NoDotAndDotDot);
     auto files = QStringList();
-    const QSignalBlocker blocker(this->noteDirectoryWatcher);
-    Q_UNUSED(blocker)
-
-    FileWatchDisabler disable(this);
 
     while (it.hasNext()) {
         const QString &file = it.next();
         qDebug() << "Found conflicting note folder database: " << file;
+        files << file;
+    }
 
-        // check if conflicted database copy is the same as the current note
-        // folder database
-        if (Utils::Misc::isSameFile(file, DatabaseService::getNoteFolderDatabasePath())) {
-            showStatusBarMessage(
-                QFile::remove(file)
-                    ? tr("Removed duplicate conflicted database: %1").arg(file)
-                    : tr("Could not remove duplicate conflicted database: %1").arg(file),
-                QStringLiteral("🗄️"), 4000);
-        } else if (DatabaseService::mergeNoteFolderDatabase(file)) {
-            showStatusBarMessage(
-                QFile::remove(file)
-                    ? tr("Removed merged conflicted database: %1").arg(file)
-                    : tr("Could not remove merged conflicted database: %1").arg(file),
-                QStringLiteral("🗄️"), 4000);
-        } else {
-            files << file;
+    if (files.isEmpty()) {
+        return;
+    }
+
+    _noteFolderDatabaseMerger->start(DatabaseService::getNoteFolderDatabasePath(), files);
+}
+
+void MainWindow::noteFolderDatabaseMergeProgress(int done, int total) {
+    showStatusBarMessage(tr("Merged %1 of %2 conflicted databases").arg(done).arg(total),
+                         QStringLiteral("🗄️"), 4000);
+}
+
+/**
+ * Removes the merged conflicted database copies and asks to remove the
+ * copies that couldn't be merged
+ */
+void MainWindow::noteFolderDatabasesMerged(
+    const QVector<NoteFolderDatabaseMerger::Result> &results) {
+    auto files = QStringList();
+    bool wasMerged = false;
+
+    {
+        const QSignalBlocker blocker(this->noteDirectoryWatcher);
+        Q_UNUSED(blocker)
+
+        FileWatchDisabler disable(this);
+
+        for (const NoteFolderDatabaseMerger::Result &result : results) {
+            const QString &file = result.path;
+
+            switch (result.outcome) {
+                // the conflicted database copy is the same as the note folder database
+                case NoteFolderDatabaseMerger::Duplicate:
+                    showStatusBarMessage(
+                        QFile::remove(file)
+                            ? tr("Removed duplicate conflicted database: %1").arg(file)
+                            : tr("Could not remove duplicate conflicted database: %1").arg(file),
+                        QStringLiteral("🗄️"), 4000);
+                    break;
+                case NoteFolderDatabaseMerger::Merged:
+                    wasMerged = true;
+                    showStatusBarMessage(
+                        QFile::remove(file)
+                            ? tr("Removed merged conflicted database: %1").arg(file)
+                            : tr("Could not remove merged conflicted database: %1").arg(file),
+                        QStringLiteral("🗄️"), 4000);
+                    break;
+                case NoteFolderDatabaseMerger::Failed:
+                    files << file;
+                    break;
+            }
         }
     }
 
+    // the merged tags and note links
+    if (wasMerged) {
+        reloadTagTree();
+    }
+
     int count = files.count();
 
     if (count == 0) {
@@ -3601,13 +4818,26 @@ void MainWindow::updateNoteDirectoryWatcher() {
     //    }
 
     const QString notePath = Utils::Misc::removeIfEndsWith(this->notesPath, QDir::separator());
+    const QString gitPath = notePath + QDir::separator() + QStringLiteral(".git");
+
+    // On Linux one inotify watch per directory replaces the per-note watches,
+    // which had to stop at 200 notes to not run out of file descriptors
+    if (QDir(notePath).exists() &&
+        _noteFolderWatcher->watch(notePath, hasSubfolders, [](const QString &folderName) {
+            return NoteSubFolder::willFolderBeIgnored(folderName);
+        })) {
+        // changes in the .git folder itself (not below it) still trigger a reload
+        if (QDir(gitPath).exists()) {
+            _noteFolderWatcher->addDirectory(gitPath);
+        }
+        return;
+    }
     if (QDir(notePath).exists()) {
         // watch the notes directory for changes
         noteDirectoryWatcher.addPath(notePath);
     }
 
     // Add the .git folder to the watcher if it exists
-    const QString gitPath = notePath + QDir::separator() + QStringLiteral(".git");
     if (QDir(gitPath).exists()) {
         addDirectoryToDirectoryWatcher(gitPath);
     }
@@ -3659,6 +4889,8 @@ void MainWindow::updateNoteDirectoryWatcher() {
  * Clears all paths from the directory watcher
  */
 void MainWindow::clearNoteDirectoryWatcher() {
+    _noteFolderWatcher->clear();
+
     const QStringList fileList = noteDirectoryWatcher.directories() + noteDirectoryWatcher.files();
     if (fileList.count() > 0) {
         noteDirectoryWatcher.removePaths(fileList);
@@ -3859,7 +5091,6 @@ void MainWindow::setCurrentNote(Note note, bool updateNoteText, bool updateSelec
     // highlighter
     qApp->setProperty("currentNoteId", noteId);
 
-    const QString name = note.getName();
     updateWindowTitle();
 
     // update current tab
@@ -3872,15 +5103,15 @@ void MainWindow::setCurrentNote(Note note, bool updateNoteText, bool updateSelec
 
     // find and set the current item
     if (updateSelectedNote) {
-        QList<QTreeWidgetItem *> items = ui->noteTreeWidget->findItems(name, Qt::MatchExactly);
-        if (items.count() > 0) {
+        QTreeWidgetItem *item = findNoteInNoteTreeWidget(note);
+        if (item != nullptr) {
             const QSignalBlocker blocker(ui->noteTreeWidget);
             Q_UNUSED(blocker)
 
             // to avoid that multiple notes will be selected
             ui->noteTreeWidget->clearSelection();
 
-            ui->noteTreeWidget->setCurrentItem(items[0]);
+            ui->noteTreeWidget->setCurrentItem(item);
         }
     }
 
@@ -3940,8 +5171,30 @@ void MainWindow::setCurrentNote(Note note, bool updateNoteText, bool updateSelec
 
 void MainWindow::updateNoteGraphicsView() {
     if (_noteRelationScene && _noteGraphicsViewDockWidget->isVisible()) {
-        _noteRelationScene->drawForNote(currentNote);
+        // only redrawn if the notes around the current note changed, the
+        // index can't tell that for note:// links
+        const QString notePath = NoteLinkIndex::notePath(currentNote);
+        QString signature = noteLinkSignature(notePath, NoteLinkIndex::neighbours(notePath));
+
+        if (signature != _noteRelationSignature || NoteLinkIndex::hasLegacyLinks()) {
+            _noteRelationSignature = std::move(signature);
+            _noteRelationScene->drawForNote(currentNote);
+        }
+    }
+}
+
+/**
+ * Returns a string that changes when a link around the note at notePath or
+ * one of the linked notes changes
+ */
+QString MainWindow::noteLinkSignature(const QString &notePath,
+                                      const QVector<NoteLinkIndex::Link> &links) {
+    QString signature = notePath;
+    for (const NoteLinkIndex::Link &link : links) {
+        signature += QLatin1Char('\n') + link.path + QLatin1Char(' ') + link.stamp;
     }
+
+    return signature;
 }
 
 void MainWindow::updateCurrentTabData(const Note &note) const {
@@ -3985,9 +5238,7 @@ bool MainWindow::jumpToTab(const Note &note) const {
  * modified outside of QOwnNotes
  */
 void MainWindow::updateCurrentNoteTextHash() {
-    _currentNoteTextHash = QString(
-        QCryptographicHash::hash(currentNote.getNoteText().toLocal8Bit(), QCryptographicHash::Sha1)
-            .toHex());
+    _currentNoteTextHash = NoteChangeReconciler::fingerprint(currentNote.getNoteText());
 }
 
 void MainWindow::updateActionUiEnabled() {
@@ -4151,8 +5402,10 @@ void MainWindow::removeCurrentNote() {
 /**
  * Searches and removes note from the note tree widget
  */
-void MainWindow::removeNoteFromNoteTreeWidget(Note &note) const {
-    auto *item = Utils::Gui::getTreeWidgetItemWithUserData(ui->noteTreeWidget, note.getId());
+void MainWindow::removeNoteFromNoteTreeWidget(Note &note) {
+    auto *item = _noteTreeWidgetItemIndexEnabled
+                     ? _noteTreeWidgetItems.take(note.getId())
+                     : Utils::Gui::getTreeWidgetItemWithUserData(ui->noteTreeWidget, note.getId());
 
     if (item != nullptr) {
         delete (item);
@@ -4544,6 +5797,7 @@ void MainWindow::setNoteTextFromNote(Note *note, bool updateNoteTextViewOnly,
         qobject_cast<QOwnNotesMarkdownHighlighter *>(ui->noteTextEdit->highlighter())
             ->updateCurrentNote(note);
         ui->noteTextEdit->setText(note->getNoteText());
+        _noteTextStoredRevision = ui->noteTextEdit->document()->revision();
     }
 
     if (allowRestoreCursorPosition && Utils::Misc::isRestoreCursorPosition()) {
@@ -4555,27 +5809,99 @@ void MainWindow::setNoteTextFromNote(Note *note, bool updateNoteTextViewOnly,
     if (_notePreviewDockWidget->isVisible() || ignorePreviewVisibility) {
         const bool decrypt = ui->noteTextEdit->isHidden();
 
-        const QString html = note->toMarkdownHtml(NoteFolder::currentLocalPath(),
-                                                  getMaxImageWidth(), false, decrypt);
+        // a preview that is still converted in the background is outdated now
+        _notePreviewRevision++;
+        _notePreviewJobPending = false;
+
+        // updates while typing are converted in the background, the markdown
+        // html hooks of scripts have to run in the scripting engine of this thread
+        ScriptingService *scriptingService = ScriptingService::instance();
+        if (updateNoteTextViewOnly && !ignorePreviewVisibility &&
+            !scriptingService->preNoteToMarkdownHtmlHookExists() &&
+            !scriptingService->noteToMarkdownHtmlHookExists()) {
+            // everything that needs the database is resolved here, the worker
+            // only converts text
+            const QString subFolderPath = note->getNoteSubFolder().relativePath();
+            _notePreviewJobText = decrypt ? note->fetchDecryptedNoteText() : note->getNoteText();
+            _notePreviewJobPath = NoteFolder::currentLocalPath();
+            if (!subFolderPath.isEmpty()) {
+                _notePreviewJobPath += QDir::separator() + subFolderPath;
+            }
+            _notePreviewJobPending = true;
+
+            // otherwise the job is started when the running one is finished
+            if (!_notePreviewWatcher->isRunning()) {
+                startNotePreviewJob();
+            }
+        } else {
+            setNotePreviewHtml(note->toMarkdownHtml(NoteFolder::currentLocalPath(),
+                                                    getMaxImageWidth(), false, decrypt));
+        }
+    }
+
+    // update the slider when editing notes
+    noteTextSliderValueChanged(activeNoteTextEdit()->verticalScrollBar()->value(), true);
+}
+
+/**
+ * Shows the html in the note preview if it has changed
+ */
+void MainWindow::setNotePreviewHtml(const QString &html) {
+    // create a hash of the html (because
+    const QString hash =
+        QString(QCryptographicHash::hash(html.toLocal8Bit(), QCryptographicHash::Sha1).toHex());
+
+    // update the note preview if the text has changed
+    // we use our hash because ui->noteTextView->toHtml() may return
+    // a different text than before
+    if (_notePreviewHash != hash) {
+#ifdef USE_QLITEHTML
+        _notePreviewWidget->setHtml(html);
+#else
+        // only the changed blocks are replaced, so editing a large note
+        // doesn't lay out the whole preview again
+        _notePreviewPatcher.show(
+            ui->noteTextView->document(), html,
+            [this](const QString &markedHtml) { ui->noteTextView->setHtml(markedHtml); });
+#endif
+        _notePreviewHash = hash;
+    }
+}
+
+/**
+ * Converts the latest note text snapshot to html in a worker thread
+ */
+void MainWindow::startNotePreviewJob() {
+    _notePreviewJobPending = false;
+
+    // plain values only: Note::toMarkdownHtml() would look up the note
+    // subfolder on the memory database, which belongs to this thread
+    const QString text = _notePreviewJobText;
+    const QString notePath = _notePreviewJobPath;
+    const int maxImageWidth = getMaxImageWidth();
+    const int revision = _notePreviewRevision;
+
+    _notePreviewWatcher->setFuture(QtConcurrent::run([text, notePath, maxImageWidth, revision]() {
+        return qMakePair(revision, Note::textToMarkdownHtml(text, notePath, maxImageWidth));
+    }));
+}
+
+/**
+ * Shows the html of a finished preview job unless the preview was updated
+ * in the meantime
+ */
+void MainWindow::notePreviewJobFinished() {
+    const QPair<int, QString> result = _notePreviewWatcher->result();
 
-        // create a hash of the html (because
-        const QString hash =
-            QString(QCryptographicHash::hash(html.toLocal8Bit(), QCryptographicHash::Sha1).toHex());
+    if (_notePreviewJobPending) {
+        startNotePreviewJob();
+    }
 
-        // update the note preview if the text has changed
-        // we use our hash because ui->noteTextView->toHtml() may return
-        // a different text than before
-        if (_notePreviewHash != hash) {
-#ifdef USE_QLITEHTML
-            _notePreviewWidget->setHtml(html);
-#else
-            ui->noteTextView->setHtml(html);
-#endif
-            _notePreviewHash = hash;
-        }
+    if (result.first != _notePreviewRevision) {
+        return;
     }
 
-    // update the slider when editing notes
+    setNotePreviewHtml(result.second);
     noteTextSliderValueChanged(activeNoteTextEdit()->verticalScrollBar()->value(), true);
 }
 
@@ -4587,7 +5913,16 @@ void MainWindow::startNavigationParser() {
         ui->navigationWidget->parse(activeNoteTextEdit()->document(),
                                     activeNoteTextEdit()->textCursor().position());
     } else if (ui->backlinkWidget->isVisible()) {
-        ui->backlinkWidget->findBacklinks(currentNote);
+        // the backlinks are only searched again if a note linking to the
+        // current note changed, the lookup in the link index is cheap; with
+        // note:// links, which the index doesn't know, they are always searched
+        const QString notePath = NoteLinkIndex::notePath(currentNote);
+        QString signature = noteLinkSignature(notePath, NoteLinkIndex::backlinks(notePath));
+
+        if (signature != _backlinkSignature || NoteLinkIndex::hasLegacyLinks()) {
+            _backlinkSignature = std::move(signature);
+            ui->backlinkWidget->findBacklinks(currentNote);
+        }
     }
 }
 
@@ -4884,6 +6219,8 @@ void MainWindow::unsetCurrentNote() {
     currentNote = Note();
 
     // clear the note preview
+    _notePreviewRevision++;
+    _notePreviewJobPending = false;
 #ifndef USE_QLITEHTML
     const QSignalBlocker blocker(ui->noteTextView);
     ui->noteTextView->clear();
@@ -5104,20 +6441,35 @@ void MainWindow::removeTagFromSelectedNotes(const Tag &tag) {
 /**
  * Activates or deactivates a workaround for the ill behaving directory watcher
  *
+ * Events caused by our own writes still trickle in for a moment after the
+ * write, so re-enabling is delayed by 200ms, without blocking the GUI thread.
+ *
  * @param isNotesDirectoryWasModifiedDisabled
  * @param alsoHandleNotesWereModified
  */
 void MainWindow::directoryWatcherWorkaround(bool isNotesDirectoryWasModifiedDisabled,
                                             bool alsoHandleNotesWereModified) {
-    if (!isNotesDirectoryWasModifiedDisabled) {
-        Utils::Misc::waitMsecs(200);
-    }
+    // a later call supersedes a pending re-enabling
+    const int generation = ++_directoryWatcherWorkaroundGeneration;
+
+    const auto apply = [this, isNotesDirectoryWasModifiedDisabled, alsoHandleNotesWereModified] {
+        _isNotesDirectoryWasModifiedDisabled = isNotesDirectoryWasModifiedDisabled;
 
-    _isNotesDirectoryWasModifiedDisabled = isNotesDirectoryWasModifiedDisabled;
+        if (alsoHandleNotesWereModified) {
+            _isNotesWereModifiedDisabled = isNotesDirectoryWasModifiedDisabled;
+        }
+    };
 
-    if (alsoHandleNotesWereModified) {
-        _isNotesWereModifiedDisabled = isNotesDirectoryWasModifiedDisabled;
+    if (isNotesDirectoryWasModifiedDisabled) {
+        apply();
+        return;
     }
+
+    QTimer::singleShot(200, this, [this, generation, apply] {
+        if (generation == _directoryWatcherWorkaroundGeneration) {
+            apply();
+        }
+    });
 }
 
 /**
@@ -5212,6 +6564,7 @@ void MainWindow::openSettingsDialog(int page, bool openScriptRepository) {
 
 void MainWindow::forceRegenerateNotePreview() {
     _notePreviewHash.clear();
+    _notePreviewPatcher.reset();
     currentNote.resetNoteTextHtmlConversionHash();
     regenerateNotePreview();
 }
@@ -5582,18 +6935,29 @@ void MainWindow::on_noteTextEdit_textChanged() {
     startAutoReadOnlyModeIfEnabled();
 }
 
+/**
+ * Stores the text of the note text edit to the current note if it was changed
+ *
+ * The document revision only grows, so the text can only differ from the
+ * stored note text if the revision moved since the note text was set or
+ * stored. The file on disk isn't read here, external changes of the file
+ * are handled by checkCurrentNoteForExternalChange().
+ */
 void MainWindow::noteTextEditTextWasUpdated() {
-    Note note = this->currentNote;
-    note.updateNoteTextFromDisk();
+    const int revision = ui->noteTextEdit->document()->revision();
+    if (revision == _noteTextStoredRevision) {
+        return;
+    }
+    _noteTextStoredRevision = revision;
 
     // we are transforming line feeds, because in some instances Windows
     // managed to sneak some "special" line feeds in
-    const QString noteTextFromDisk = Utils::Misc::transformLineFeeds(note.getNoteText());
     QString text = Utils::Misc::transformLineFeeds(ui->noteTextEdit->toPlainText());
 
-    // store the note to the database if the note text differs from the one
-    // on the disk or the note was already modified but not stored to disk
-    if ((text != noteTextFromDisk || currentNote.getHasDirtyData())) {
+    // a note without dirty data has the same text in the database as on the
+    // disk, so we only need to compare the texts until the first change is stored
+    if (currentNote.getHasDirtyData() ||
+        text != Utils::Misc::transformLineFeeds(currentNote.getNoteText())) {
         this->currentNote.storeNewText(std::move(text));
         this->currentNote.refetch();
         this->currentNoteLastEdited = QDateTime::currentDateTime();
@@ -5607,9 +6971,7 @@ void MainWindow::noteTextEditTextWasUpdated() {
 }
 
 void MainWindow::handleNoteTextChanged() {
-    SettingsService settings;
-    if (settings.value(QStringLiteral("notesPanelSort"), SORT_BY_LAST_CHANGE).toInt() ==
-        SORT_BY_LAST_CHANGE) {
+    if (_settingsSnapshot.values().notesPanelSort == SORT_BY_LAST_CHANGE) {
         makeCurrentNoteFirstInNoteList();
     } else if (Utils::Misc::isNoteListPreview()) {
         updateNoteTreeWidgetItem(currentNote);
@@ -5668,6 +7030,9 @@ void MainWindow::filterNotes(bool searchForText) {
         // first, instead the first occurrence should be found first
         ui->noteTextEdit->searchWidget()->doSearchDown();
     }
+
+    // other rows may have become visible
+    scheduleNoteTreeWidgetDecoration();
 }
 
 /**
@@ -5679,6 +7044,10 @@ bool MainWindow::isTagsEnabled() { return _taggingDockWidget->isVisible(); }
  * Checks if the Markdown view is enabled
  */
 bool MainWindow::isMarkdownViewEnabled() {
+    if (s_self != nullptr) {
+        return s_self->_settingsSnapshot.values().markdownViewEnabled;
+    }
+
     SettingsService settings;
     return settings.value(QStringLiteral("markdownViewEnabled"), true).toBool();
 }
@@ -5706,16 +7075,36 @@ void MainWindow::filterNotesBySearchLineEditText(bool searchInNote) {
             doSearchInNote(searchText);
         }
 
-        QVector<int> noteIdList = Note::searchInNotes(
-            searchText, _showNotesFromAllNoteSubFolders ||
-                            NoteSubFolder::isNoteSubfoldersPanelShowNotesRecursively());
+        const bool ignoreNoteSubFolder = _showNotesFromAllNoteSubFolders ||
+                                         NoteSubFolder::isNoteSubfoldersPanelShowNotesRecursively();
+        const QStringList searchTextTerms = Note::buildQueryStringList(searchText);
+
+        // note id -> occurrences of the search terms, ids and counts come
+        // from the full-text index with one query if the terms allow it
+        QVector<NoteSearchIndex::Term> indexTerms;
+        for (const QString &word : searchTextTerms) {
+            NoteSearchIndex::Term term;
+            term.nameOnly = Note::isNameSearch(word);
+            term.text = term.nameOnly ? Note::removeNameSearchPrefix(word) : word;
+            indexTerms << term;
+        }
+
+        QHash<int, int> noteMatches;
+        if (!NoteSearchIndex::search(
+                indexTerms, ignoreNoteSubFolder ? -1 : NoteSubFolder::activeNoteSubFolderId(),
+                &noteMatches)) {
+            const QVector<int> noteIdList = Note::searchInNotes(searchText, ignoreNoteSubFolder);
+            noteMatches.reserve(noteIdList.size());
+            for (const int noteId : noteIdList) {
+                // -1: still has to be counted
+                noteMatches.insert(noteId, -1);
+            }
+        }
 
         int columnWidth = ui->noteTreeWidget->columnWidth(0);
         ui->noteTreeWidget->setColumnCount(2);
         int maxWidth = 0;
-        const QStringList searchTextTerms = Note::buildQueryStringList(searchText);
-        const SettingsService settings;
-        const bool showMatches = settings.value(QStringLiteral("showMatches"), true).toBool();
+        const bool showMatches = _settingsSnapshot.values().showMatches;
 
         while (*it) {
             QTreeWidgetItem *item = *it;
@@ -5727,23 +7116,24 @@ void MainWindow::filterNotesBySearchLineEditText(bool searchInNote) {
             }
 
             const int noteId = item->data(0, Qt::UserRole).toInt();
-            bool isHidden = noteIdList.indexOf(noteId) < 0;
+            const auto match = noteMatches.constFind(noteId);
+            bool isHidden = match == noteMatches.constEnd();
 
             // hide all filtered notes
             item->setHidden(isHidden);
 
             // count occurrences of search terms in notes
             if (!isHidden && showMatches) {
-                const Note note = Note::fetch(noteId);
                 item->setForeground(1, QColor(Qt::gray));
-                int count = 0;
+                int count = match.value();
 
-                for (QString word : searchTextTerms) {
-                    if (Note::isNameSearch(word)) {
-                        word = Note::removeNameSearchPrefix(word);
-                    }
+                if (count < 0) {
+                    const Note note = Note::fetch(noteId);
+                    count = 0;
 
-                    count += note.countSearchTextInNote(word);
+                    for (const NoteSearchIndex::Term &term : Utils::asConst(indexTerms)) {
+                        count += note.countSearchTextInNote(term.text);
+                    }
                 }
 
                 const QString text = QString::number(count);
@@ -5820,7 +7210,11 @@ void MainWindow::filterNotesByTag() {
     }
 
     const int tagId = Tag::activeTagId();
-    QVector<int> noteIdList;
+    NoteIdBitmap noteIds;
+
+    // the note id sets of tags stay valid until one of the databases changes,
+    // so switching between tags only costs set unions
+    _tagFilterNoteIds.validate();
 
     switch (tagId) {
         case Tag::AllNotesId:
@@ -5828,7 +7222,8 @@ void MainWindow::filterNotesByTag() {
             return;
         case Tag::AllUntaggedNotesId:
             // get all note names that are not tagged
-            noteIdList = Note::fetchAllNotTaggedIds();
+            noteIds = _tagFilterNoteIds.value(QStringLiteral("untagged"),
+                                              [] { return Note::fetchAllNotTaggedIds(); });
             break;
         default:
             // check for multiple active;
@@ -5866,27 +7261,45 @@ void MainWindow::filterNotesByTag() {
             const auto selectedFolderItems = ui->noteSubFolderTreeWidget->selectedItems();
 
             const bool showNotesFromAllNoteSubFolders = _showNotesFromAllNoteSubFolders;
-            noteIdList.reserve(tagIdList.count() * 2);
+            // the Tag queries take the notes of the note subfolders below the
+            // selected ones into account if this is enabled
+            const int showNotesRecursively =
+                int(NoteSubFolder::isNoteSubfoldersPanelShowNotesRecursively());
             if (selectedFolderItems.count() > 1) {
-                for (const int tagId_ : Utils::asConst(tagIdList)) {
-                    for (const QTreeWidgetItem *i : selectedFolderItems) {
-                        const int id = i->data(0, Qt::UserRole).toInt();
-                        const NoteSubFolder folder = NoteSubFolder::fetch(id);
+                for (const QTreeWidgetItem *i : selectedFolderItems) {
+                    const int id = i->data(0, Qt::UserRole).toInt();
+                    const NoteSubFolder folder = NoteSubFolder::fetch(id);
 
-                        noteIdList << Tag::fetchAllLinkedNoteIdsForFolder(
-                            tagId_, folder, showNotesFromAllNoteSubFolders);
+                    for (const int tagId_ : Utils::asConst(tagIdList)) {
+                        const QString key = QStringLiteral("tag/%1/folder/%2/%3/%4")
+                                                .arg(tagId_)
+                                                .arg(id)
+                                                .arg(int(showNotesFromAllNoteSubFolders))
+                                                .arg(showNotesRecursively);
+                        noteIds |= _tagFilterNoteIds.value(key, [&] {
+                            return Tag::fetchAllLinkedNoteIdsForFolder(
+                                tagId_, folder, showNotesFromAllNoteSubFolders);
+                        });
                     }
                 }
             } else {
+                // without all note subfolders the result depends on the active one
+                const int activeNoteSubFolderId =
+                    showNotesFromAllNoteSubFolders ? -1 : NoteSubFolder::activeNoteSubFolderId();
                 for (const int tagId_ : Utils::asConst(tagIdList)) {
-                    noteIdList << Tag::fetchAllLinkedNoteIds(tagId_,
-                                                             showNotesFromAllNoteSubFolders);
+                    const QString key = QStringLiteral("tag/%1/%2/%3")
+                                            .arg(tagId_)
+                                            .arg(activeNoteSubFolderId)
+                                            .arg(showNotesRecursively);
+                    noteIds |= _tagFilterNoteIds.value(key, [&] {
+                        return Tag::fetchAllLinkedNoteIds(tagId_, showNotesFromAllNoteSubFolders);
+                    });
                 }
             }
             break;
     }
 
-    qDebug() << __func__ << " - 'noteIdList': " << noteIdList;
+    qDebug() << __func__ << " - 'noteIds': " << noteIds.count();
 
     // omit the already hidden notes
     QTreeWidgetItemIterator it(ui->noteTreeWidget, QTreeWidgetItemIterator::NotHidden);
@@ -5902,7 +7315,7 @@ void MainWindow::filterNotesByTag() {
         // note subfolder are not taken into account here (note names are now
         // not unique), but it should be ok because they are filtered by
         // filterNotesByNoteSubFolders
-        if (!noteIdList.contains((*it)->data(0, Qt::UserRole).toInt())) {
+        if (!noteIds.contains((*it)->data(0, Qt::UserRole).toInt())) {
             (*it)->setHidden(true);
         }
 
@@ -6228,6 +7641,7 @@ void MainWindow::on_actionAlphabetical_triggered(bool checked) {
     if (checked) {
         SettingsService settings;
         settings.setValue(QStringLiteral("notesPanelSort"), SORT_ALPHABETICAL);
+        _settingsSnapshot.reload();
         loadNoteDirectoryList();
     }
 
@@ -6239,6 +7653,7 @@ void MainWindow::on_actionBy_date_triggered(bool checked) {
     if (checked) {
         SettingsService settings;
         settings.setValue(QStringLiteral("notesPanelSort"), SORT_BY_LAST_CHANGE);
+        _settingsSnapshot.reload();
         loadNoteDirectoryList();
     }
 
@@ -6618,7 +8033,7 @@ void MainWindow::on_actionInsert_image_triggered() {
  * Inserts a media file into the current note
  */
 bool MainWindow::insertMedia(QFile *file, QString title) {
-    QString text = currentNote.getInsertMediaMarkdown(file, true, false, std::move(title));
+    QString text = getInsertMediaMarkdown(currentNote, file, true, std::move(title));
 
     if (!text.isEmpty()) {
         ScriptingService *scriptingService = ScriptingService::instance();
@@ -6634,6 +8049,92 @@ bool MainWindow::insertMedia(QFile *file, QString title) {
     return false;
 }
 
+/**
+ * Returns the Markdown image link to a media file, relativePath is percent
+ * encoded so file names with spaces or non-ASCII characters work
+ */
+static QString mediaMarkdown(const QString &relativePath, const QString &title,
+                             bool addNewLine) {
+    QString text = QStringLiteral("![") + title + QStringLiteral("](") +
+                   QString::fromUtf8(QUrl::toPercentEncoding(relativePath, "/")) +
+                   QStringLiteral(")");
+
+    if (addNewLine) {
+        text += QStringLiteral("\n");
+    }
+
+    return text;
+}
+
+/**
+ * Returns the Markdown code to insert a media file into a note
+ * A file with the same content that is already in the media folder is reused
+ * instead of storing another copy, see MediaStore
+ */
+QString MainWindow::getInsertMediaMarkdown(Note &note, QFile *file, bool addNewLine,
+                                           QString title) {
+    const QString hash = MediaStore::hash(file->fileName());
+    QString filePath = MediaStore::findFile(hash);
+
+    if (!filePath.isEmpty()) {
+        if (title.isEmpty()) {
+            title = QFileInfo(filePath).baseName();
+        }
+
+        return mediaMarkdown(note.relativeFilePath(filePath), title, addNewLine);
+    }
+
+    const QString text = note.getInsertMediaMarkdown(file, addNewLine, false, std::move(title));
+
+    // remember the new file in the media folder by its content
+    static const QRegularExpression linkRe(QStringLiteral(R"(^!\[(.*)\]\((.+?)\))"));
+    const QRegularExpressionMatch match = linkRe.match(text);
+    const QString url = match.captured(2);
+    filePath = QFileInfo(note.fullNoteFilePath())
+                   .dir()
+                   .absoluteFilePath(QUrl::fromPercentEncoding(url.toUtf8()));
+
+    if (url.isEmpty() || !QFileInfo::exists(filePath)) {
+        return text;
+    }
+
+    MediaStore::addFile(hash, filePath);
+
+    // the same link as for a reused file
+    return mediaMarkdown(note.relativeFilePath(filePath), match.captured(1), addNewLine);
+}
+
+/**
+ * Imports an image data url into the media folder and returns the Markdown
+ * code for it, like Note::importMediaFromDataUrl() but with the same
+ * deduplication as insertMedia()
+ */
+QString MainWindow::importMediaFromDataUrl(Note &note, const QString &dataUrl) {
+    static const QRegularExpression re(
+        QStringLiteral(R"(^data:image/([\w.+-]+);base64,([A-Za-z0-9+/=\s]+)$)"));
+    const QRegularExpressionMatch match = re.match(dataUrl);
+
+    if (!match.hasMatch()) {
+        return note.importMediaFromDataUrl(dataUrl);
+    }
+
+    QString suffix = match.captured(1).section(QLatin1Char('+'), 0, 0).toLower();
+    if (suffix == QLatin1String("jpeg")) {
+        suffix = QStringLiteral("jpg");
+    }
+
+    const QByteArray data = QByteArray::fromBase64(match.captured(2).toLatin1());
+    QTemporaryFile tempFile(QDir::tempPath() + QDir::separator() +
+                            QStringLiteral("qownnotes-media-XXXXXX.") + suffix);
+
+    if (data.isEmpty() || !tempFile.open() || tempFile.write(data) != data.size() ||
+        !tempFile.flush()) {
+        return QString();
+    }
+
+    return getInsertMediaMarkdown(note, &tempFile);
+}
+
 void MainWindow::insertNoteText(const QString &text) {
     QOwnNotesMarkdownTextEdit *textEdit = activeNoteTextEdit();
     QTextCursor c = textEdit->textCursor();
@@ -7336,7 +8837,8 @@ void MainWindow::handleInsertingFromMimeData(const QMimeData *mimeData) {
 
 /**
  * Inserts html as Markdown in the current note
- * Images are also downloaded
+ * Images are downloaded in the background, their Markdown code replaces a
+ * placeholder when they are stored in the media folder
  */
 void MainWindow::insertHtmlAsMarkdownIntoCurrentNote(QString html) {
     // convert html tags to Markdown
@@ -7347,13 +8849,15 @@ void MainWindow::insertHtmlAsMarkdownIntoCurrentNote(QString html) {
                                        QRegularExpression::CaseInsensitiveOption);
     QRegularExpressionMatchIterator i = re.globalMatch(html);
 
+    int downloadCount = 0;
+
     // find, download locally and replace all images
     while (i.hasNext()) {
         QRegularExpressionMatch match = i.next();
         const QString imageTag = match.captured(0);
         const QString imageUrlText = match.captured(1).trimmed();
         // try to import a media file into the current note
-        QString markdownCode = currentNote.importMediaFromDataUrl(imageUrlText);
+        QString markdownCode = importMediaFromDataUrl(currentNote, imageUrlText);
 
         // if no inline-image was detected try to download the url
         if (markdownCode.isEmpty()) {
@@ -7365,11 +8869,15 @@ void MainWindow::insertHtmlAsMarkdownIntoCurrentNote(QString html) {
                 continue;
             }
 
-            showStatusBarMessage(tr("Downloading %1").arg(imageUrl.toString()), QStringLiteral("⬇️️"),
-                                 0);
-
-            // download the image and get the media Markdown code for it
-            markdownCode = currentNote.downloadUrlToMedia(imageUrl);
+            // the placeholder survives the removal of the html tags below, it
+            // is matched literally, so it isn't translated, and it is unique
+            // beyond this session in case a note keeps an unfinished one
+            markdownCode = QStringLiteral("![Downloading image](image-download:") +
+                           QUuid::createUuid().toString(QUuid::WithoutBraces) +
+                           QStringLiteral(")");
+            _pendingImageDownloads[imageUrl].append(qMakePair(currentNote.getId(), markdownCode));
+            _imageDownloadPool->download(imageUrl);
+            downloadCount++;
         }
 
         if (!markdownCode.isEmpty()) {
@@ -7378,7 +8886,10 @@ void MainWindow::insertHtmlAsMarkdownIntoCurrentNote(QString html) {
         }
     }
 
-    showStatusBarMessage(tr("Downloading images finished"), QStringLiteral("🖼️"), 3000);
+    if (downloadCount > 0) {
+        showStatusBarMessage(tr("Downloading %n image(s)", "", downloadCount),
+                             QStringLiteral("⬇️️"), 0);
+    }
 
     // remove all html tags
     static const QRegularExpression tagRE(QStringLiteral("<.+?>"));
@@ -7393,6 +8904,82 @@ void MainWindow::insertHtmlAsMarkdownIntoCurrentNote(QString html) {
     c.insertText(html);
 }
 
+/**
+ * Replaces the placeholders of a downloaded image with its Markdown code
+ * An image that couldn't be downloaded (empty data) is removed
+ */
+void MainWindow::imageDownloadFinished(const QUrl &url, const QByteArray &data,
+                                       const QString &suffix) {
+    const auto placeholders = _pendingImageDownloads.take(url);
+
+    // the media file is named after the image in the url, the file name of
+    // the temporary file is where the note takes it from
+    static const QRegularExpression invalidCharactersRe(QStringLiteral(R"([^\w.-]+)"));
+    QString baseName = QFileInfo(url.path()).fileName();
+    if (baseName.endsWith(QLatin1Char('.') + suffix, Qt::CaseInsensitive)) {
+        baseName.chop(suffix.size() + 1);
+    }
+    baseName = baseName.replace(invalidCharactersRe, QStringLiteral("-")).left(64);
+    if (baseName.isEmpty() || baseName.startsWith(QLatin1Char('.'))) {
+        baseName.prepend(QStringLiteral("image"));
+    }
+    const QTemporaryDir tempDir;
+
+    // the image is imported once per note, its Markdown code depends on the
+    // note subfolder
+    QHash<int, QString> markdownCodes;
+
+    for (const auto &placeholder : placeholders) {
+        const int noteId = placeholder.first;
+
+        if (!data.isEmpty() && !markdownCodes.contains(noteId)) {
+            Note note = Note::fetch(noteId);
+            QFile file(tempDir.filePath(baseName + QLatin1Char('.') + suffix));
+            QString markdownCode;
+
+            if (note.isFetched() && tempDir.isValid() && file.open(QIODevice::WriteOnly) &&
+                file.write(data) == data.size() && file.flush()) {
+                markdownCode = getInsertMediaMarkdown(note, &file);
+            }
+            file.remove();
+
+            markdownCodes.insert(noteId, markdownCode);
+        }
+
+        replaceImageDownloadPlaceholder(noteId, placeholder.second, markdownCodes.value(noteId));
+    }
+
+    if (_pendingImageDownloads.isEmpty()) {
+        showStatusBarMessage(tr("Downloading images finished"), QStringLiteral("🖼️"), 3000);
+    } else {
+        showStatusBarMessage(tr("Downloading %n image(s)", "", _pendingImageDownloads.size()),
+                             QStringLiteral("⬇️️"), 0);
+    }
+}
+
+void MainWindow::replaceImageDownloadPlaceholder(int noteId, const QString &placeholder,
+                                                 const QString &markdownCode) {
+    // the current note is changed in the editor to keep the undo history
+    if (noteId == currentNote.getId()) {
+        QTextCursor cursor = activeNoteTextEdit()->document()->find(placeholder);
+
+        if (!cursor.isNull()) {
+            cursor.insertText(markdownCode);
+            return;
+        }
+    }
+
+    Note note = Note::fetch(noteId);
+    QString text = note.getNoteText();
+
+    if (!note.isFetched() || !text.contains(placeholder)) {
+        return;
+    }
+
+    text.replace(placeholder, markdownCode);
+    note.storeNewText(std::move(text));
+}
+
 void MainWindow::resetBrokenTagNotesLinkFlag() {
     if (_brokenTagNoteLinksRemoved) _brokenTagNoteLinksRemoved = false;
 }
@@ -7584,6 +9171,135 @@ void MainWindow::hideNoteFolderComboBoxIfNeeded() {
     }
 }
 
+/**
+ * Everything the tag panel shows, fetched with a handful of queries by
+ * MainWindow::reloadTagTree() and assembled in memory instead of querying
+ * per tag and per tree level
+ */
+struct TagTreeData {
+    QHash<int, QVector<TagHeader>> tagsByParentId;
+    // tag id -> "<note subfolder path>\n<file name>" of the linked notes that
+    // pass the note subfolder selection
+    QHash<int, QSet<QString>> linkedNotesByTagId;
+    QSet<QString> allLinkedNotes;
+    QSet<int> coloredTagIds;
+    bool colorsKnown = false;
+    QSet<QString> expandedTagIds;
+    int activeTagId = 0;
+    int sort = 0;
+    int order = 0;
+    bool hideCount = false;
+    bool countRecursively = false;
+
+    static QString noteKey(const QString &noteSubFolderPath, const QString &fileName) {
+        return noteSubFolderPath + QLatin1Char('\n') + fileName;
+    }
+
+    /**
+     * @param folderPaths the relative paths of the selected note subfolders,
+     *                    links in other note subfolders aren't counted
+     */
+    bool load(const QStringList &folderPaths, bool fromAllSubFolders, bool recursive) {
+        QSqlDatabase db = QSqlDatabase::database(QStringLiteral("note_folder"));
+        QSqlQuery query(db);
+        query.setForwardOnly(true);
+
+        // the whole hierarchy in one query, same order as
+        // Tag::fetchAllTagHeadersByParentId()
+        if (!query.exec(
+                QStringLiteral("SELECT id, name, parent_id FROM tag ORDER BY created DESC"))) {
+            return false;
+        }
+        while (query.next()) {
+            TagHeader header;
+            header._id = query.value(0).toInt();
+            header._name = query.value(1).toString();
+            tagsByParentId[query.value(2).toInt()] << header;
+        }
+
+        if (query.exec(
+                QStringLiteral("SELECT id FROM tag WHERE color IS NOT NULL AND color != ''"))) {
+            colorsKnown = true;
+            while (query.next()) {
+                coloredTagIds << query.value(0).toInt();
+            }
+        }
+
+        // all links in one query, the counts are computed in memory
+        if (!query.exec(QStringLiteral(
+                "SELECT tag_id, note_sub_folder_path, note_file_name FROM noteTagLink"))) {
+            return false;
+        }
+        while (query.next()) {
+            const QString path = query.value(1).toString();
+            const QString key = noteKey(path, query.value(2).toString());
+            allLinkedNotes << key;
+
+            bool isInSelection = fromAllSubFolders;
+            for (int i = 0; i < folderPaths.size() && !isInSelection; ++i) {
+                isInSelection =
+                    recursive ? path.startsWith(folderPaths.at(i)) : path == folderPaths.at(i);
+            }
+
+            if (isInSelection) {
+                linkedNotesByTagId[query.value(0).toInt()] << key;
+            }
+        }
+
+        return true;
+    }
+
+    int linkCount(int tagId) const {
+        if (!countRecursively) {
+            return linkedNotesByTagId.value(tagId).size();
+        }
+
+        // notes linked to the tag or one of its descendants, each note once
+        QSet<QString> notes;
+        QVector<int> pending{tagId};
+        while (!pending.isEmpty()) {
+            const int id = pending.takeLast();
+            notes.unite(linkedNotesByTagId.value(id));
+            for (const TagHeader &child : tagsByParentId.value(id)) {
+                pending << child._id;
+            }
+        }
+        return notes.size();
+    }
+
+    /**
+     * Counts all and the untagged notes of some note subfolders with one query
+     */
+    void countNotes(const QVector<int> &noteSubFolderIds, int *noteCount,
+                    int *untaggedNoteCount) const {
+        QHash<int, QString> paths;
+        for (const int noteSubFolderId : noteSubFolderIds) {
+            paths.insert(noteSubFolderId,
+                         noteSubFolderId == 0 ? QString()
+                                              : NoteSubFolder::fetch(noteSubFolderId).relativePath());
+        }
+
+        *noteCount = 0;
+        *untaggedNoteCount = 0;
+        QSqlQuery query(QSqlDatabase::database(QStringLiteral("memory")));
+        query.setForwardOnly(true);
+        if (!query.exec(QStringLiteral("SELECT note_sub_folder_id, file_name FROM note"))) {
+            return;
+        }
+        while (query.next()) {
+            const auto path = paths.constFind(query.value(0).toInt());
+            if (path == paths.constEnd()) {
+                continue;
+            }
+
+            ++*noteCount;
+            if (!allLinkedNotes.contains(noteKey(path.value(), query.value(1).toString()))) {
+                ++*untaggedNoteCount;
+            }
+        }
+    }
+};
+
 /**
  * Reloads the tag tree
  */
@@ -7627,15 +9343,60 @@ void MainWindow::reloadTagTree() {
 
     qDebug() << __func__ << " - 'noteSubFolderIds': " << noteSubFolderIds;
 
-    QVector<int> noteIdList;
+    // tags, links and colors in a few queries instead of a few per tag
+    TagTreeData tagTreeData;
+    tagTreeData.hideCount = _settingsSnapshot.values().tagsPanelHideNoteCount;
+    tagTreeData.countRecursively = Tag::isTaggingShowNotesRecursively();
+    tagTreeData.activeTagId = Tag::activeTagId();
+    tagTreeData.sort = settings.value(QStringLiteral("tagsPanelSort")).toInt();
+    tagTreeData.order = settings.value(QStringLiteral("tagsPanelOrder")).toInt();
+    const QStringList expandedList =
+        settings
+            .value(QStringLiteral("MainWindow/tagTreeWidgetExpandState-") +
+                   QString::number(NoteFolder::currentNoteFolderId()))
+            .toStringList();
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
+    tagTreeData.expandedTagIds = QSet<QString>(expandedList.begin(), expandedList.end());
+#else
+    tagTreeData.expandedTagIds = expandedList.toSet();
+#endif
+
+    QStringList folderPaths;
+    const auto selectedSubFolderItems = ui->noteSubFolderTreeWidget->selectedItems();
+    if (selectedSubFolderItems.count() > 1) {
+        for (QTreeWidgetItem *folderItem : selectedSubFolderItems) {
+            const NoteSubFolder folder =
+                NoteSubFolder::fetch(folderItem->data(0, Qt::UserRole).toInt());
+            if (folder.isFetched()) {
+                folderPaths << folder.relativePath();
+            }
+        }
+    } else {
+        const int activeNoteSubFolderId = NoteSubFolder::activeNoteSubFolderId();
+        folderPaths << (activeNoteSubFolderId == 0
+                            ? QString()
+                            : NoteSubFolder::fetch(activeNoteSubFolderId).relativePath());
+    }
+
+    const bool hasTagTreeData =
+        tagTreeData.load(folderPaths, _showNotesFromAllNoteSubFolders,
+                         NoteSubFolder::isNoteSubfoldersPanelShowNotesRecursively());
+    _tagTreeData = hasTagTreeData ? &tagTreeData : nullptr;
+    const QScopeGuard resetTagTreeData([this] { _tagTreeData = nullptr; });
+
+    int noteCount = 0;
     int untaggedNoteCount = 0;
 
     if (NoteFolder::isCurrentShowSubfolders()) {
-        // get the notes from the subfolders
-        for (int noteSubFolderId : Utils::asConst(noteSubFolderIds)) {
-            // get all notes of a note sub folder
-            untaggedNoteCount += Note::countAllNotTagged(noteSubFolderId);
-            noteIdList << Note::fetchAllIdsByNoteSubFolderId(noteSubFolderId);
+        if (hasTagTreeData) {
+            tagTreeData.countNotes(noteSubFolderIds, &noteCount, &untaggedNoteCount);
+        } else {
+            // get the notes from the subfolders
+            for (int noteSubFolderId : Utils::asConst(noteSubFolderIds)) {
+                // get all notes of a note sub folder
+                untaggedNoteCount += Note::countAllNotTagged(noteSubFolderId);
+                noteCount += Note::fetchAllIdsByNoteSubFolderId(noteSubFolderId).count();
+            }
         }
     } else {
         untaggedNoteCount = Note::countAllNotTagged(0);
@@ -7644,7 +9405,7 @@ void MainWindow::reloadTagTree() {
     // create an item to view all notes
     int linkCount = _showNotesFromAllNoteSubFolders || !NoteFolder::isCurrentShowSubfolders()
                         ? Note::countAll()
-                        : noteIdList.count();
+                        : noteCount;
     QString toolTip = tr("Show all notes (%1)").arg(QString::number(linkCount));
 
     auto *allItem = new QTreeWidgetItem();
@@ -7711,6 +9472,12 @@ void MainWindow::reloadNoteSubFolderTree() {
 void MainWindow::buildTagTreeForParentItem(QTreeWidgetItem *parent, bool topLevel) {
     const int parentId =
         (parent == nullptr || topLevel) ? 0 : parent->data(0, Qt::UserRole).toInt();
+
+    if (_tagTreeData != nullptr) {
+        buildTagTreeFromData(parent, parentId);
+        return;
+    }
+
     const int activeTagId = Tag::activeTagId();
     SettingsService settings;
     const QStringList expandedList =
@@ -7749,6 +9516,36 @@ void MainWindow::buildTagTreeForParentItem(QTreeWidgetItem *parent, bool topLeve
     // QCoreApplication::processEvents();
 }
 
+/**
+ * Populates the tag tree below parentId from the data of reloadTagTree(),
+ * without any further queries
+ */
+void MainWindow::buildTagTreeFromData(QTreeWidgetItem *parent, int parentId) {
+    const auto tagList = _tagTreeData->tagsByParentId.value(parentId);
+    for (const TagHeader &tag : tagList) {
+        const int tagId = tag._id;
+        QTreeWidgetItem *item = addTagToTagTreeWidget(parent, tag);
+
+        // set the active item
+        if (_tagTreeData->activeTagId == tagId) {
+            const QSignalBlocker blocker(ui->tagTreeWidget);
+            Q_UNUSED(blocker)
+
+            ui->tagTreeWidget->setCurrentItem(item);
+        }
+
+        // recursively populate the next level
+        buildTagTreeFromData(item, tagId);
+
+        // set expanded state
+        item->setExpanded(_tagTreeData->expandedTagIds.contains(QString::number(tagId)));
+
+        if (_tagTreeData->sort == SORT_ALPHABETICAL) {
+            item->sortChildren(0, Utils::Gui::toQtOrder(_tagTreeData->order));
+        }
+    }
+}
+
 /**
  * Ads a tag to the tag tree widget
  */
@@ -7756,13 +9553,17 @@ QTreeWidgetItem *MainWindow::addTagToTagTreeWidget(QTreeWidgetItem *parent, cons
     const int parentId = parent == nullptr ? 0 : parent->data(0, Qt::UserRole).toInt();
     const int tagId = tag._id;
     const QString name = tag._name;
-    auto hideCount = SettingsService().value("tagsPanelHideNoteCount", false).toBool();
+    auto hideCount = _tagTreeData != nullptr ? _tagTreeData->hideCount
+                                             : _settingsSnapshot.values().tagsPanelHideNoteCount;
 
     int linkCount = 0;
     QVector<int> linkedNoteIds;
     bool isMultipleTags = false;
 
-    if (!hideCount) {
+    if (_tagTreeData != nullptr) {
+        // counted in memory by reloadTagTree()
+        linkCount = hideCount ? 0 : _tagTreeData->linkCount(tagId);
+    } else if (!hideCount) {
         const QVector<int> tagIdListToCount = Tag::isTaggingShowNotesRecursively()
                                                   ? Tag::fetchTagIdsRecursivelyByParentId(tagId)
                                                   : QVector<int>{tag._id};
@@ -7837,8 +9638,12 @@ QTreeWidgetItem *MainWindow::addTagToTagTreeWidget(QTreeWidgetItem *parent, cons
     item->setToolTip(1, toolTip);
     item->setFlags(item->flags() | Qt::ItemIsEditable);
 
-    // set the color of the tag tree widget item
-    Utils::Gui::handleTreeWidgetItemTagColor(item, tagId);
+    // set the color of the tag tree widget item, a tag without a color
+    // doesn't need to be fetched
+    if (_tagTreeData == nullptr || !_tagTreeData->colorsKnown ||
+        _tagTreeData->coloredTagIds.contains(tagId)) {
+        Utils::Gui::handleTreeWidgetItemTagColor(item, tagId);
+    }
 
     if (parentId == 0) {
         // add the item at top level if there was no parent item
@@ -8105,63 +9910,177 @@ void MainWindow::handleScriptingNotesTagUpdating() {
 
     qDebug() << __func__;
 
+    QSqlDatabase db = QSqlDatabase::database(QStringLiteral("note_folder"));
+    QSqlQuery query(db);
+
+    // tag ids by name, the first tag of a name like Tag::fetchByName()
+    QHash<QString, int> tagIdsByName;
+    QSet<int> tagIds;
+    query.setForwardOnly(true);
+    if (!query.exec(QStringLiteral("SELECT id, name FROM tag ORDER BY id"))) {
+        return;
+    }
+    while (query.next()) {
+        const int tagId = query.value(0).toInt();
+        const QString name = query.value(1).toString();
+        tagIds << tagId;
+        if (!tagIdsByName.contains(name)) {
+            tagIdsByName.insert(name, tagId);
+        }
+    }
+    query.finish();
+
     // workaround when signal blocking doesn't work correctly
     directoryWatcherWorkaround(true, true);
 
+    // the links the notes should have, they are reconciled with the
+    // noteTagLink table in two statements below
+    QVariantList noteFileNames;
+    QVariantList noteSubFolderPaths;
+    QVariantList linkTagIds;
+    QVariantList linkFileNames;
+    QVariantList linkSubFolderPaths;
+    QHash<int, QString> subFolderPaths;
+    QHash<int, NoteTaggingHookResult> hookResults;
+
     const QVector<Note> &notes = Note::fetchAll();
     for (const Note &note : notes) {
-        QSet<int> tagIdList;
-        const QStringList tagNameList = ScriptingService::instance()
-                                            ->callNoteTaggingHook(note, QStringLiteral("list"))
-                                            .toStringList();
-
-        if (tagNameList.count() == 0) {
-            // if callNoteTaggingHook didn't return anything lets try
-            // callNoteTaggingByObjectHook
-            const auto variantTagIdList =
-                ScriptingService::instance()
-                    ->callNoteTaggingByObjectHook(note, QStringLiteral("list"))
-                    .toList();
-
-            // get a tagId list from the variant list
-            for (const QVariant &tagId : variantTagIdList) {
-                tagIdList << tagId.toInt();
-            }
-        } else {
-            // get a tagId list from the tag name list
-            for (const QString &tagName : tagNameList) {
-                Tag tag = Tag::fetchByName(tagName);
-
-                // add missing tags to the tag database
-                if (!tag.isFetched()) {
-                    tag.setName(tagName);
-                    tag.store();
+        // the hook is only called for notes that were changed since the last run
+        const quint64 fingerprint = NoteChangeReconciler::fingerprint(note.getNoteText());
+        NoteTaggingHookResult result = _noteTaggingHookResults.value(note.getId());
+
+        if (result.fileName != note.getFileName() ||
+            result.noteSubFolderId != note.getNoteSubFolderId() ||
+            result.fingerprint != fingerprint) {
+            result.fileName = note.getFileName();
+            result.noteSubFolderId = note.getNoteSubFolderId();
+            result.fingerprint = fingerprint;
+            result.tagIds.clear();
+            result.tagNames = ScriptingService::instance()
+                                  ->callNoteTaggingHook(note, QStringLiteral("list"))
+                                  .toStringList();
+
+            if (result.tagNames.count() == 0) {
+                // if callNoteTaggingHook didn't return anything lets try
+                // callNoteTaggingByObjectHook
+                const auto variantTagIdList =
+                    ScriptingService::instance()
+                        ->callNoteTaggingByObjectHook(note, QStringLiteral("list"))
+                        .toList();
+
+                // get a tagId list from the variant list
+                for (const QVariant &tagId : variantTagIdList) {
+                    result.tagIds << tagId.toInt();
                 }
-
-                tagIdList << tag.getId();
             }
         }
 
-        QSet<int> tagIdList2 = Tag::fetchAllIdsByNote(note);
+        hookResults.insert(note.getId(), result);
+
+        const int noteSubFolderId = note.getNoteSubFolderId();
+        auto path = subFolderPaths.constFind(noteSubFolderId);
+        if (path == subFolderPaths.constEnd()) {
+            path = subFolderPaths.insert(noteSubFolderId, note.getNoteSubFolder().relativePath());
+        }
 
-        // we need to create a copy of tagIdList, because subtract would modify tagIdList
-        QSet<int> subtraction = tagIdList;
-        subtraction.subtract(tagIdList2);
+        noteFileNames << note.getFileName();
+        noteSubFolderPaths << path.value();
 
-        // add missing tag links to the note
-        for (const int tagId : subtraction) {
-            Tag tag = Tag::fetch(tagId);
-            tag.linkToNote(note);
-            qDebug() << " difference1: " << tag;
+        QSet<int> noteTagIds;
+        for (const int tagId : Utils::asConst(result.tagIds)) {
+            if (tagIds.contains(tagId)) {
+                noteTagIds << tagId;
+            }
         }
 
-        const QSet<int> subtraction1 = tagIdList2.subtract(tagIdList);
+        // get a tagId list from the tag name list
+        for (const QString &tagName : Utils::asConst(result.tagNames)) {
+            auto tagId = tagIdsByName.constFind(tagName);
 
-        // remove tags from the note that are not in the note text
-        for (const int tagId : subtraction1) {
-            Tag tag = Tag::fetch(tagId);
-            tag.removeLinkToNote(note);
-            qDebug() << " difference2: " << tag;
+            // add missing tags to the tag database
+            if (tagId == tagIdsByName.constEnd()) {
+                Tag tag;
+                tag.setName(tagName);
+                tag.store();
+                tagIds << tag.getId();
+                tagId = tagIdsByName.insert(tagName, tag.getId());
+            }
+
+            noteTagIds << tagId.value();
+        }
+
+        for (const int tagId : Utils::asConst(noteTagIds)) {
+            linkTagIds << tagId;
+            linkFileNames << note.getFileName();
+            linkSubFolderPaths << path.value();
+        }
+    }
+
+    // results of notes that don't exist anymore are dropped
+    _noteTaggingHookResults.swap(hookResults);
+
+    const bool inTransaction = db.transaction();
+
+    bool success =
+        query.exec(QStringLiteral("CREATE TEMP TABLE IF NOT EXISTS tagging_note "
+                                  "(note_file_name TEXT, note_sub_folder_path TEXT)")) &&
+        query.exec(
+            QStringLiteral("CREATE TEMP TABLE IF NOT EXISTS tagging_link "
+                           "(tag_id INTEGER, note_file_name TEXT, note_sub_folder_path TEXT)")) &&
+        query.exec(QStringLiteral("CREATE INDEX IF NOT EXISTS temp.idxTaggingNote "
+                                  "ON tagging_note (note_file_name)")) &&
+        query.exec(QStringLiteral("CREATE INDEX IF NOT EXISTS temp.idxTaggingLink "
+                                  "ON tagging_link (note_file_name, tag_id)")) &&
+        query.exec(QStringLiteral("DELETE FROM temp.tagging_note")) &&
+        query.exec(QStringLiteral("DELETE FROM temp.tagging_link"));
+
+    if (success) {
+        query.prepare(QStringLiteral("INSERT INTO temp.tagging_note "
+                                     "(note_file_name, note_sub_folder_path) VALUES (?, ?)"));
+        query.addBindValue(noteFileNames);
+        query.addBindValue(noteSubFolderPaths);
+        success = query.execBatch();
+    }
+
+    if (success) {
+        query.prepare(
+            QStringLiteral("INSERT INTO temp.tagging_link "
+                           "(tag_id, note_file_name, note_sub_folder_path) VALUES (?, ?, ?)"));
+        query.addBindValue(linkTagIds);
+        query.addBindValue(linkFileNames);
+        query.addBindValue(linkSubFolderPaths);
+        success = query.execBatch();
+    }
+
+    // add the missing tag links and remove the links the notes don't have anymore
+    success = success &&
+              query.exec(QStringLiteral(
+                  "INSERT INTO noteTagLink (tag_id, note_file_name, note_sub_folder_path) "
+                  "SELECT DISTINCT l.tag_id, l.note_file_name, l.note_sub_folder_path "
+                  "FROM temp.tagging_link l WHERE NOT EXISTS (SELECT 1 FROM noteTagLink o "
+                  "WHERE o.tag_id = l.tag_id AND o.note_file_name = l.note_file_name "
+                  "AND COALESCE(o.note_sub_folder_path, '') = "
+                  "COALESCE(l.note_sub_folder_path, ''))")) &&
+              query.exec(QStringLiteral(
+                  "DELETE FROM noteTagLink WHERE EXISTS (SELECT 1 FROM temp.tagging_note n "
+                  "WHERE n.note_file_name = noteTagLink.note_file_name "
+                  "AND COALESCE(n.note_sub_folder_path, '') = "
+                  "COALESCE(noteTagLink.note_sub_folder_path, '')) "
+                  "AND NOT EXISTS (SELECT 1 FROM temp.tagging_link l "
+                  "WHERE l.note_file_name = noteTagLink.note_file_name "
+                  "AND l.tag_id = noteTagLink.tag_id "
+                  "AND COALESCE(l.note_sub_folder_path, '') = "
+                  "COALESCE(noteTagLink.note_sub_folder_path, ''))"));
+
+    if (!success) {
+        qWarning() << __func__ << " - could not update the tag links: " << query.lastError();
+    }
+
+    if (inTransaction) {
+        if (success) {
+            db.commit();
+        } else {
+            db.rollback();
         }
     }
 
@@ -8306,6 +10225,8 @@ void MainWindow::reloadCurrentNoteTags() {
 
         // overwrite the note preview with a preview of the selected notes
         const QString previewHtml = Note::generateMultipleNotesPreviewText(notes);
+        _notePreviewRevision++;
+        _notePreviewJobPending = false;
 #ifdef USE_QLITEHTML
         _notePreviewWidget->setHtml(previewHtml);
 #else
@@ -8629,8 +10550,8 @@ void MainWindow::on_tagTreeWidget_customContextMenuRequested(const QPoint pos) {
             disableColorOfTagItem(tagItem);
         }
 
-        // reload the notes in the note tree widget to update the colors
-        loadNoteDirectoryList();
+        // update the colors of the notes in the note tree widget
+        invalidateNoteTreeWidgetDecoration();
         return;
     }
 
@@ -8675,8 +10596,8 @@ void MainWindow::assignColorToTagItem(QTreeWidgetItem *item) {
         // set the color of the tag tree widget item
         Utils::Gui::handleTreeWidgetItemTagColor(item, tag);
 
-        // reload the notes in the note tree widget to update the colors
-        loadNoteDirectoryList();
+        // update the colors of the notes in the note tree widget
+        invalidateNoteTreeWidgetDecoration();
     }
 }
 
@@ -8732,8 +10653,8 @@ void MainWindow::assignColorToSelectedTagItems() {
         }
     }
 
-    // reload the notes in the note tree widget to update the colors
-    loadNoteDirectoryList();
+    // update the colors of the notes in the note tree widget
+    invalidateNoteTreeWidgetDecoration();
 }
 
 /**
@@ -9337,6 +11258,7 @@ void MainWindow::on_actionSelect_note_folder_triggered() {
  */
 void MainWindow::on_actionReload_scripting_engine_triggered() {
     ScriptingService::instance()->reloadEngine();
+    _noteTaggingHookResults.clear();
     showStatusBarMessage(tr("The scripting engine was reloaded"), QStringLiteral("🔧"), 3000);
     forceRegenerateNotePreview();
 }
@@ -10424,6 +12346,45 @@ void MainWindow::on_actionManage_stored_images_triggered() {
     _storedImagesDialog->show();
 }
 
+/**
+ * Asks to remove the media files of the store no note links to anymore,
+ * see MediaStore::unusedFiles()
+ */
+void MainWindow::removeUnusedMediaFiles() {
+    const QStringList filePaths = MediaStore::unusedFiles();
+
+    if (filePaths.isEmpty()) {
+        showStatusBarMessage(tr("No unused media files were found"), QStringLiteral("🖼️"),
+                             4000);
+        return;
+    }
+
+    const QDir noteFolderDir(NoteFolder::currentLocalPath());
+    QStringList fileNames;
+    for (const QString &filePath : Utils::asConst(filePaths)) {
+        fileNames << noteFolderDir.relativeFilePath(filePath).toHtmlEscaped();
+    }
+
+    if (fileNames.count() > 10) {
+        fileNames = fileNames.mid(0, 10);
+        fileNames << QStringLiteral("…");
+    }
+
+    if (Utils::Gui::question(
+            this, tr("Remove unused media files"),
+            tr("Remove %n media file(s) no note links to? Notes in the trash can't show "
+               "them anymore if they are restored.",
+               "", filePaths.count()) +
+                QStringLiteral("<br /><br />") + fileNames.join(QStringLiteral("<br />")),
+            QStringLiteral("remove-unused-media-files")) != QMessageBox::Yes) {
+        return;
+    }
+
+    const QStringList removedFiles = MediaStore::removeFiles(filePaths);
+    showStatusBarMessage(tr("Removed %n unused media file(s)", "", removedFiles.count()),
+                         QStringLiteral("🖼️"), 4000);
+}
+
 /**
  * Writes text to the note text edit (for ScriptingService)
  *
@@ -11067,9 +13028,7 @@ void MainWindow::noteEditCursorPositionChanged() {
     _noteEditLineNumberLabel->setText(text);
     _noteEditLineNumberLabel->setToolTip(toolTip);
 
-    const bool autoSelect =
-        SettingsService().value(QStringLiteral("navigationPanelAutoSelect"), true).toBool();
-    if (autoSelect) {
+    if (_settingsSnapshot.values().navigationPanelAutoSelect) {
         selectNavigationItemAtPosition(textEdit->textCursor().block().position());
     }
 }
@@ -12132,7 +14091,7 @@ void MainWindow::on_actionJump_to_navigation_panel_triggered() {
  * @return
  */
 bool MainWindow::insertDataUrlAsFileIntoCurrentNote(const QString &dataUrl) {
-    QString markdownCode = currentNote.importMediaFromDataUrl(dataUrl);
+    QString markdownCode = importMediaFromDataUrl(currentNote, dataUrl);
 
     if (markdownCode.isEmpty()) {
         return false;
@@ -12326,8 +14285,10 @@ void MainWindow::on_actionReattach_panels_triggered() {
     }
 }
 
-void MainWindow::on_actionAIAssistant_triggered()
-{
+/**
+ * Returns the working directory of the local AI assistant (its kb lives below it)
+ */
+QString MainWindow::aiAssistantWorkDir() {
     const QString baseDir = QCoreApplication::applicationDirPath();
 
 #if defined(QT_DEBUG)
@@ -12336,7 +14297,32 @@ void MainWindow::on_actionAIAssistant_triggered()
     const QString aiSubdir = "AIassistant/x64/Release";
 #endif
 
-    const QString workDir = QDir(baseDir).filePath(aiSubdir);
+    return QDir(baseDir).filePath(aiSubdir);
+}
+
+/**
+ * Appends a change event to the journal the AI assistant's note indexer drains
+ * ("F<TAB>path" for note files, "D<TAB>path" for directories)
+ */
+void MainWindow::appendAiAssistantNoteEvent(const QString &path, bool isDirectory) {
+    // the kb directory only exists once the assistant was started
+    const QDir kbDir(QDir(aiAssistantWorkDir()).filePath(QStringLiteral("kb")));
+    if (path.isEmpty() || !kbDir.exists()) {
+        return;
+    }
+
+    QFile file(kbDir.filePath(QStringLiteral("note_events.journal")));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        return;
+    }
+
+    file.write((isDirectory ? QByteArrayLiteral("D\t") : QByteArrayLiteral("F\t")) +
+               QDir::toNativeSeparators(path).toUtf8() + '\n');
+}
+
+void MainWindow::on_actionAIAssistant_triggered()
+{
+    const QString workDir = aiAssistantWorkDir();
     const QString exePath = QDir(workDir).filePath("AIassistant.exe");
 
     qDebug() << "exePath =" << QDir::toNativeSeparators(exePath);
@@ -12348,7 +14334,11 @@ void MainWindow::on_actionAIAssistant_triggered()
         return;
     }
 
-    if (!QProcess::startDetached(exePath, {}, workDir)) {
+    // the assistant keeps its knowledge base in sync with the current note folder
+    const QStringList arguments{QStringLiteral("--note-folder"),
+                                QDir::toNativeSeparators(NoteFolder::currentLocalPath())};
+
+    if (!QProcess::startDetached(exePath, arguments, workDir)) {
         QMessageBox::warning(this, tr("fail to initiate"),
                              tr("Unable to launch AIassistant.exe, please check the path or dependent DLLs."));
     }
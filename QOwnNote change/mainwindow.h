@@ -17,12 +17,24 @@
 
 
 #include <entities/note.h>
+#include <helpers/imagedownloadpool.h>
+#include <helpers/mediastore.h>
+#include <helpers/notechangereconciler.h>
+#include <helpers/notefolderdatabasemerger.h>
+#include <helpers/notelinkindex.h>
+#include <helpers/noteidbitmap.h>
+#include <helpers/notepreviewpatcher.h>
+#include <helpers/notewritequeue.h>
+#include <helpers/settingssnapshot.h>
 #include <libraries/qhotkey/QHotkey/qhotkey.h>
 #include <services/webappclientservice.h>
 #include <widgets/logwidget.h>
 
+#include <QElapsedTimer>
 #include <QFileSystemWatcher>
+#include <QFutureWatcher>
 #include <QMainWindow>
+#include <QPair>
 #include <QSystemTrayIcon>
 
 #include "entities/notehistory.h"
@@ -43,6 +55,7 @@ class QMimeData;
 class QActionGroup;
 class QListWidgetItem;
 class QFileSystemWatcher;
+class NoteFolderWatcher;
 class QFileDialog;
 class QEvent;
 class QSystemTrayIcon;
@@ -81,6 +94,7 @@ class WaitingSpinnerWidget;
 class NoteFilePathLabel;
 class NoteRelationScene;
 struct TagHeader;
+struct TagTreeData;
 
 // forward declaration because of "xxx does not name a type"
 class TodoDialog;
@@ -291,6 +305,10 @@ class MainWindow : public QMainWindow {
 
     void notesWereModified(const QString &str);
 
+    void noteFolderWatcherOverflowed();
+
+    void processNoteFolderChanges();
+
     void on_actionSet_ownCloud_Folder_triggered();
 
     void on_searchLineEdit_textChanged(const QString &arg1);
@@ -441,6 +459,21 @@ class MainWindow : public QMainWindow {
 
     void noteViewUpdateTimerSlot();
 
+    void notePreviewJobFinished();
+
+    void externalChangeCheckFinished();
+
+    void storeUpdatedNotesToDiskInBackground();
+
+    void noteWritesFinished(const QVector<NoteWriteQueue::Write> &writes);
+
+    void noteFolderDatabaseMergeProgress(int done, int total);
+
+    void noteFolderDatabasesMerged(const QVector<NoteFolderDatabaseMerger::Result> &results);
+
+    void imageDownloadFinished(const QUrl &url, const QByteArray &data = QByteArray(),
+                               const QString &suffix = QString());
+
     void autoReadOnlyModeTimerSlot();
 
     void gitCommitCurrentNoteFolder();
@@ -541,6 +574,8 @@ class MainWindow : public QMainWindow {
 
     void on_actionManage_stored_images_triggered();
 
+    void removeUnusedMediaFiles();
+
     void on_actionGitter_triggered();
 
     void on_actionUnlock_panels_toggled(bool arg1);
@@ -771,8 +806,14 @@ class MainWindow : public QMainWindow {
     Ui::MainWindow *ui;
     QString notesPath;
     QFileSystemWatcher noteDirectoryWatcher;
+    NoteFolderWatcher *_noteFolderWatcher = nullptr;    // Linux: inotify, one watch per directory
+    // settings of the hot paths, see readSettingsFromSettingsDialog()
+    SettingsSnapshot _settingsSnapshot;
     Note currentNote;
-    QString _currentNoteTextHash;
+    quint64 _currentNoteTextHash = 0;
+    // document revision of the note text edit at which its text was set or
+    // stored to currentNote, see noteTextEditTextWasUpdated()
+    int _noteTextStoredRevision = -1;
     NoteDiffDialog *noteDiffDialog;
     UpdateService *updateService;
     bool showSystemTray;
@@ -788,6 +829,17 @@ class MainWindow : public QMainWindow {
     QTimer *_gitCommitTimer;
     QTimer *_todoListTimer;
     bool _noteViewNeedsUpdate;
+    // background conversion of the note preview, the result is paired with
+    // the preview revision it was started for
+    QFutureWatcher<QPair<int, QString>> *_notePreviewWatcher = nullptr;
+    int _notePreviewRevision = 0;
+    bool _notePreviewJobPending = false;
+    // the text to convert and the directory of its note, resolved on this thread
+    QString _notePreviewJobText;
+    QString _notePreviewJobPath;
+    // background comparison of the current note file, see checkCurrentNoteForExternalChange()
+    QFutureWatcher<NoteChangeReconciler::Result> *_externalChangeWatcher = nullptr;
+    bool _externalChangeCheckPending = false;
     NoteHistory noteHistory;
     QHash<int, NoteHistoryItem> noteBookmarks;
     QPushButton *_updateAvailableButton;
@@ -809,13 +861,45 @@ class MainWindow : public QMainWindow {
     bool _searchLineEditFromCompleter;
     bool _isNotesDirectoryWasModifiedDisabled;
     bool _isNotesWereModifiedDisabled;
+    int _directoryWatcherWorkaroundGeneration = 0;
+    QTimer *_noteFolderChangeTimer = nullptr;
+    QSet<QString> _pendingNoteFileChanges;
+    QSet<QString> _pendingNoteDirectoryChanges;
+    // what the note tagging hook returned for a note, by note id, see
+    // handleScriptingNotesTagUpdating()
+    struct NoteTaggingHookResult {
+        QString fileName;
+        int noteSubFolderId = 0;
+        quint64 fingerprint = 0;
+        QStringList tagNames;
+        QVector<int> tagIds;
+    };
+    QHash<int, NoteTaggingHookResult> _noteTaggingHookResults;
+    QElapsedTimer _noteFolderChangesPendingSince;
+    bool _processingNoteFolderChanges = false;
+    // write-behind of the current note, see storeUpdatedNotesToDiskInBackground()
+    NoteWriteQueue *_noteWriteQueue = nullptr;
+    bool _noteWriteWasWatched = false;
+    NoteFolderDatabaseMerger *_noteFolderDatabaseMerger = nullptr;
+    // the links around the current note the backlinks and the note relation
+    // view were last built for, see NoteLinkIndex
+    QString _backlinkSignature;
+    QString _noteRelationSignature;
+    // images of pasted html, url -> (note id, placeholder in the note text), see
+    // insertHtmlAsMarkdownIntoCurrentNote()
+    ImageDownloadPool *_imageDownloadPool = nullptr;
+    QHash<QUrl, QVector<QPair<int, QString>>> _pendingImageDownloads;
     bool _isDefaultShortcutInitialized;
     QList<QShortcut *> _menuShortcuts;
     bool _showNotesFromAllNoteSubFolders;
-    QVector<int> _buildNotesIndexBeforeNoteIdList;
-    QVector<int> _buildNotesIndexBeforeNoteSubFolderIdList;
-    QList<int> _buildNotesIndexAfterNoteIdList;
-    QList<int> _buildNotesIndexAfterNoteSubFolderIdList;
+    bool _buildingNotesIndex = false;
+    bool _noteTreeWidgetDecorationScheduled = false;
+    // note id -> top level item of the note list, see findNoteInNoteTreeWidget()
+    QHash<int, QTreeWidgetItem *> _noteTreeWidgetItems;
+    bool _noteTreeWidgetItemIndexEnabled = false;
+    NoteIdBitmapCache _tagFilterNoteIds;
+    // only set while reloadTagTree() builds the tree
+    const TagTreeData *_tagTreeData = nullptr;
     QScrollArea *_noteTagButtonScrollArea;
     QDockWidget *_taggingDockWidget;
     QDockWidget *_noteSubFolderDockWidget;
@@ -860,6 +944,7 @@ class MainWindow : public QMainWindow {
     QList<QAction *> _noteTextEditContextMenuActions;
     QList<QAction *> _noteListContextMenuActions;
     QString _notePreviewHash;
+    NotePreviewPatcher _notePreviewPatcher;
     int _gitCommitInterval;
     bool _noteEditIsCentralWidget;
     bool _lastNoteSelectionWasMultiple;
@@ -912,6 +997,10 @@ class MainWindow : public QMainWindow {
                              bool ignorePreviewVisibility = false,
                              bool allowRestoreCursorPosition = false);
 
+    void setNotePreviewHtml(const QString &html);
+
+    void startNotePreviewJob();
+
     void loadNoteFolderListMenu();
 
     void storeRecentNoteFolder(const QString &addFolderName, const QString &removeFolderName);
@@ -964,6 +1053,11 @@ class MainWindow : public QMainWindow {
 
     bool insertMedia(QFile *file, QString title = QString());
 
+    QString getInsertMediaMarkdown(Note &note, QFile *file, bool addNewLine = true,
+                                   QString title = QString());
+
+    QString importMediaFromDataUrl(Note &note, const QString &dataUrl);
+
     static bool isValidMediaFile(QFile *file);
 
     static bool isValidNoteFile(QFile *file);
@@ -996,6 +1090,8 @@ class MainWindow : public QMainWindow {
 
     void buildTagTreeForParentItem(QTreeWidgetItem *parent = nullptr, bool topLevel = false);
 
+    void buildTagTreeFromData(QTreeWidgetItem *parent, int parentId);
+
     void buildTagMoveMenuTree(QMenu *parentMenu, int parentTagId = 0);
 
     void buildBulkNoteTagMenuTree(QMenu *parentMenu, int parentTagId = 0);
@@ -1024,6 +1120,16 @@ class MainWindow : public QMainWindow {
 
     bool addNoteToNoteTreeWidget(const Note &note, QTreeWidgetItem *parent = nullptr);
 
+    QTreeWidgetItem *createNoteTreeWidgetItem(const Note &note) const;
+
+    void decorateNoteTreeWidgetItem(const Note &note, QTreeWidgetItem *noteItem);
+
+    void decorateVisibleNoteTreeWidgetItems();
+
+    void scheduleNoteTreeWidgetDecoration();
+
+    void invalidateNoteTreeWidgetDecoration();
+
     QTreeWidgetItem *findNoteInNoteTreeWidget(const Note &note);
 
     void jumpToNoteOrCreateNew(bool disableLoadNoteDirectoryList = false);
@@ -1102,6 +1208,9 @@ class MainWindow : public QMainWindow {
 
     bool insertTextAsAttachment(const QString &text);
 
+    void replaceImageDownloadPlaceholder(int noteId, const QString &placeholder,
+                                         const QString &markdownCode);
+
     void updatePanelsSortOrder();
 
     void updateNotesPanelSortOrder();
@@ -1120,6 +1229,14 @@ class MainWindow : public QMainWindow {
     void directoryWatcherWorkaround(bool isNotesDirectoryWasModifiedDisabled,
                                     bool alsoHandleNotesWereModified = false);
 
+    void queueNoteFolderChange(const QString &path, bool isDirectory);
+
+    bool updateNotesIndexForChanges(const QSet<QString> &files, const QSet<QString> &directories);
+
+    void checkCurrentNoteForExternalChange();
+
+    void handleCurrentNoteExternalChange();
+
     static void setMenuEnabled(QMenu *menu, bool enabled);
 
     bool undoFormatting(const QString &formatter);
@@ -1153,7 +1270,7 @@ class MainWindow : public QMainWindow {
     QTextDocument *getDocumentForPreviewExport();
 
     void noteTextEditTextWasUpdated();
-    void removeNoteFromNoteTreeWidget(Note &note) const;
+    void removeNoteFromNoteTreeWidget(Note &note);
     void initGlobalKeyboardShortcuts();
     void resizeTagTreeWidgetColumnToContents() const;
     void updateCurrentTabData(const Note &note) const;
@@ -1172,5 +1289,10 @@ class MainWindow : public QMainWindow {
     static void handleDockWidgetLocking(QDockWidget *dockWidget);
     void setupNoteRelationScene();
     void updateNoteGraphicsView();
+
+    static QString noteLinkSignature(const QString &notePath,
+                                     const QVector<NoteLinkIndex::Link> &links);
     void addDirectoryToDirectoryWatcher(const QString &path);
+    static QString aiAssistantWorkDir();
+    void appendAiAssistantNoteEvent(const QString &path, bool isDirectory = false);
 };